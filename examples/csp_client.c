@@ -143,6 +143,9 @@ static csp_iface_t * add_interface(enum DeviceType device_type, const char * dev
 		default_iface->is_default = 1;
 	}
 
+	/* The interface was added before its address and default flag were set */
+	csp_iflist_update();
+
 	return default_iface;
 }
 
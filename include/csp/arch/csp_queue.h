@@ -28,6 +28,10 @@ typedef StaticQueue_t csp_static_queue_t;
 #include <zephyr/kernel.h>
 typedef struct k_msgq * csp_queue_handle_t;
 typedef struct k_msgq csp_static_queue_t;
+#elif (CSP_QUEUE_LOCKFREE)
+typedef struct ring_queue_s ring_queue_t; // Opaque pointer
+typedef ring_queue_t * csp_queue_handle_t;
+typedef void * csp_static_queue_t;
 #else
 typedef struct pthread_queue_s pthread_queue_t; // Opaque pointer
 typedef pthread_queue_t * csp_queue_handle_t;
@@ -86,6 +90,32 @@ int csp_queue_dequeue(csp_queue_handle_t handle, void *buf, uint32_t timeout);
  */
 int csp_queue_dequeue_isr(csp_queue_handle_t handle, void * buf, int * pxTaskWoken);
 
+/**
+ * Enqueue (back) multiple values, with a single wakeup of the reader.
+ *
+ * Waits for free space, then adds as many of the values as fit without waiting further.
+ *
+ * @param[in] handle queue.
+ * @param[in] values array of \a count values to add (by copy).
+ * @param[in] count number of values.
+ * @param[in] timeout timeout, time to wait for free space
+ * @return Number of values added, 0 on timeout.
+ */
+int csp_queue_enqueue_many(csp_queue_handle_t handle, const void * values, int count, uint32_t timeout);
+
+/**
+ * Dequeue multiple values (front), with a single wakeup of any writer.
+ *
+ * Waits for an element, then extracts up to \a count elements without waiting further.
+ *
+ * @param[in] handle queue.
+ * @param[out] buf array with room for \a count extracted elements (by copy).
+ * @param[in] count max number of elements.
+ * @param[in] timeout timeout, time to wait for element in queue.
+ * @return Number of elements extracted, 0 on timeout.
+ */
+int csp_queue_dequeue_many(csp_queue_handle_t handle, void * buf, int count, uint32_t timeout);
+
 /**
  * Queue size.
  *
@@ -109,6 +139,14 @@ int csp_queue_size_isr(csp_queue_handle_t handle);
  */
 int csp_queue_free(csp_queue_handle_t handle);
 
+/**
+ * Delete queue object (handle), releasing any memory allocated for it.
+ * Items still in the queue are not freed.
+ *
+ * @param[in] handle handle queue.
+ */
+void csp_queue_delete(csp_queue_handle_t handle);
+
 /**
  * Empty queue object by removing all items (handle).
  *
@@ -45,6 +45,11 @@ typedef struct csp_conf_s {
    const char *revision;       /**< Revision, returned by the #CSP_CMP_IDENT request */
    uint32_t conn_dfl_so;       /**< Default connection options. Options will always be or'ed onto new connections, see csp_connect() */
    uint8_t dedup;              /**< Enable CSP deduplication. 0 = off, 1 = always on, 2 = only on forwarded packets,  */
+   uint32_t dedup_count;       /**< Number of packets remembered for deduplication, 0 = CSP_DEDUP_MAX. Read when csp_init() is called */
+   uint32_t dedup_window_ms;   /**< Only packets seen under this many ms ago are duplicates, 0 = 100. Read when csp_init() is called */
+   uint32_t buffer_count;      /**< Maximum number of packet buffers, 0 = CSP_BUFFER_COUNT. Only used with CSP_BUFFER_DYNAMIC */
+   uint8_t buffer_hugepages;   /**< Back packet buffers with huge pages when available. Only used with CSP_BUFFER_DYNAMIC */
+   uint32_t conn_max;          /**< Maximum number of connections, 0 = CSP_CONN_MAX. Only used with CSP_CONN_DYNAMIC */
 } csp_conf_t;
 
 extern csp_conf_t csp_conf;
@@ -112,6 +117,20 @@ void csp_send(csp_conn_t *conn, csp_packet_t *packet);
  */
 void csp_send_prio(uint8_t prio, csp_conn_t *conn, csp_packet_t *packet);
 
+/**
+ * Send packet on a connection, without waiting.
+ * On an RDP connection with a full window, the packet is not sent and #CSP_ERR_AGAIN returned.
+ * Send it again after the #CSP_RDP_EVENT_WRITABLE event, see csp_rdp_set_event_callback().
+ *
+ * Unlike csp_send(), the packet buffer is only freed if the call succeeds, on error it is
+ * still owned by the caller.
+ *
+ * @param[in] conn connection
+ * @param[in] packet packet to send
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_AGAIN if the RDP window is full, otherwise an error code.
+ */
+int csp_send_nonblock(csp_conn_t *conn, csp_packet_t *packet);
+
 /**
  * Perform an entire request & reply transaction.
  * Creates a connection, send \a outbuf, wait for reply, copy reply to \a inbuf and close the connection.
@@ -285,6 +304,7 @@ bool csp_conn_is_active(csp_conn_t *conn);
  *
  * @param[in] socket socket
  * @param[in] backlog max length of backlog queue. The backlog queue holds incoming connections, waiting to be returned by call to csp_accept().
+ *                    Only used with CSP_CONN_DYNAMIC, otherwise the backlog queue holds CSP_CONN_RXQUEUE_LEN connections.
  * @return #CSP_ERR_NONE on success, otherwise an error code.
 */
 int csp_listen(csp_socket_t *socket, size_t backlog);
@@ -311,10 +331,67 @@ int csp_bind_callback(csp_callback_t callback, uint8_t port);
 /**
  * Route packet from the incoming router queue and check RDP timeouts.
  * In order for incoming packets to routed and RDP timeouts to be checked, this function must be called regularly.
+ * It blocks until a packet arrives or the next RDP timeout is due, which is forever when idle.
  * @return #CSP_ERR_NONE on success, otherwise an error code.
  */
 int csp_route_work(void);
 
+#if (CSP_POSIX || __DOXYGEN__)
+/**
+ * Start router worker threads (POSIX only).
+ *
+ * Incoming packets are spread over the workers by a hash of (src, dst, sport, dport), so packets of
+ * one flow are always routed by the same worker and stay in order. Use this instead of calling
+ * csp_route_work() from a router task, and call it before any interface starts receiving.
+ * Workers run until the process exits, so this can only be called once.
+ *
+ * @param[in] count number of workers, 1 to CSP_ROUTE_WORKERS
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL on invalid count, #CSP_ERR_BUSY if workers are
+ *         already running, otherwise an error code.
+ */
+int csp_route_start_workers(unsigned int count);
+#endif
+
+/**
+ * Router input queue dequeue policy, used when CSP_USE_QOS is enabled.
+ */
+typedef enum {
+	CSP_QFIFO_STRICT = 0,   //!< Always serve the highest priority packet first (default)
+	CSP_QFIFO_WEIGHTED = 1, //!< Serve each priority level in proportion to its weight
+} csp_qfifo_policy_t;
+
+/**
+ * Router input queue counters for one priority level.
+ */
+typedef struct {
+	uint32_t depth; //!< Packets currently queued on the level
+	uint32_t drops; //!< Packets dropped because the level was full
+} csp_qfifo_stats_t;
+
+/**
+ * Set the router input queue dequeue policy.
+ *
+ * With #CSP_QFIFO_WEIGHTED, each priority level is served up to its weight in packets per round,
+ * highest priority first. Levels with packets but no credit left are only served once all other
+ * levels are empty, so the router never idles while packets are queued.
+ * Without CSP_USE_QOS there is only one level and the policy has no effect.
+ *
+ * @param[in] policy dequeue policy
+ * @param[in] weights packets per round for each #csp_prio_t, indexed by priority. Ignored for
+ *                    #CSP_QFIFO_STRICT, and may be NULL to keep the current weights.
+ */
+void csp_qfifo_set_policy(csp_qfifo_policy_t policy, const uint8_t weights[CSP_PRIO_LOW + 1]);
+
+/**
+ * Get router input queue counters for a priority level.
+ * Without CSP_USE_QOS all priorities share one queue, so depth is the same for all of them.
+ *
+ * @param[in] prio priority level
+ * @param[out] stats counters
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL on invalid priority.
+ */
+int csp_qfifo_get_stats(csp_prio_t prio, csp_qfifo_stats_t * stats);
+
 /**
  * Set the bridge interfaces.
  *
@@ -474,6 +551,58 @@ void csp_rdp_get_opt(unsigned int *window_size, unsigned int *conn_timeout_ms,
 	  unsigned int *packet_timeout_ms, unsigned int *delayed_acks,
 	  unsigned int *ack_timeout, unsigned int *ack_delay_count);
 
+/**
+ * RDP connection statistics, see csp_rdp_get_stats()
+ */
+typedef struct {
+	uint32_t srtt;        //!< Smoothed round trip time in ms, 0 until measured
+	uint32_t rttvar;      //!< Round trip time variation in ms
+	uint32_t rto;         //!< Retransmission timeout in ms, the packet timeout until the round trip time is measured
+	uint32_t cwnd;        //!< Congestion window, max unacknowledged packets
+	uint32_t window_size; //!< Negotiated window size, the congestion window grows no larger
+	uint32_t retransmits; //!< Packets retransmitted on the connection
+	uint32_t fast_retransmits; //!< Of those, packets retransmitted on extended acknowledgements before they timed out
+} csp_rdp_stats_t;
+
+/**
+ * Get round trip time and congestion window of an RDP connection.
+ *
+ * The retransmission timeout adapts to the measured round trip time, and the congestion window
+ * shrinks when packets time out and grows back while they are acknowledged.
+ *
+ * @param[in] conn RDP connection
+ * @param[out] stats statistics
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL if the connection is not an RDP connection.
+ */
+int csp_rdp_get_stats(const csp_conn_t * conn, csp_rdp_stats_t * stats);
+
+#define CSP_RDP_EVENT_WRITABLE 0x01 //!< The window has room again, after csp_send_nonblock() returned #CSP_ERR_AGAIN
+#define CSP_RDP_EVENT_ACKED    0x02 //!< Sent packets were acknowledged by the receiver
+#define CSP_RDP_EVENT_CLOSED   0x04 //!< The connection was reset by the other end or timed out, and can only be closed
+
+/**
+ * RDP event callback, see csp_rdp_set_event_callback()
+ *
+ * @param[in] conn connection
+ * @param[in] events CSP_RDP_EVENT_ flags
+ * @param[in] arg argument given to csp_rdp_set_event_callback()
+ */
+typedef void (*csp_rdp_event_callback_t)(csp_conn_t * conn, unsigned int events, void * arg);
+
+/**
+ * Set the event callback of an RDP connection.
+ *
+ * Lets a single task drive many RDP connections with csp_send_nonblock(). The callback is called
+ * from the router task, so it must not block, and should only hand the events to the task sending,
+ * e.g. through a queue. It is cleared by csp_close().
+ *
+ * @param[in] conn RDP connection
+ * @param[in] callback callback, or NULL to remove it
+ * @param[in] arg passed to the callback
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL if the connection is not an RDP connection.
+ */
+int csp_rdp_set_event_callback(csp_conn_t * conn, csp_rdp_event_callback_t callback, void * arg);
+
 /**
  * Set platform specific memory copy function.
  */
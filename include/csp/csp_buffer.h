@@ -28,6 +28,18 @@ extern "C" {
  */
 csp_packet_t * csp_buffer_get(size_t unused);
 
+/**
+ * Get free buffer with room for at least \a size bytes of data (from task context).
+ *
+ * If size class pools are configured (CSP_BUFFER_SMALL_COUNT, CSP_BUFFER_MEDIUM_COUNT), the buffer is taken
+ * from the smallest class that fits, falling back to larger classes and finally to the main pool used by
+ * csp_buffer_get(). Use csp_buffer_data_size() to get the actual capacity of the returned buffer.
+ *
+ * @param[in] size minimum number of data bytes, including any trailers (CRC32, HMAC) added on transmission
+ * @return Buffer pointer to #csp_packet_t or NULL if no buffers available or \a size exceeds #CSP_BUFFER_SIZE
+ */
+csp_packet_t * csp_buffer_get_sized(size_t size);
+
 /**
  * Get a buffer or get killed (from task context)
  *
@@ -81,15 +93,27 @@ csp_packet_t * csp_buffer_clone(const csp_packet_t * packet);
 
 /**
  * Copy the contents of a buffer.
+ * Only the part of the data area in use by the packet (\a length) or its frame (\a frame_length) is copied.
  *
  * @param[in] src Source buffer.
  * @param[out] dst Destination buffer.
  */
 void csp_buffer_copy(const csp_packet_t * src, csp_packet_t * dst);
 
+/**
+ * Return the data capacity of a buffer.
+ *
+ * The capacity is read from \a packet->size_class, which csp_buffer_get_sized() sets for buffers from a
+ * size class pool. Packets from the main pool, or not allocated by CSP, have a full data area.
+ *
+ * @param[in] packet buffer
+ * @return number of bytes available in \a packet->data, #CSP_BUFFER_SIZE for buffers from the main pool
+ */
+size_t csp_buffer_data_size(const csp_packet_t * packet);
+
 /**
  * Return number of remaining/free buffers.
- * The number of buffers is set by csp_init().
+ * The number of buffers is set by csp_init(). Buffers in the size class pools are not included.
  *
  * @return number of remaining/free buffers
  */
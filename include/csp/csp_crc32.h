@@ -58,6 +58,30 @@ void csp_crc32_init(csp_crc32_t *crc);
 */
 void csp_crc32_update(csp_crc32_t * crc, const void * data, uint32_t length);
 
+/**
+   Copy a chunk of data and update the CRC32 calculation with it, in one pass over the data.
+   @param[in] crc CRC32 object previously created, and init'ed by the caller
+   @param[out] dst destination of the copy
+   @param[in] src data to copy and update the checksum on
+   @param[in] length number of bytes to copy
+*/
+void csp_crc32_copy(csp_crc32_t * crc, void * dst, const void * src, uint32_t length);
+
+/**
+ * Copy received bytes into the frame of a packet, for interface drivers.
+ *
+ * The CRC32 of the data, between the CSP header and the last 4 bytes of the frame, is computed
+ * on the way and stored in the packet. csp_crc32_verify() and deduplication use it instead of
+ * reading the data again. Call after csp_id_setup_rx(), with frame_length set to the length of
+ * the whole frame, and with the frame copied in order, in one or more calls.
+ *
+ * @param[in] packet CSP packet being received
+ * @param[in] offset offset of the bytes in the frame
+ * @param[in] src received bytes
+ * @param[in] length number of bytes received
+ */
+void csp_crc32_copy_frame(csp_packet_t * packet, uint32_t offset, const void * src, uint32_t length);
+
 /**
    Finalize the CRC32 checksum calculation.
    @param[in] crc CRC32 object previously created, init'ed and updated by the caller
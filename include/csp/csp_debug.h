@@ -30,6 +30,10 @@ extern uint8_t csp_dbg_conn_ovf;
 extern uint8_t csp_dbg_conn_noroute;
 extern uint8_t csp_dbg_inval_reply;
 
+/** Deduplication counters, packets found to be duplicates and packets seen for the first time */
+extern uint32_t csp_dbg_dedup_hit;
+extern uint32_t csp_dbg_dedup_miss;
+
 /* Central errno */
 extern uint8_t csp_dbg_errno;
 #define CSP_DBG_ERR_CORRUPT_BUFFER 1
@@ -43,6 +47,7 @@ extern uint8_t csp_dbg_errno;
 #define CSP_DBG_ERR_ALREADY_CLOSED 10
 #define CSP_DBG_ERR_INVALID_POINTER 11
 #define CSP_DBG_ERR_CLOCK_SET_FAIL 12
+#define CSP_DBG_ERR_PORTS_EXHAUSTED 13
 
 /* CAN protocol specific errno */
 extern uint8_t csp_dbg_can_errno;
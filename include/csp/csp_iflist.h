@@ -13,6 +13,8 @@ extern "C" {
 
 /**
  * Add interface to the list.
+ * Set the address, netmask and default flag of the interface first, or call csp_iflist_update()
+ * after changing them.
  *
  * @param[in] iface The interface must remain valid as long as the application is running.
  */
@@ -25,6 +27,13 @@ void csp_iflist_add(csp_iface_t * iface);
  */
 void csp_iflist_remove(csp_iface_t * ifc);
 
+/**
+ * Update the interface index after changing the address, netmask or default flag of an interface
+ * already in the list. The router looks up interfaces in the index, which csp_iflist_add(),
+ * csp_iflist_remove() and csp_iflist_check_dfl() update by themselves.
+ */
+void csp_iflist_update(void);
+
 csp_iface_t * csp_iflist_get_by_name(const char * name);
 csp_iface_t * csp_iflist_get_by_addr(uint16_t addr);
 csp_iface_t * csp_iflist_get_by_subnet(uint16_t addr, csp_iface_t * from);
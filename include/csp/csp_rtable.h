@@ -17,21 +17,44 @@ extern "C" {
 
 #define CSP_NO_VIA_ADDRESS	0xFFFF
 
+/**
+ * Route flags.
+ *
+ * When several routes share the longest matching prefix, every redundant route gets a copy of
+ * the packet, and one of the remaining (multipath) routes is picked per flow, in proportion to the
+ * route weights. A flow is identified by source, destination and ports, so packets of a
+ * connection always take the same path and stay in order.
+ */
+#define CSP_ROUTE_REDUNDANT	0x01 /**< Replicate packets onto this route */
+
 typedef struct csp_route_s {
 	uint16_t address;
 	uint16_t netmask;
    uint16_t via;
    csp_iface_t * iface;
+   uint8_t weight; /**< Share of the flows, only used by multipath routes */
+   uint8_t flags;  /**< CSP_ROUTE_ flags */
 } csp_route_t;
 
 /**
  * Loop through routes backwards and find routes that match on addr and mask from start_route
  */
 csp_route_t * csp_rtable_search_backward(csp_route_t * start_route);
+
+/**
+ * Find the route to a destination address.
+ * Changes to the routing table are published as a new table, and a returned route stays valid
+ * until the table has been changed a few times (CSP_RTABLE_VERSIONS - 1).
+ *
+ * @param[in] dest_address destination address.
+ * @return newest route with the longest matching prefix, NULL if none.
+ */
 csp_route_t * csp_rtable_find_route(uint16_t dest_address);
 
 /**
  * Set route to destination address/node.
+ * The route is redundant, i.e. it gets a copy of every packet routed to the prefix.
+ * @see csp_rtable_set_route()
  *
  * @param[in] dest_address destination address.
  * @param[in] netmask number of bits in netmask (set to -1 for maximum number of bits)
@@ -41,6 +64,21 @@ csp_route_t * csp_rtable_find_route(uint16_t dest_address);
  */
 int csp_rtable_set(uint16_t dest_address, int netmask, csp_iface_t *ifc, uint16_t via);
 
+/**
+ * Set route to destination address/node, with weight and flags.
+ * Setting an existing route (same address, netmask and interface) updates via, weight and flags.
+ *
+ * @param[in] dest_address destination address.
+ * @param[in] netmask number of bits in netmask (set to -1 for maximum number of bits)
+ * @param[in] ifc interface.
+ * @param[in] via assosicated via address.
+ * @param[in] weight share of the flows for a multipath route, 0 is taken as 1.
+ * @param[in] flags CSP_ROUTE_ flags, 0 for a multipath route.
+ * @return #CSP_ERR_NONE on success, or an error code. #CSP_ERR_BUSY if senders still use every
+ *         older version of the table.
+ */
+int csp_rtable_set_route(uint16_t dest_address, int netmask, csp_iface_t *ifc, uint16_t via, uint8_t weight, uint8_t flags);
+
 #if (CSP_HAVE_STDIO)
 /**
  * Save routing table as a string (readable format).
@@ -55,8 +93,11 @@ int csp_rtable_save(char * buffer, size_t buffer_size);
 /**
  * Load routing table from a string.
  * Table will be loaded on-top of existing routes, possibly overwriting existing entries.
- * Format: \<address\>[/mask] \<interface\> [via][, next entry]
+ * The router sees all of the routes at once, or none of them if the string is invalid.
+ * Format: \<address\>[/mask] \<interface\> [via] [w\<weight\>][, next entry]
  * Example: "0/0 CAN, 8 KISS, 10 I2C 10", same as "0/0 CAN, 8/5 KISS, 10/5 I2C 10".
+ * Routes with a weight are multipath routes, the others are redundant:
+ * "0/0 RADIO1 w2, 0/0 RADIO2 w1" sends two out of three flows on RADIO1.
  * @see csp_rtable_save(), csp_rtable_clear(), csp_rtable_free()
  *
  * @param[in] rtable routing table (nul terminated)
@@ -64,6 +105,16 @@ int csp_rtable_save(char * buffer, size_t buffer_size);
  */
 int csp_rtable_load(const char * rtable);
 
+/**
+ * Replace the routing table with the routes in a string.
+ * The router sees the new routes at once, and keeps the old routes if the string is invalid.
+ * @see csp_rtable_load() for the format.
+ *
+ * @param[in] rtable routing table (nul terminated)
+ * @return CSP_ERR or number of entries.
+ */
+int csp_rtable_reload(const char * rtable);
+
 /**
  * Check string for valid routing elements.
  *
@@ -87,6 +138,12 @@ inline int csp_rtable_load(const char * rtable) {
    return CSP_ERR_NOSYS;
 }
 
+inline int csp_rtable_reload(const char * rtable) {
+   (void)rtable; /* Avoid compiler warnings about unused parameter */
+
+   return CSP_ERR_NOSYS;
+}
+
 inline int csp_rtable_check(const char * rtable) {
    (void)rtable; /* Avoid compiler warnings about unused parameter */
 
@@ -96,6 +153,7 @@ inline int csp_rtable_check(const char * rtable) {
 
 /**
  * Clear routing table and add loopback route.
+ * Like other changes, it is published as a new table, so the router never sees a half empty table.
  * @see csp_rtable_free()
  */
 void csp_rtable_clear(void);
@@ -124,6 +124,9 @@ typedef struct csp_packet_s {
 	uint16_t remain;            /*< Remaining packets */
 	uint32_t cfpid;             /*< Connection CFP identification number */
 	uint32_t last_used;         /*< Timestamp in ms for last use of buffer */
+	uint32_t rx_crc;            /*< CRC32 of the data before its last 4 bytes, computed by the driver while receiving */
+	uint8_t rx_crc_valid;       /*< rx_crc is set, until the packet is sent or its CRC32 verified */
+	uint8_t size_class;         /*< Buffer size class, see csp_buffer_data_size(), 0 for a full data area */
 	uint8_t * frame_begin;
 	uint16_t frame_length;
 
@@ -5,6 +5,7 @@
 
 #include <FreeRTOS.h>
 #include <queue.h>
+#include <task.h>
 
 csp_queue_handle_t csp_queue_create_static(int length, size_t item_size, char * buffer, csp_static_queue_t * queue) {
 	return xQueueCreateStatic(length, item_size, (uint8_t *)buffer, queue);
@@ -42,6 +43,52 @@ int csp_queue_dequeue_isr(csp_queue_handle_t handle, void * buf, int * task_woke
 	return CSP_QUEUE_ERROR;
 }
 
+int csp_queue_enqueue_many(csp_queue_handle_t handle, const void * values, int count, uint32_t timeout) {
+	const char * item = values;
+	UBaseType_t item_size = uxQueueGetQueueItemSize(handle);
+	int n = 0;
+
+	/* Readers are only scheduled once all values that fit have been added */
+	vTaskSuspendAll();
+	while ((n < count) && (xQueueSendToBack(handle, item + n * item_size, 0) == pdPASS)) {
+		n++;
+	}
+	xTaskResumeAll();
+
+	/* Queue was full, wait for room for the first value */
+	if ((n == 0) && (count > 0) && (timeout > 0)) {
+		if (csp_queue_enqueue(handle, item, timeout) != CSP_QUEUE_OK) {
+			return 0;
+		}
+		n = 1 + csp_queue_enqueue_many(handle, item + item_size, count - 1, 0);
+	}
+
+	return n;
+}
+
+int csp_queue_dequeue_many(csp_queue_handle_t handle, void * buf, int count, uint32_t timeout) {
+	char * item = buf;
+	UBaseType_t item_size = uxQueueGetQueueItemSize(handle);
+	int n = 0;
+
+	/* Writers are only scheduled once all available elements have been taken */
+	vTaskSuspendAll();
+	while ((n < count) && (xQueueReceive(handle, item + n * item_size, 0) == pdPASS)) {
+		n++;
+	}
+	xTaskResumeAll();
+
+	/* Queue was empty, wait for the first element */
+	if ((n == 0) && (count > 0) && (timeout > 0)) {
+		if (csp_queue_dequeue(handle, item, timeout) != CSP_QUEUE_OK) {
+			return 0;
+		}
+		n = 1 + csp_queue_dequeue_many(handle, item + item_size, count - 1, 0);
+	}
+
+	return n;
+}
+
 int csp_queue_size(csp_queue_handle_t handle) {
 	return uxQueueMessagesWaiting(handle);
 }
@@ -54,6 +101,10 @@ int csp_queue_free(csp_queue_handle_t handle) {
 	return uxQueueSpacesAvailable(handle);
 }
 
+void csp_queue_delete(csp_queue_handle_t handle) {
+	vQueueDelete(handle);
+}
+
 void csp_queue_empty(csp_queue_handle_t handle) {
 	xQueueReset(handle);
 }
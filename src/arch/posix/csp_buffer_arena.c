@@ -0,0 +1,250 @@
+#include "csp_buffer_arena.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "csp/autoconfig.h"
+
+#ifndef CSP_BUFFER_ARENA_SIZE
+#define CSP_BUFFER_ARENA_SIZE (2 * 1024 * 1024)  //! Bytes per arena, one huge page on most platforms
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * An idle arena gives its pages back to the system, but keeps its address range, so a packet freed
+ * again after that reads as a zeroed, corrupt buffer instead of faulting.
+ */
+typedef struct {
+	char * mem;           /* Reserved address range, NULL if never mapped */
+	size_t map_size;      /* Bytes mapped */
+	bool resident;        /* Holds memory and slots, false once released */
+	unsigned int slots;   /* Slots in this arena, 0 if not resident */
+	unsigned int nfree;   /* Slots on the free stack */
+	void ** free_stack;
+} csp_buffer_arena_t;
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static csp_buffer_arena_t * arenas;
+static unsigned int arena_count;      /* Entries in arenas[] */
+static unsigned int arena_slots;      /* Slots in a full arena */
+static unsigned int arena_max_slots;
+static unsigned int arena_in_use;     /* Slots handed out */
+static unsigned int arena_idle;       /* Mapped arenas with all slots free */
+static unsigned int arena_mapped;     /* Resident arenas */
+static size_t arena_slot_size;
+static bool arena_hugepages;
+static void (*arena_slot_init)(void * slot);
+
+static size_t round_up(size_t size, size_t align) {
+	return (size + align - 1) / align * align;
+}
+
+static int arena_map(csp_buffer_arena_t * arena, unsigned int index) {
+
+	unsigned int slots = arena_max_slots - index * arena_slots;
+	if (slots > arena_slots) {
+		slots = arena_slots;
+	}
+
+	arena->free_stack = malloc(slots * sizeof(void *));
+	if (arena->free_stack == NULL) {
+		return -1;
+	}
+
+	/* A released arena still has its range, its pages are zero filled again on first use */
+	if (arena->mem == NULL) {
+		void * mem = MAP_FAILED;
+		size_t size = slots * arena_slot_size;
+
+#ifdef MAP_HUGETLB
+		if (arena_hugepages) {
+			arena->map_size = round_up(size, HUGE_PAGE_SIZE);
+			mem = mmap(NULL, arena->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		}
+#endif
+
+		/* No huge pages requested or none reserved by the system, use normal pages */
+		if (mem == MAP_FAILED) {
+			arena->map_size = round_up(size, sysconf(_SC_PAGESIZE));
+			mem = mmap(NULL, arena->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		}
+
+		if (mem == MAP_FAILED) {
+			free(arena->free_stack);
+			arena->free_stack = NULL;
+			return -1;
+		}
+
+		arena->mem = mem;
+	}
+
+	arena->resident = true;
+	arena->slots = slots;
+	arena->nfree = 0;
+
+	/* Push in reverse, so slots are handed out in address order */
+	for (unsigned int i = slots; i > 0; i--) {
+		void * slot = arena->mem + (i - 1) * arena_slot_size;
+		arena_slot_init(slot);
+		arena->free_stack[arena->nfree++] = slot;
+	}
+
+	arena_mapped++;
+	arena_idle++;
+
+	return 0;
+}
+
+/* Give the memory of an idle arena back, returns false if the system does not take it */
+static bool arena_release(csp_buffer_arena_t * arena) {
+
+	if (madvise(arena->mem, arena->map_size, MADV_DONTNEED) != 0) {
+		return false;
+	}
+
+	free(arena->free_stack);
+	arena->free_stack = NULL;
+	arena->resident = false;
+	arena->slots = 0;
+	arena->nfree = 0;
+	arena_mapped--;
+
+	return true;
+}
+
+static void arena_unmap(csp_buffer_arena_t * arena) {
+
+	munmap(arena->mem, arena->map_size);
+	if (arena->resident) {
+		free(arena->free_stack);
+		arena_mapped--;
+	}
+	arena->mem = NULL;
+	arena->free_stack = NULL;
+	arena->resident = false;
+	arena->slots = 0;
+	arena->nfree = 0;
+}
+
+int csp_buffer_arena_init(size_t slot_size, unsigned int max_slots, bool hugepages, void (*slot_init)(void * slot)) {
+
+	pthread_mutex_lock(&arena_lock);
+
+	/* Release arenas from a previous initialization */
+	for (unsigned int i = 0; i < arena_count; i++) {
+		if (arenas[i].mem != NULL) {
+			arena_unmap(&arenas[i]);
+		}
+	}
+	free(arenas);
+
+	arena_slot_size = round_up(slot_size, sizeof(void *));
+	arena_slots = CSP_BUFFER_ARENA_SIZE / arena_slot_size;
+	if (arena_slots == 0) {
+		arena_slots = 1;
+	}
+	arena_max_slots = max_slots;
+	arena_count = (max_slots + arena_slots - 1) / arena_slots;
+	arena_in_use = 0;
+	arena_idle = 0;
+	arena_mapped = 0;
+	arena_hugepages = hugepages;
+	arena_slot_init = slot_init;
+
+	arenas = calloc(arena_count, sizeof(*arenas));
+	int ret = (arenas == NULL) ? -1 : 0;
+	if (ret != 0) {
+		arena_count = 0;
+		arena_max_slots = 0;
+	}
+
+	pthread_mutex_unlock(&arena_lock);
+
+	return ret;
+}
+
+void * csp_buffer_arena_alloc(void) {
+
+	void * slot = NULL;
+	csp_buffer_arena_t * unmapped = NULL;
+
+	pthread_mutex_lock(&arena_lock);
+
+	/* Prefer the lowest arena with free slots, so higher arenas drain and can be released */
+	for (unsigned int i = 0; i < arena_count; i++) {
+		csp_buffer_arena_t * arena = &arenas[i];
+		if (!arena->resident) {
+			if (unmapped == NULL) {
+				unmapped = arena;
+			}
+			continue;
+		}
+		if (arena->nfree > 0) {
+			if (arena->nfree == arena->slots) {
+				arena_idle--;
+			}
+			slot = arena->free_stack[--arena->nfree];
+			break;
+		}
+	}
+
+	if ((slot == NULL) && (unmapped != NULL) && (arena_map(unmapped, unmapped - arenas) == 0)) {
+		arena_idle--;
+		slot = unmapped->free_stack[--unmapped->nfree];
+	}
+
+	if (slot != NULL) {
+		arena_in_use++;
+	}
+
+	pthread_mutex_unlock(&arena_lock);
+
+	return slot;
+}
+
+void csp_buffer_arena_free(void * slot) {
+
+	pthread_mutex_lock(&arena_lock);
+
+	for (unsigned int i = 0; i < arena_count; i++) {
+		csp_buffer_arena_t * arena = &arenas[i];
+		if (!arena->resident || ((char *)slot < arena->mem) || ((char *)slot >= arena->mem + arena->slots * arena_slot_size)) {
+			continue;
+		}
+
+		arena->free_stack[arena->nfree++] = slot;
+		arena_in_use--;
+
+		if (arena->nfree == arena->slots) {
+			/* Keep one idle arena around to absorb the next burst, give back the rest */
+			if ((++arena_idle > 1) && arena_release(arena)) {
+				arena_idle--;
+			}
+		}
+		break;
+	}
+
+	pthread_mutex_unlock(&arena_lock);
+}
+
+unsigned int csp_buffer_arena_available(void) {
+
+	pthread_mutex_lock(&arena_lock);
+	unsigned int available = arena_max_slots - arena_in_use;
+	pthread_mutex_unlock(&arena_lock);
+
+	return available;
+}
+
+unsigned int csp_buffer_arena_mapped(void) {
+
+	pthread_mutex_lock(&arena_lock);
+	unsigned int mapped = arena_mapped;
+	pthread_mutex_unlock(&arena_lock);
+
+	return mapped;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+/**
+   @file
+
+   Growable slab of fixed size slots, backed by mmap'd arenas.
+
+   Used by the packet buffer pool when CSP_BUFFER_DYNAMIC is enabled. Arenas are mapped on demand
+   until the configured number of slots is reached. When they become idle, their memory is given
+   back but their address range stays reserved, so a stale packet pointer into them can still be
+   read.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+   Initialize (or re-initialize) the arena pool.
+   Any previously mapped arenas are released.
+
+   @param[in] slot_size size of each slot in bytes.
+   @param[in] max_slots maximum number of slots.
+   @param[in] hugepages try to back arenas with huge pages.
+   @param[in] slot_init called once for every slot when its arena is mapped.
+   @return 0 on success, -1 on failure.
+*/
+int csp_buffer_arena_init(size_t slot_size, unsigned int max_slots, bool hugepages, void (*slot_init)(void * slot));
+
+/**
+   Allocate a slot, mapping a new arena if all mapped slots are in use.
+
+   @return slot, or NULL if all \a max_slots slots are in use or mapping failed.
+*/
+void * csp_buffer_arena_alloc(void);
+
+/**
+   Return a slot to its arena.
+
+   @param[in] slot slot returned by csp_buffer_arena_alloc().
+*/
+void csp_buffer_arena_free(void * slot);
+
+/**
+   Return number of slots that can still be allocated, mapped or not.
+*/
+unsigned int csp_buffer_arena_available(void);
+
+/**
+   Return number of arenas currently holding memory.
+*/
+unsigned int csp_buffer_arena_mapped(void);
@@ -0,0 +1,132 @@
+#include "csp_conn_slab.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "csp/autoconfig.h"
+
+#ifndef CSP_CONN_SLAB_CHUNK
+#define CSP_CONN_SLAB_CHUNK 64  //! Slots per chunk
+#endif
+
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static char ** slab_chunks;          /* Allocated chunks, in the order they were added */
+static unsigned int slab_chunk_count; /* Entries in slab_chunks[] */
+static unsigned int slab_max_slots;
+static unsigned int slab_slots;       /* Slots in allocated chunks */
+static void ** slab_free_stack;       /* Room for slab_slots entries */
+static unsigned int slab_nfree;
+static size_t slab_slot_size;
+static void (*slab_slot_init)(void * slot);
+
+static int slab_grow(void) {
+
+	if (slab_slots >= slab_max_slots) {
+		return -1;
+	}
+
+	/* Only the last chunk can be short, and it is never followed by another */
+	unsigned int chunk = slab_slots / CSP_CONN_SLAB_CHUNK;
+
+	unsigned int slots = slab_max_slots - slab_slots;
+	if (slots > CSP_CONN_SLAB_CHUNK) {
+		slots = CSP_CONN_SLAB_CHUNK;
+	}
+
+	void ** free_stack = realloc(slab_free_stack, (slab_slots + slots) * sizeof(void *));
+	if (free_stack == NULL) {
+		return -1;
+	}
+	slab_free_stack = free_stack;
+
+	char * mem = calloc(slots, slab_slot_size);
+	if (mem == NULL) {
+		return -1;
+	}
+	slab_chunks[chunk] = mem;
+	slab_slots += slots;
+
+	/* Push in reverse, so slots are handed out in address order */
+	for (unsigned int i = slots; i > 0; i--) {
+		void * slot = mem + (i - 1) * slab_slot_size;
+		slab_slot_init(slot);
+		slab_free_stack[slab_nfree++] = slot;
+	}
+
+	return 0;
+}
+
+int csp_conn_slab_init(size_t slot_size, unsigned int max_slots, void (*slot_init)(void * slot)) {
+
+	pthread_mutex_lock(&slab_lock);
+
+	/* Release chunks from a previous initialization */
+	for (unsigned int i = 0; i < slab_chunk_count; i++) {
+		free(slab_chunks[i]);
+	}
+	free(slab_chunks);
+	free(slab_free_stack);
+	slab_free_stack = NULL;
+
+	slab_slot_size = slot_size;
+	slab_max_slots = max_slots;
+	slab_chunk_count = (max_slots + CSP_CONN_SLAB_CHUNK - 1) / CSP_CONN_SLAB_CHUNK;
+	slab_slots = 0;
+	slab_nfree = 0;
+	slab_slot_init = slot_init;
+
+	slab_chunks = calloc(slab_chunk_count, sizeof(*slab_chunks));
+	int ret = (slab_chunks == NULL) ? -1 : 0;
+	if (ret != 0) {
+		slab_chunk_count = 0;
+		slab_max_slots = 0;
+	}
+
+	pthread_mutex_unlock(&slab_lock);
+
+	return ret;
+}
+
+void * csp_conn_slab_alloc(void) {
+
+	void * slot = NULL;
+
+	pthread_mutex_lock(&slab_lock);
+
+	if ((slab_nfree > 0) || (slab_grow() == 0)) {
+		slot = slab_free_stack[--slab_nfree];
+	}
+
+	pthread_mutex_unlock(&slab_lock);
+
+	return slot;
+}
+
+void csp_conn_slab_free(void * slot) {
+
+	pthread_mutex_lock(&slab_lock);
+	slab_free_stack[slab_nfree++] = slot;
+	pthread_mutex_unlock(&slab_lock);
+}
+
+unsigned int csp_conn_slab_slots(void) {
+
+	pthread_mutex_lock(&slab_lock);
+	unsigned int slots = slab_slots;
+	pthread_mutex_unlock(&slab_lock);
+
+	return slots;
+}
+
+void * csp_conn_slab_get(unsigned int index) {
+
+	void * slot = NULL;
+
+	pthread_mutex_lock(&slab_lock);
+	if (index < slab_slots) {
+		slot = slab_chunks[index / CSP_CONN_SLAB_CHUNK] + (index % CSP_CONN_SLAB_CHUNK) * slab_slot_size;
+	}
+	pthread_mutex_unlock(&slab_lock);
+
+	return slot;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+/**
+   @file
+
+   Growable slab of connection slots.
+
+   Used by the connection pool when CSP_CONN_DYNAMIC is enabled. Slots are allocated in chunks on
+   demand until the configured number of slots is reached. Applications keep pointers to their
+   connections after closing them, so chunks are only released when the slab is re-initialized.
+*/
+
+#include <stddef.h>
+
+/**
+   Initialize (or re-initialize) the slab.
+   Any previously allocated chunks are released.
+
+   @param[in] slot_size size of each slot in bytes.
+   @param[in] max_slots maximum number of slots.
+   @param[in] slot_init called once for every slot when its chunk is allocated.
+   @return 0 on success, -1 on failure.
+*/
+int csp_conn_slab_init(size_t slot_size, unsigned int max_slots, void (*slot_init)(void * slot));
+
+/**
+   Allocate a slot, most recently freed first, allocating a new chunk if all slots are in use.
+
+   @return slot, or NULL if all \a max_slots slots are in use or allocation failed.
+*/
+void * csp_conn_slab_alloc(void);
+
+/**
+   Return a slot to the slab.
+
+   @param[in] slot slot returned by csp_conn_slab_alloc().
+*/
+void csp_conn_slab_free(void * slot);
+
+/**
+   Return number of slots allocated so far, in use or not.
+*/
+unsigned int csp_conn_slab_slots(void);
+
+/**
+   Return slot by index.
+
+   @param[in] index index, less than csp_conn_slab_slots().
+   @return slot, or NULL if \a index is out of range.
+*/
+void * csp_conn_slab_get(unsigned int index);
@@ -1,19 +1,44 @@
 
 
 #include <csp/arch/csp_queue.h>
+
+#if (CSP_QUEUE_LOCKFREE)
+#include "ring_queue.h"
+
+#define queue_create ring_queue_create
+#define queue_enqueue ring_queue_enqueue
+#define queue_dequeue ring_queue_dequeue
+#define queue_enqueue_many ring_queue_enqueue_many
+#define queue_dequeue_many ring_queue_dequeue_many
+#define queue_items ring_queue_items
+#define queue_free ring_queue_free
+#define queue_delete ring_queue_delete
+#define queue_empty ring_queue_empty
+#else
 #include "pthread_queue.h"
 
+#define queue_create pthread_queue_create
+#define queue_enqueue pthread_queue_enqueue
+#define queue_dequeue pthread_queue_dequeue
+#define queue_enqueue_many pthread_queue_enqueue_many
+#define queue_dequeue_many pthread_queue_dequeue_many
+#define queue_items pthread_queue_items
+#define queue_free pthread_queue_free
+#define queue_delete pthread_queue_delete
+#define queue_empty pthread_queue_empty
+#endif
+
 csp_queue_handle_t csp_queue_create_static(int length, size_t item_size, char * buffer, csp_static_queue_t * queue) {
 	/* Avoid compiler warnings about unused parameter */
 	(void)buffer;
 	(void)queue;
 
 	/* We ignore static allocation for posix for now */
-	return pthread_queue_create(length, item_size);
+	return queue_create(length, item_size);
 }
 
 int csp_queue_enqueue(csp_queue_handle_t handle, const void * value, uint32_t timeout) {
-	return pthread_queue_enqueue(handle, value, timeout);
+	return queue_enqueue(handle, value, timeout);
 }
 
 int csp_queue_enqueue_isr(csp_queue_handle_t handle, const void * value, int * task_woken) {
@@ -24,7 +49,7 @@ int csp_queue_enqueue_isr(csp_queue_handle_t handle, const void * value, int * t
 }
 
 int csp_queue_dequeue(csp_queue_handle_t handle, void * buf, uint32_t timeout) {
-	return pthread_queue_dequeue(handle, buf, timeout);
+	return queue_dequeue(handle, buf, timeout);
 }
 
 int csp_queue_dequeue_isr(csp_queue_handle_t handle, void * buf, int * task_woken) {
@@ -34,18 +59,30 @@ int csp_queue_dequeue_isr(csp_queue_handle_t handle, void * buf, int * task_woke
 	return csp_queue_dequeue(handle, buf, 0);
 }
 
+int csp_queue_enqueue_many(csp_queue_handle_t handle, const void * values, int count, uint32_t timeout) {
+	return queue_enqueue_many(handle, values, count, timeout);
+}
+
+int csp_queue_dequeue_many(csp_queue_handle_t handle, void * buf, int count, uint32_t timeout) {
+	return queue_dequeue_many(handle, buf, count, timeout);
+}
+
 int csp_queue_size(csp_queue_handle_t handle) {
-	return pthread_queue_items(handle);
+	return queue_items(handle);
 }
 
 int csp_queue_size_isr(csp_queue_handle_t handle) {
-	return pthread_queue_items(handle);
+	return queue_items(handle);
 }
 
 int csp_queue_free(csp_queue_handle_t handle) {
-	return pthread_queue_free(handle);
+	return queue_free(handle);
+}
+
+void csp_queue_delete(csp_queue_handle_t handle) {
+	queue_delete(handle);
 }
 
 void csp_queue_empty(csp_queue_handle_t handle) {
-	pthread_queue_empty(handle);
+	queue_empty(handle);
 }
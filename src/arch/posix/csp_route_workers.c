@@ -0,0 +1,62 @@
+#include "../../csp_route.h"
+#include "../../csp_qfifo.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <csp/csp.h>
+
+/* Set once workers run, they are never stopped */
+static atomic_flag csp_route_workers_running = ATOMIC_FLAG_INIT;
+
+static void * csp_route_worker(void * param) {
+
+	unsigned int shard = (uintptr_t)param;
+
+	/* Here there be routing */
+	while (1) {
+		csp_route_work_shard(shard);
+	}
+
+	return NULL;
+}
+
+int csp_route_start_workers(unsigned int count) {
+
+	if ((count == 0) || (count > CSP_ROUTE_WORKERS)) {
+		return CSP_ERR_INVAL;
+	}
+
+	/* A second set of workers would route a shard from two threads, out of order */
+	if (atomic_flag_test_and_set(&csp_route_workers_running)) {
+		return CSP_ERR_BUSY;
+	}
+
+	pthread_attr_t attributes;
+	if (pthread_attr_init(&attributes) != 0) {
+		atomic_flag_clear(&csp_route_workers_running);
+		return CSP_ERR_NOMEM;
+	}
+	/* no need to join with thread to free its resources */
+	pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+	unsigned int started;
+	for (started = 0; started < count; started++) {
+		pthread_t handle;
+		if (pthread_create(&handle, &attributes, csp_route_worker, (void *)(uintptr_t)started) != 0) {
+			break;
+		}
+	}
+
+	pthread_attr_destroy(&attributes);
+
+	/* Only hand packets to workers that are running */
+	if (started > 0) {
+		csp_qfifo_set_shards(started);
+	} else {
+		atomic_flag_clear(&csp_route_workers_running);
+	}
+
+	return (started == count) ? CSP_ERR_NONE : CSP_ERR_NOMEM;
+}
@@ -34,6 +34,9 @@ static inline int get_deadline(struct timespec * ts, uint32_t timeout_ms) {
 	return ret;
 }
 
+/* Deadline of a zero timeout, which fails at once instead of reading the clock and waiting */
+static struct timespec no_wait;
+
 static inline int init_cond_clock_monotonic(pthread_cond_t * cond) {
 
 	int ret;
@@ -123,6 +126,10 @@ static inline int wait_slot_available(pthread_queue_t * queue, struct timespec *
 
 	while (queue->items == queue->size) {
 
+		if (ts == &no_wait) {
+			return PTHREAD_QUEUE_FULL;
+		}
+
 		if (ts != NULL) {
 			ret = pthread_cond_timedwait(&(queue->cond_full), &(queue->mutex), ts);
 		} else {
@@ -144,7 +151,9 @@ int pthread_queue_enqueue(pthread_queue_t * queue, const void * value, uint32_t
 	struct timespec * pts = NULL;
 
 	/* Calculate timeout */
-	if (timeout != CSP_MAX_TIMEOUT) {
+	if (timeout == 0) {
+		pts = &no_wait;
+	} else if (timeout != CSP_MAX_TIMEOUT) {
 		if (get_deadline(&ts, timeout) != 0) {
 			return PTHREAD_QUEUE_ERROR;
 		}
@@ -180,6 +189,10 @@ static inline int wait_item_available(pthread_queue_t * queue, struct timespec *
 
 	while (queue->items == 0) {
 
+		if (ts == &no_wait) {
+			return PTHREAD_QUEUE_EMPTY;
+		}
+
 		if (ts != NULL) {
 			ret = pthread_cond_timedwait(&(queue->cond_empty), &(queue->mutex), ts);
 		} else {
@@ -206,7 +219,9 @@ int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout)
 	}
 
 	/* Calculate timeout */
-	if (timeout != CSP_MAX_TIMEOUT) {
+	if (timeout == 0) {
+		pts = &no_wait;
+	} else if (timeout != CSP_MAX_TIMEOUT) {
 		if (get_deadline(&ts, timeout) != 0) {
 			return PTHREAD_QUEUE_ERROR;
 		}
@@ -236,6 +251,92 @@ int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout)
 	return ret;
 }
 
+int pthread_queue_enqueue_many(pthread_queue_t * queue, const void * values, int count, uint32_t timeout) {
+
+	struct timespec ts;
+	struct timespec * pts = NULL;
+	int n = 0;
+
+	if (count <= 0) {
+		return 0;
+	}
+
+	/* Calculate timeout */
+	if (timeout == 0) {
+		pts = &no_wait;
+	} else if (timeout != CSP_MAX_TIMEOUT) {
+		if (get_deadline(&ts, timeout) != 0) {
+			return 0;
+		}
+		pts = &ts;
+	}
+
+	/* Get queue lock */
+	pthread_mutex_lock(&(queue->mutex));
+
+	if (wait_slot_available(queue, pts) == PTHREAD_QUEUE_OK) {
+		/* Copy as many objects as there is room for */
+		while ((n < count) && (queue->items < queue->size)) {
+			memcpy((char *)queue->buffer + (queue->in * queue->item_size), (const char *)values + (n * queue->item_size), queue->item_size);
+			queue->items++;
+			queue->in = (queue->in + 1) % queue->size;
+			n++;
+		}
+	}
+
+	pthread_mutex_unlock(&(queue->mutex));
+
+	if (n > 0) {
+		/* Notify blocked threads */
+		pthread_cond_broadcast(&(queue->cond_empty));
+	}
+
+	return n;
+}
+
+int pthread_queue_dequeue_many(pthread_queue_t * queue, void * buf, int count, uint32_t timeout) {
+
+	struct timespec ts;
+	struct timespec * pts = NULL;
+	int n = 0;
+
+	if (count <= 0) {
+		return 0;
+	}
+
+	/* Calculate timeout */
+	if (timeout == 0) {
+		pts = &no_wait;
+	} else if (timeout != CSP_MAX_TIMEOUT) {
+		if (get_deadline(&ts, timeout) != 0) {
+			return 0;
+		}
+		pts = &ts;
+	}
+
+	/* Get queue lock */
+	pthread_mutex_lock(&(queue->mutex));
+
+	if (wait_item_available(queue, pts) == PTHREAD_QUEUE_OK) {
+		/* Copy all available objects, up to count */
+		while ((n < count) && (queue->items > 0)) {
+			memcpy((char *)buf + (n * queue->item_size), (char *)queue->buffer + (queue->out * queue->item_size), queue->item_size);
+			queue->items--;
+			queue->out = (queue->out + 1) % queue->size;
+			n++;
+		}
+	}
+
+	pthread_mutex_unlock(&(queue->mutex));
+
+	if (n > 0) {
+		/* Notify blocked threads */
+		pthread_cond_broadcast(&(queue->cond_full));
+	}
+
+	return n;
+}
+
 int pthread_queue_items(pthread_queue_t * queue) {
 
 	pthread_mutex_lock(&(queue->mutex));
@@ -77,6 +77,18 @@ int pthread_queue_enqueue(pthread_queue_t * queue, const void * value, uint32_t
 */
 int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout);
 
+/**
+   Enqueue/insert up to count elements, under one lock.
+   @return number of elements inserted.
+*/
+int pthread_queue_enqueue_many(pthread_queue_t * queue, const void * values, int count, uint32_t timeout);
+
+/**
+   Dequeue/extract up to count elements, under one lock.
+   @return number of elements extracted.
+*/
+int pthread_queue_dequeue_many(pthread_queue_t * queue, void * buf, int count, uint32_t timeout);
+
 /**
    Return number of elements in the queue.
 */
@@ -0,0 +1,368 @@
+#include "ring_queue.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <csp/csp.h>
+
+#define CACHE_LINE_SIZE 64
+
+/* Futex for one direction of the queue. Bit 0 is set while someone may be sleeping on it, the
+ * remaining bits count wakeups, so a sleeper never misses one that happens after it registered. */
+typedef struct {
+	alignas(CACHE_LINE_SIZE) _Atomic uint32_t futex;
+} ring_queue_wait_t;
+
+#define RING_QUEUE_WAITERS 1U
+
+typedef struct {
+	/* Position of the item in the slot, see ring_queue_enqueue() and ring_queue_dequeue() */
+	atomic_size_t seq;
+	alignas(max_align_t) char data[];
+} ring_queue_slot_t;
+
+struct ring_queue_s {
+	//! Next position to insert at, shared by producers.
+	alignas(CACHE_LINE_SIZE) atomic_size_t head;
+	//! Next position to extract from, shared by consumers.
+	alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+	//! Consumers waiting for an item.
+	ring_queue_wait_t not_empty;
+	//! Producers waiting for a free slot.
+	ring_queue_wait_t not_full;
+	//! Number of slots.
+	alignas(CACHE_LINE_SIZE) size_t size;
+	//! Item/element size.
+	size_t item_size;
+	//! Bytes between slots.
+	size_t stride;
+	//! Memory area.
+	char * slots;
+};
+
+static inline int get_deadline(struct timespec * ts, uint32_t timeout_ms) {
+	int ret = clock_gettime(CLOCK_MONOTONIC, ts);
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	uint32_t sec = timeout_ms / 1000;
+	uint32_t nsec = (timeout_ms - 1000 * sec) * 1000000;
+
+	ts->tv_sec += sec;
+
+	if (ts->tv_nsec + nsec >= 1000000000) {
+		ts->tv_sec++;
+	}
+
+	ts->tv_nsec = (ts->tv_nsec + nsec) % 1000000000;
+
+	return ret;
+}
+
+static inline ring_queue_slot_t * slot_at(ring_queue_t * queue, size_t pos) {
+	return (ring_queue_slot_t *)(void *)(queue->slots + (pos % queue->size) * queue->stride);
+}
+
+/* Sleep until the futex no longer holds val, or until the absolute CLOCK_MONOTONIC deadline ts */
+static int futex_wait(_Atomic uint32_t * futex, uint32_t val, const struct timespec * ts) {
+	return syscall(SYS_futex, futex, FUTEX_WAIT_BITSET_PRIVATE, val, ts, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void futex_wake(_Atomic uint32_t * futex, int count) {
+	syscall(SYS_futex, futex, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/* Wake threads sleeping on w, after an item or slot has been published */
+static inline void ring_queue_signal(ring_queue_wait_t * w) {
+
+	/* Orders the publish before the waiters check. Pairs with setting the waiters bit in
+	 * ring_queue_wait(), so either we see the bit, or the waiter sees what we published. */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	/* Only the first signal after a waiter registers pays for the syscall */
+	uint32_t val = atomic_load_explicit(&w->futex, memory_order_relaxed);
+	while (val & RING_QUEUE_WAITERS) {
+		if (atomic_compare_exchange_weak(&w->futex, &val, (val + 2) & ~RING_QUEUE_WAITERS)) {
+			futex_wake(&w->futex, INT_MAX);
+			break;
+		}
+	}
+}
+
+/**
+ * A slot can be claimed by a thread that is preempted before it publishes or releases it. With
+ * wait_peer, such a slot is waited for, so the queue is only reported full when it really is.
+ * Otherwise it is reported full, and the caller sleeps on the futex until the peer signals.
+ */
+static bool try_enqueue(ring_queue_t * queue, const void * value, bool wait_peer) {
+
+	size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	ring_queue_slot_t * slot;
+
+	for (;;) {
+		slot = slot_at(queue, pos);
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+		if (dif == 0) {
+			/* Slot is free for this position, claim it */
+			if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (dif < 0) {
+			/* Slot still holds the item from the previous lap. The queue is only full if no
+			 * consumer has claimed it, otherwise wait for that consumer to release the slot. */
+			size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+			if (!wait_peer || ((intptr_t)(pos - tail) >= (intptr_t)queue->size)) {
+				return false;
+			}
+			sched_yield();
+			pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+		} else {
+			/* Another producer claimed the position */
+			pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+		}
+	}
+
+	memcpy(slot->data, value, queue->item_size);
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	return true;
+}
+
+/* As try_enqueue(), for a slot claimed by a producer that has not published the item yet */
+static bool try_dequeue(ring_queue_t * queue, void * buf, bool wait_peer) {
+
+	size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	ring_queue_slot_t * slot;
+
+	for (;;) {
+		slot = slot_at(queue, pos);
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (dif == 0) {
+			/* Slot holds the item for this position, claim it */
+			if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (dif < 0) {
+			/* Nothing published at this position yet. The queue is only empty if no producer has
+			 * claimed it, otherwise wait for that producer to publish the item. */
+			if (!wait_peer || (atomic_load_explicit(&queue->head, memory_order_relaxed) == pos)) {
+				return false;
+			}
+			sched_yield();
+			pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+		} else {
+			/* Another consumer claimed the position */
+			pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+		}
+	}
+
+	if (buf != NULL) {
+		memcpy(buf, slot->data, queue->item_size);
+	}
+
+	/* Hand the slot to the producer one lap ahead */
+	atomic_store_explicit(&slot->seq, pos + queue->size, memory_order_release);
+
+	return true;
+}
+
+ring_queue_t * ring_queue_create(int length, size_t item_size) {
+
+	if ((length <= 0) || (item_size == 0)) {
+		return NULL;
+	}
+
+	ring_queue_t * q = aligned_alloc(CACHE_LINE_SIZE, sizeof(ring_queue_t));
+	if (q == NULL) {
+		return NULL;
+	}
+
+	q->size = length;
+	q->item_size = item_size;
+	q->stride = sizeof(ring_queue_slot_t) + item_size;
+	q->stride = (q->stride + alignof(ring_queue_slot_t) - 1) / alignof(ring_queue_slot_t) * alignof(ring_queue_slot_t);
+
+	q->slots = aligned_alloc(CACHE_LINE_SIZE, (q->size * q->stride + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+	if (q->slots == NULL) {
+		free(q);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < q->size; i++) {
+		atomic_init(&slot_at(q, i)->seq, i);
+	}
+
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+	atomic_init(&q->not_empty.futex, 0);
+	atomic_init(&q->not_full.futex, 0);
+
+	return q;
+}
+
+void ring_queue_delete(ring_queue_t * q) {
+
+	if (q == NULL)
+		return;
+
+	free(q->slots);
+	free(q);
+}
+
+/**
+ * Run op until it succeeds or the timeout expires, sleeping on w in between.
+ * The deadline is only computed once the caller actually has to wait. Only a call that cannot
+ * sleep waits for a preempted peer inside op.
+ */
+static int ring_queue_wait(ring_queue_t * queue, ring_queue_wait_t * w, bool (*op)(ring_queue_t *, void *, bool), void * arg, uint32_t timeout) {
+
+	bool wait_peer = (timeout == 0);
+
+	struct timespec ts;
+	struct timespec * pts = NULL;
+	bool expired = false;
+
+	for (;;) {
+		if (op(queue, arg, wait_peer)) {
+			return RING_QUEUE_OK;
+		}
+
+		if ((timeout == 0) || expired) {
+			return RING_QUEUE_ERROR;
+		}
+
+		if ((pts == NULL) && (timeout != CSP_MAX_TIMEOUT)) {
+			if (get_deadline(&ts, timeout) != 0) {
+				return RING_QUEUE_ERROR;
+			}
+			pts = &ts;
+		}
+
+		uint32_t val = atomic_fetch_or(&w->futex, RING_QUEUE_WAITERS) | RING_QUEUE_WAITERS;
+
+		/* Check again now that we are registered, a signal could have been missed before */
+		if (op(queue, arg, wait_peer)) {
+			return RING_QUEUE_OK;
+		}
+
+		if ((futex_wait(&w->futex, val, pts) != 0) && (errno == ETIMEDOUT)) {
+			expired = true;
+		}
+	}
+}
+
+static bool try_enqueue_op(ring_queue_t * queue, void * arg, bool wait_peer) {
+	return try_enqueue(queue, arg, wait_peer);
+}
+
+static bool try_dequeue_op(ring_queue_t * queue, void * arg, bool wait_peer) {
+	return try_dequeue(queue, arg, wait_peer);
+}
+
+int ring_queue_enqueue(ring_queue_t * queue, const void * value, uint32_t timeout) {
+
+	int ret = ring_queue_wait(queue, &queue->not_full, try_enqueue_op, (void *)value, timeout);
+	if (ret == RING_QUEUE_OK) {
+		ring_queue_signal(&queue->not_empty);
+	}
+
+	return ret;
+}
+
+int ring_queue_dequeue(ring_queue_t * queue, void * buf, uint32_t timeout) {
+
+	if (!queue) {
+		csp_print("csp not initialized\n");
+		return RING_QUEUE_ERROR;
+	}
+
+	int ret = ring_queue_wait(queue, &queue->not_empty, try_dequeue_op, buf, timeout);
+	if (ret == RING_QUEUE_OK) {
+		ring_queue_signal(&queue->not_full);
+	}
+
+	return ret;
+}
+
+int ring_queue_enqueue_many(ring_queue_t * queue, const void * values, int count, uint32_t timeout) {
+
+	if (count <= 0) {
+		return 0;
+	}
+
+	if (ring_queue_wait(queue, &queue->not_full, try_enqueue_op, (void *)values, timeout) != RING_QUEUE_OK) {
+		return 0;
+	}
+
+	int n = 1;
+	while ((n < count) && try_enqueue(queue, (const char *)values + n * queue->item_size, timeout == 0)) {
+		n++;
+	}
+
+	ring_queue_signal(&queue->not_empty);
+
+	return n;
+}
+
+int ring_queue_dequeue_many(ring_queue_t * queue, void * buf, int count, uint32_t timeout) {
+
+	if (count <= 0) {
+		return 0;
+	}
+
+	if (ring_queue_wait(queue, &queue->not_empty, try_dequeue_op, buf, timeout) != RING_QUEUE_OK) {
+		return 0;
+	}
+
+	int n = 1;
+	while ((n < count) && try_dequeue(queue, (char *)buf + n * queue->item_size, timeout == 0)) {
+		n++;
+	}
+
+	ring_queue_signal(&queue->not_full);
+
+	return n;
+}
+
+int ring_queue_items(ring_queue_t * queue) {
+
+	/* Load tail first, so a concurrent dequeue cannot make the result negative */
+	size_t tail = atomic_load(&queue->tail);
+	size_t head = atomic_load(&queue->head);
+	size_t items = head - tail;
+
+	/* The ring may have moved between the two loads */
+	if (items > queue->size) {
+		items = queue->size;
+	}
+
+	return items;
+}
+
+int ring_queue_free(ring_queue_t * queue) {
+	return queue->size - ring_queue_items(queue);
+}
+
+void ring_queue_empty(ring_queue_t * queue) {
+
+	while (try_dequeue(queue, NULL, true)) {
+	}
+
+	ring_queue_signal(&queue->not_full);
+}
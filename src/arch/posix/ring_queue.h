@@ -0,0 +1,99 @@
+#pragma once
+
+/**
+   @file
+
+   Lock-free bounded queue, with futex based blocking.
+
+   Producers and consumers claim slots with a single compare-and-swap on their own index, so any
+   number of producers and consumers can use the queue concurrently (MPMC, which covers the MPSC
+   and SPSC topologies used by CSP). Each slot carries a sequence number, based on the algorithm by
+   Dmitry Vyukov: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+
+   Waiting threads sleep on a futex. Only the first signal after a thread starts waiting makes a
+   system call, so a busy queue costs no syscalls.
+
+   The queue is non-blocking only in the common case. A thread preempted between claiming a slot
+   and publishing (or releasing) it holds up the threads behind it on that slot. A call with a
+   timeout sleeps on the futex until the peer is done. A call with a zero timeout yields until
+   then instead of reporting the queue full or empty when it is not, because callers such as
+   csp_buffer_free() cannot retry.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+   Queue error codes.
+   @{
+*/
+/**
+   General error code - something went wrong.
+*/
+#define RING_QUEUE_ERROR CSP_QUEUE_ERROR
+/**
+   Queue is empty - cannot extract element.
+*/
+#define RING_QUEUE_EMPTY CSP_QUEUE_ERROR
+/**
+   Queue is full - cannot insert element.
+*/
+#define RING_QUEUE_FULL CSP_QUEUE_ERROR
+/**
+   Ok - no error.
+*/
+#define RING_QUEUE_OK CSP_QUEUE_OK
+/** @{ */
+
+/**
+   Queue handle.
+*/
+typedef struct ring_queue_s ring_queue_t;
+
+/**
+   Create queue.
+*/
+ring_queue_t * ring_queue_create(int length, size_t item_size);
+
+/**
+   Delete queue.
+*/
+void ring_queue_delete(ring_queue_t * q);
+
+/**
+   Enqueue/insert element.
+*/
+int ring_queue_enqueue(ring_queue_t * queue, const void * value, uint32_t timeout);
+
+/**
+   Dequeue/extract element.
+   @param[out] buf extracted element, or NULL to discard it.
+*/
+int ring_queue_dequeue(ring_queue_t * queue, void * buf, uint32_t timeout);
+
+/**
+   Enqueue/insert up to count elements, signalling readers once.
+   @return number of elements inserted.
+*/
+int ring_queue_enqueue_many(ring_queue_t * queue, const void * values, int count, uint32_t timeout);
+
+/**
+   Dequeue/extract up to count elements, signalling writers once.
+   @return number of elements extracted.
+*/
+int ring_queue_dequeue_many(ring_queue_t * queue, void * buf, int count, uint32_t timeout);
+
+/**
+   Return number of elements in the queue.
+*/
+int ring_queue_items(ring_queue_t * queue);
+
+/**
+   Return number of free slots in the queue.
+*/
+int ring_queue_free(ring_queue_t * queue);
+
+/**
+   Remove all elements in the queue.
+*/
+void ring_queue_empty(ring_queue_t * queue);
@@ -67,6 +67,52 @@ int csp_queue_dequeue_isr(csp_queue_handle_t queue, void * buf, int * unused) {
 	return csp_errno_zephyr_to_csp(ret);
 }
 
+int csp_queue_enqueue_many(csp_queue_handle_t queue, const void * values, int count, uint32_t timeout) {
+	struct k_msgq * q = (struct k_msgq *)queue;
+	const char * item = values;
+	int n = 0;
+
+	/* Readers are only scheduled once all values that fit have been added */
+	k_sched_lock();
+	while ((n < count) && (k_msgq_put(q, item + n * q->msg_size, K_NO_WAIT) == 0)) {
+		n++;
+	}
+	k_sched_unlock();
+
+	/* Queue was full, wait for room for the first value */
+	if ((n == 0) && (count > 0) && (timeout > 0)) {
+		if (k_msgq_put(q, item, K_MSEC(timeout)) != 0) {
+			return 0;
+		}
+		n = 1 + csp_queue_enqueue_many(queue, item + q->msg_size, count - 1, 0);
+	}
+
+	return n;
+}
+
+int csp_queue_dequeue_many(csp_queue_handle_t queue, void * buf, int count, uint32_t timeout) {
+	struct k_msgq * q = (struct k_msgq *)queue;
+	char * item = buf;
+	int n = 0;
+
+	/* Writers are only scheduled once all available elements have been taken */
+	k_sched_lock();
+	while ((n < count) && (k_msgq_get(q, item + n * q->msg_size, K_NO_WAIT) == 0)) {
+		n++;
+	}
+	k_sched_unlock();
+
+	/* Queue was empty, wait for the first element */
+	if ((n == 0) && (count > 0) && (timeout > 0)) {
+		if (k_msgq_get(q, item, K_MSEC(timeout)) != 0) {
+			return 0;
+		}
+		n = 1 + csp_queue_dequeue_many(queue, item + q->msg_size, count - 1, 0);
+	}
+
+	return n;
+}
+
 int csp_queue_size(csp_queue_handle_t queue) {
 	struct k_msgq * q = (struct k_msgq *)queue;
 
@@ -83,6 +129,12 @@ int csp_queue_free(csp_queue_handle_t queue) {
 	return k_msgq_num_free_get(q);
 }
 
+void csp_queue_delete(csp_queue_handle_t queue) {
+	struct k_msgq * q = (struct k_msgq *)queue;
+
+	(void)k_msgq_cleanup(q);
+}
+
 void csp_queue_empty(csp_queue_handle_t queue) {
 	struct k_msgq * q = (struct k_msgq *)queue;
 
@@ -2,23 +2,380 @@
 
 #include <string.h>
 
+#include <csp/csp.h>
 #include <csp/arch/csp_queue.h>
 #include <csp/csp_debug.h>
 #include "csp_macro.h"
 #include <csp/csp_hooks.h>
 #include <csp/csp_id.h>
 
+#if (CSP_BUFFER_DYNAMIC)
+#if !(CSP_POSIX)
+#error "CSP_BUFFER_DYNAMIC is only supported on POSIX"
+#endif
+#include "arch/posix/csp_buffer_arena.h"
+#endif
+
+#ifndef CSP_BUFFER_MAGAZINE_SIZE
+#define CSP_BUFFER_MAGAZINE_SIZE 0
+#endif
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+#if !(CSP_POSIX)
+#error "CSP_BUFFER_MAGAZINE_SIZE is only supported on POSIX"
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#endif
+
+#ifndef CSP_BUFFER_SMALL_COUNT
+#define CSP_BUFFER_SMALL_COUNT 0
+#endif
+#ifndef CSP_BUFFER_SMALL_SIZE
+#define CSP_BUFFER_SMALL_SIZE 64
+#endif
+#ifndef CSP_BUFFER_MEDIUM_COUNT
+#define CSP_BUFFER_MEDIUM_COUNT 0
+#endif
+#ifndef CSP_BUFFER_MEDIUM_SIZE
+#define CSP_BUFFER_MEDIUM_SIZE 128
+#endif
+
+#if (CSP_BUFFER_SMALL_COUNT > 0) && (CSP_BUFFER_SMALL_SIZE >= CSP_BUFFER_SIZE)
+#error "CSP_BUFFER_SMALL_SIZE must be smaller than CSP_BUFFER_SIZE"
+#endif
+#if (CSP_BUFFER_MEDIUM_COUNT > 0) && (CSP_BUFFER_MEDIUM_SIZE >= CSP_BUFFER_SIZE)
+#error "CSP_BUFFER_MEDIUM_SIZE must be smaller than CSP_BUFFER_SIZE"
+#endif
+#if (CSP_BUFFER_SMALL_COUNT > 0) && (CSP_BUFFER_MEDIUM_COUNT > 0) && (CSP_BUFFER_SMALL_SIZE >= CSP_BUFFER_MEDIUM_SIZE)
+#error "CSP_BUFFER_SMALL_SIZE must be smaller than CSP_BUFFER_MEDIUM_SIZE"
+#endif
+
 /** Internal buffer header */
 typedef struct csp_skbf_s {
 	unsigned int refcount;
 	void * skbf_addr;
+	uint16_t data_size;  /* Usable bytes in skbf_data.data */
+	uint8_t size_class;  /* Index in csp_buffer_classes[], or CSP_BUFFER_CLASS_MAIN */
 	csp_packet_t skbf_data;
 } csp_skbf_t;
 
+/* Buffers of the main pool hold a full csp_packet_t */
+#define CSP_BUFFER_CLASS_MAIN 0xFF
+
+#define CSP_BUFFER_CLASSES ((CSP_BUFFER_SMALL_COUNT > 0) + (CSP_BUFFER_MEDIUM_COUNT > 0))
+
+#if (CSP_BUFFER_CLASSES > 0)
+
+/* A slot only holds the packet up to data_size bytes of data, rounded up to keep slots aligned */
+#define CSP_BUFFER_SLOT_SIZE(data_size) \
+	(((offsetof(csp_skbf_t, skbf_data) + offsetof(csp_packet_t, data) + (data_size)) + _Alignof(csp_skbf_t) - 1) & ~(_Alignof(csp_skbf_t) - 1))
+
+/**
+ * Size class pool.
+ * Pools are sorted by ascending data size, and are all smaller than the main pool.
+ */
+typedef struct {
+	uint16_t data_size;
+	uint16_t count;
+	size_t slot_size;
+	char * pool;
+	char * queue_data;
+	csp_static_queue_t queue_static;
+	csp_queue_handle_t queue;
+} csp_buffer_class_t;
+
+#if (CSP_BUFFER_SMALL_COUNT > 0)
+static _Alignas(csp_skbf_t) char csp_buffer_small_pool[CSP_BUFFER_SMALL_COUNT * CSP_BUFFER_SLOT_SIZE(CSP_BUFFER_SMALL_SIZE)] __noinit;
+static char csp_buffer_small_queue_data[CSP_BUFFER_SMALL_COUNT * sizeof(csp_skbf_t *)] __noinit;
+#endif
+#if (CSP_BUFFER_MEDIUM_COUNT > 0)
+static _Alignas(csp_skbf_t) char csp_buffer_medium_pool[CSP_BUFFER_MEDIUM_COUNT * CSP_BUFFER_SLOT_SIZE(CSP_BUFFER_MEDIUM_SIZE)] __noinit;
+static char csp_buffer_medium_queue_data[CSP_BUFFER_MEDIUM_COUNT * sizeof(csp_skbf_t *)] __noinit;
+#endif
+
+static csp_buffer_class_t csp_buffer_classes[CSP_BUFFER_CLASSES] = {
+#if (CSP_BUFFER_SMALL_COUNT > 0)
+	{
+		.data_size = CSP_BUFFER_SMALL_SIZE,
+		.count = CSP_BUFFER_SMALL_COUNT,
+		.slot_size = CSP_BUFFER_SLOT_SIZE(CSP_BUFFER_SMALL_SIZE),
+		.pool = csp_buffer_small_pool,
+		.queue_data = csp_buffer_small_queue_data,
+	},
+#endif
+#if (CSP_BUFFER_MEDIUM_COUNT > 0)
+	{
+		.data_size = CSP_BUFFER_MEDIUM_SIZE,
+		.count = CSP_BUFFER_MEDIUM_COUNT,
+		.slot_size = CSP_BUFFER_SLOT_SIZE(CSP_BUFFER_MEDIUM_SIZE),
+		.pool = csp_buffer_medium_pool,
+		.queue_data = csp_buffer_medium_queue_data,
+	},
+#endif
+};
+
+static void csp_buffer_classes_init(void) {
+	for (unsigned int c = 0; c < CSP_BUFFER_CLASSES; c++) {
+		csp_buffer_class_t * class = &csp_buffer_classes[c];
+		class->queue = csp_queue_create_static(class->count, sizeof(csp_skbf_t *), class->queue_data, &class->queue_static);
+		for (unsigned int i = 0; i < class->count; i++) {
+			csp_skbf_t * buf = (csp_skbf_t *)(void *)&class->pool[i * class->slot_size];
+			buf->skbf_addr = buf;
+			buf->data_size = class->data_size;
+			buf->size_class = c;
+			buf->refcount = 0;
+			csp_queue_enqueue(class->queue, &buf, 0);
+		}
+	}
+}
+
+#endif
+
+/* Number of buffers in the main pool */
+static unsigned int csp_buffer_count;
+
+#if (CSP_BUFFER_DYNAMIC)
+
+/**
+ * The main pool is a growable set of mmap'd arenas, sized at runtime by csp_conf.buffer_count.
+ */
+static void csp_buffer_slot_init(void * slot) {
+	csp_skbf_t * buf = slot;
+	buf->skbf_addr = buf;
+	buf->data_size = CSP_BUFFER_SIZE;
+	buf->size_class = CSP_BUFFER_CLASS_MAIN;
+	buf->refcount = 0;
+}
+
+static __maybe_unused csp_skbf_t * csp_buffer_pool_take(int isr) {
+	(void)isr; /* ISR context does not exist on POSIX */
+	return csp_buffer_arena_alloc();
+}
+
+static __maybe_unused void csp_buffer_pool_put(csp_skbf_t * buf, int isr) {
+	(void)isr; /* ISR context does not exist on POSIX */
+	csp_buffer_arena_free(buf);
+}
+
+static __maybe_unused int csp_buffer_pool_available(int isr) {
+	(void)isr; /* ISR context does not exist on POSIX */
+	return csp_buffer_arena_available();
+}
+
+static __maybe_unused unsigned int csp_buffer_pool_take_many(csp_skbf_t ** bufs, unsigned int count) {
+	unsigned int n = 0;
+	while ((n < count) && ((bufs[n] = csp_buffer_arena_alloc()) != NULL)) {
+		n++;
+	}
+	return n;
+}
+
+static __maybe_unused void csp_buffer_pool_put_many(csp_skbf_t ** bufs, unsigned int count) {
+	for (unsigned int i = 0; i < count; i++) {
+		csp_buffer_arena_free(bufs[i]);
+	}
+}
+
+#else
+
 // Queue of free CSP buffers
 static csp_queue_handle_t csp_buffers;
 
+static __maybe_unused csp_skbf_t * csp_buffer_pool_take(int isr) {
+	csp_skbf_t * buf = NULL;
+	if (isr) {
+		int task_woken = 0;
+		csp_queue_dequeue_isr(csp_buffers, &buf, &task_woken);
+	} else {
+		csp_queue_dequeue(csp_buffers, &buf, 0);
+	}
+	return buf;
+}
+
+static __maybe_unused void csp_buffer_pool_put(csp_skbf_t * buf, int isr) {
+	if (isr) {
+		int task_woken = 0;
+		csp_queue_enqueue_isr(csp_buffers, &buf, &task_woken);
+	} else {
+		csp_queue_enqueue(csp_buffers, &buf, 0);
+	}
+}
+
+static __maybe_unused int csp_buffer_pool_available(int isr) {
+	if (isr) {
+		return csp_queue_size_isr(csp_buffers);
+	}
+	return csp_queue_size(csp_buffers);
+}
+
+static __maybe_unused unsigned int csp_buffer_pool_take_many(csp_skbf_t ** bufs, unsigned int count) {
+	return csp_queue_dequeue_many(csp_buffers, bufs, count, 0);
+}
+
+static __maybe_unused void csp_buffer_pool_put_many(csp_skbf_t ** bufs, unsigned int count) {
+	csp_queue_enqueue_many(csp_buffers, bufs, count, 0);
+}
+
+#endif
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+
+/**
+ * Per-thread magazine of free buffers.
+ *
+ * Buffers are taken from and returned to the calling thread's magazine without touching the
+ * shared pool. The magazine is refilled from the pool, and drained back to it, half a
+ * magazine at a time. Buffers parked in a magazine still count as free, so the reserve check
+ * and csp_buffer_remaining() see the total number of free buffers. A thread that frees more
+ * than it allocates parks buffers nobody else would get, so when the pool runs dry, the
+ * magazines of the other threads are flushed back to it.
+ */
+typedef struct csp_buffer_magazine_s {
+	atomic_flag lock;  /* Held by the owner while using the magazine, and by threads flushing it */
+	unsigned int generation;  /* Pool generation the cached buffers belong to */
+	unsigned int count;
+	bool listed;
+	struct csp_buffer_magazine_s * next;  /* Magazines of all threads */
+	csp_skbf_t * bufs[CSP_BUFFER_MAGAZINE_SIZE];
+} csp_buffer_magazine_t;
+
+#define CSP_BUFFER_MAGAZINE_BATCH ((CSP_BUFFER_MAGAZINE_SIZE + 1) / 2)
+
+static _Thread_local csp_buffer_magazine_t csp_buffer_magazine;
+static pthread_key_t csp_buffer_magazine_key;
+static pthread_once_t csp_buffer_magazine_once = PTHREAD_ONCE_INIT;
+static csp_buffer_magazine_t * csp_buffer_magazines;
+static pthread_mutex_t csp_buffer_magazines_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Free buffers, including those parked in magazines */
+static atomic_int csp_buffer_free_count;
+/* Bumped on every csp_buffer_init(), invalidating magazines filled from an older pool */
+static atomic_uint csp_buffer_generation;
+
+static void csp_buffer_magazine_drain(csp_buffer_magazine_t * mag, unsigned int keep) {
+	if (mag->count > keep) {
+		csp_buffer_pool_put_many(&mag->bufs[keep], mag->count - keep);
+		mag->count = keep;
+	}
+}
+
+static inline void csp_buffer_magazine_lock(csp_buffer_magazine_t * mag) {
+	while (atomic_flag_test_and_set_explicit(&mag->lock, memory_order_acquire)) {
+		sched_yield();
+	}
+}
+
+static inline void csp_buffer_magazine_unlock(csp_buffer_magazine_t * mag) {
+	atomic_flag_clear_explicit(&mag->lock, memory_order_release);
+}
+
+/* Return cached buffers to the pool when a thread exits */
+static void csp_buffer_magazine_destructor(void * arg) {
+	csp_buffer_magazine_t * mag = arg;
+
+	pthread_mutex_lock(&csp_buffer_magazines_lock);
+	for (csp_buffer_magazine_t ** m = &csp_buffer_magazines; *m != NULL; m = &(*m)->next) {
+		if (*m == mag) {
+			*m = mag->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&csp_buffer_magazines_lock);
+
+	csp_buffer_magazine_lock(mag);
+	if (mag->generation == csp_buffer_generation) {
+		csp_buffer_magazine_drain(mag, 0);
+	}
+	mag->count = 0;
+	mag->listed = false;
+	csp_buffer_magazine_unlock(mag);
+}
+
+/* Return the buffers parked in the magazines of other threads to the pool */
+static void csp_buffer_magazine_flush_others(csp_buffer_magazine_t * self) {
+	pthread_mutex_lock(&csp_buffer_magazines_lock);
+	for (csp_buffer_magazine_t * mag = csp_buffer_magazines; mag != NULL; mag = mag->next) {
+		if (mag == self) {
+			continue;
+		}
+		csp_buffer_magazine_lock(mag);
+		if (mag->generation == csp_buffer_generation) {
+			csp_buffer_magazine_drain(mag, 0);
+		}
+		csp_buffer_magazine_unlock(mag);
+	}
+	pthread_mutex_unlock(&csp_buffer_magazines_lock);
+}
+
+static void csp_buffer_magazine_key_create(void) {
+	pthread_key_create(&csp_buffer_magazine_key, csp_buffer_magazine_destructor);
+}
+
+/* The calling thread's magazine, returned locked */
+static csp_buffer_magazine_t * csp_buffer_magazine_get(void) {
+	csp_buffer_magazine_t * mag = &csp_buffer_magazine;
+	if (!mag->listed) {
+		/* First use by this thread */
+		pthread_once(&csp_buffer_magazine_once, csp_buffer_magazine_key_create);
+		pthread_setspecific(csp_buffer_magazine_key, mag);
+		pthread_mutex_lock(&csp_buffer_magazines_lock);
+		mag->next = csp_buffer_magazines;
+		csp_buffer_magazines = mag;
+		mag->listed = true;
+		pthread_mutex_unlock(&csp_buffer_magazines_lock);
+	}
+
+	csp_buffer_magazine_lock(mag);
+	unsigned int generation = csp_buffer_generation;
+	if (mag->generation != generation) {
+		/* First use by this thread, or the pool was re-initialized: cached pointers are stale */
+		mag->generation = generation;
+		mag->count = 0;
+	}
+	return mag;
+}
+
+static csp_skbf_t * csp_buffer_magazine_alloc(void) {
+	csp_buffer_magazine_t * mag = csp_buffer_magazine_get();
+	if (mag->count == 0) {
+		mag->count = csp_buffer_pool_take_many(mag->bufs, CSP_BUFFER_MAGAZINE_BATCH);
+	}
+	if (mag->count == 0) {
+		/* Unlocked while flushing, as other threads flushing lock this magazine too */
+		csp_buffer_magazine_unlock(mag);
+		csp_buffer_magazine_flush_others(mag);
+		mag = csp_buffer_magazine_get();
+		mag->count = csp_buffer_pool_take_many(mag->bufs, CSP_BUFFER_MAGAZINE_BATCH);
+		if (mag->count == 0) {
+			csp_buffer_magazine_unlock(mag);
+			return NULL;
+		}
+	}
+	csp_skbf_t * buf = mag->bufs[--mag->count];
+	csp_buffer_magazine_unlock(mag);
+	return buf;
+}
+
+static void csp_buffer_magazine_free(csp_skbf_t * buf) {
+	csp_buffer_magazine_t * mag = csp_buffer_magazine_get();
+	if (mag->count == CSP_BUFFER_MAGAZINE_SIZE) {
+		csp_buffer_magazine_drain(mag, CSP_BUFFER_MAGAZINE_SIZE - CSP_BUFFER_MAGAZINE_BATCH);
+	}
+	mag->bufs[mag->count++] = buf;
+	csp_buffer_magazine_unlock(mag);
+}
+
+#endif
+
 void csp_buffer_init(void) {
+#if (CSP_BUFFER_DYNAMIC)
+	csp_buffer_count = (csp_conf.buffer_count > 0) ? csp_conf.buffer_count : CSP_BUFFER_COUNT;
+	if (csp_buffer_arena_init(sizeof(csp_skbf_t), csp_buffer_count, csp_conf.buffer_hugepages, csp_buffer_slot_init) != 0) {
+		csp_buffer_count = 0;
+	}
+#else
 	/**
 	 * Chunk of memory allocated for CSP buffers:
 	 * This is marked as .noinit, because csp buffers can never be assumed zeroed out
@@ -27,25 +384,42 @@ void csp_buffer_init(void) {
 	static csp_static_queue_t csp_buffers_queue __noinit;
 	static char csp_buffer_queue_data[CSP_BUFFER_COUNT * sizeof(csp_skbf_t *)] __noinit;
 
+	csp_buffer_count = CSP_BUFFER_COUNT;
 	csp_buffers = csp_queue_create_static(CSP_BUFFER_COUNT, sizeof(csp_skbf_t *), csp_buffer_queue_data, &csp_buffers_queue);
 
 	for (unsigned int i = 0; i < CSP_BUFFER_COUNT; i++) {
 		csp_buffer_pool[i].skbf_addr = &csp_buffer_pool[i];
+		csp_buffer_pool[i].data_size = CSP_BUFFER_SIZE;
+		csp_buffer_pool[i].size_class = CSP_BUFFER_CLASS_MAIN;
 		csp_skbf_t * bufptr = &csp_buffer_pool[i];
 		csp_queue_enqueue(csp_buffers, &bufptr, 0);
 	}
+#endif
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	csp_buffer_free_count = csp_buffer_count;
+	csp_buffer_generation++;
+#endif
+
+#if (CSP_BUFFER_CLASSES > 0)
+	csp_buffer_classes_init();
+#endif
 }
 
-static csp_packet_t * csp_packet_init(csp_packet_t * packet)
+static csp_packet_t * csp_packet_init(csp_packet_t * packet, size_t data_size, uint8_t size_class)
 {
 
 #if (CSP_BUFFER_ZERO_CLEAR)
-	memset(packet, 0, sizeof(csp_packet_t));
+	memset(packet, 0, offsetof(csp_packet_t, data) + data_size);
+#else
+	(void)data_size; /* Avoid compiler warnings about unused parameter */
 #endif
 
 	packet->length = 0;
 	packet->frame_begin = packet->data;
 	packet->frame_length = 0;
+	packet->rx_crc_valid = 0;
+	packet->size_class = size_class;
 
 	csp_id_clear(&packet->id);
 
@@ -56,11 +430,11 @@ static csp_packet_t * csp_buffer_get_actual(int reserve, int isr) {
 
 	/* Get buffers remaining */
 	int remain;
-	if (isr) {
-		remain = csp_queue_size_isr(csp_buffers);
-	} else {
-		remain = csp_queue_size(csp_buffers);
-	}
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	remain = csp_buffer_free_count;
+#else
+	remain = csp_buffer_pool_available(isr);
+#endif
 	/* Respect the requested reserve */
 	if (remain <= reserve) {
 		return NULL;
@@ -68,12 +442,12 @@ static csp_packet_t * csp_buffer_get_actual(int reserve, int isr) {
 
 	/* Now fetch a buffer */
 	csp_skbf_t * buf = NULL;
-	if (isr) {
-		int task_woken = 0;
-		csp_queue_dequeue_isr(csp_buffers, &buf, &task_woken);
-	} else {
-		csp_queue_dequeue(csp_buffers, &buf, 0);
-	}
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	(void)isr; /* ISR context does not exist on POSIX */
+	buf = csp_buffer_magazine_alloc();
+#else
+	buf = csp_buffer_pool_take(isr);
+#endif
 
 	/* We might be out of buffers */
 	if (buf == NULL) {
@@ -86,11 +460,37 @@ static csp_packet_t * csp_buffer_get_actual(int reserve, int isr) {
 		return NULL;
 	}
 
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	csp_buffer_free_count--;
+#endif
+
+	buf->refcount = 1;
+
+	return csp_packet_init(&buf->skbf_data, CSP_BUFFER_SIZE, 0);
+}
+
+#if (CSP_BUFFER_CLASSES > 0)
+
+static csp_packet_t * csp_buffer_class_get(csp_buffer_class_t * class) {
+
+	csp_skbf_t * buf = NULL;
+	if (csp_queue_dequeue(class->queue, &buf, 0) != CSP_QUEUE_OK) {
+		return NULL;
+	}
+
+	if (buf != buf->skbf_addr) {
+		csp_dbg_errno = CSP_DBG_ERR_CORRUPT_BUFFER;
+		return NULL;
+	}
+
 	buf->refcount = 1;
 
-	return csp_packet_init(&buf->skbf_data);
+	/* The packet carries its class, numbered from 1 as 0 is a full data area */
+	return csp_packet_init(&buf->skbf_data, buf->data_size, buf->size_class + 1);
 }
 
+#endif
+
 void csp_buffer_free_isr(void * packet) {
 
 	if (packet == NULL) {
@@ -115,8 +515,20 @@ void csp_buffer_free_isr(void * packet) {
 		return;
 	}
 
-	int task_woken = 0;
-	csp_queue_enqueue_isr(csp_buffers, &buf, &task_woken);
+#if (CSP_BUFFER_CLASSES > 0)
+	if (buf->size_class != CSP_BUFFER_CLASS_MAIN) {
+		int task_woken = 0;
+		csp_queue_enqueue_isr(csp_buffer_classes[buf->size_class].queue, &buf, &task_woken);
+		return;
+	}
+#endif
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	csp_buffer_magazine_free(buf);
+	csp_buffer_free_count++;
+#else
+	csp_buffer_pool_put(buf, 1);
+#endif
 }
 
 void csp_buffer_free(void * packet) {
@@ -143,13 +555,26 @@ void csp_buffer_free(void * packet) {
 		return;
 	}
 
-	csp_queue_enqueue(csp_buffers, &buf, 0);
+#if (CSP_BUFFER_CLASSES > 0)
+	if (buf->size_class != CSP_BUFFER_CLASS_MAIN) {
+		csp_queue_enqueue(csp_buffer_classes[buf->size_class].queue, &buf, 0);
+		return;
+	}
+#endif
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	csp_buffer_magazine_free(buf);
+	csp_buffer_free_count++;
+#else
+	csp_buffer_pool_put(buf, 0);
+#endif
 }
 
 csp_packet_t * csp_buffer_clone(const csp_packet_t * packet) {
 	csp_packet_t * clone = NULL;
 	if (packet) {
-		clone = csp_buffer_get(0);
+		/* Keep the size class, so trailers that fit the original also fit the clone */
+		clone = csp_buffer_get_sized(csp_buffer_data_size(packet));
 		csp_buffer_copy(packet, clone);
 	}
 
@@ -158,7 +583,21 @@ csp_packet_t * csp_buffer_clone(const csp_packet_t * packet) {
 
 void csp_buffer_copy(const csp_packet_t * src, csp_packet_t * dst) {
 	if ((NULL != src) && (NULL != dst)) {
-		(void)memcpy(dst, src, sizeof(csp_packet_t));
+		/* Only copy the part of the data area in use, either by the packet or by a frame */
+		size_t data_size = src->length;
+		const uint8_t * frame_end = src->frame_begin + src->frame_length;
+		if ((frame_end > src->data) && ((size_t)(frame_end - src->data) > data_size)) {
+			data_size = frame_end - src->data;
+		}
+		if (csp_buffer_data_size(src) < data_size) {
+			data_size = csp_buffer_data_size(src);
+		}
+		if (csp_buffer_data_size(dst) < data_size) {
+			data_size = csp_buffer_data_size(dst);
+		}
+		uint8_t size_class = dst->size_class;
+		(void)memcpy(dst, src, offsetof(csp_packet_t, data) + data_size);
+		dst->size_class = size_class;
 		dst->frame_begin =  (dst->header + CSP_PACKET_PADDING_BYTES) - (src->data - src->frame_begin);
 	}
 }
@@ -179,8 +618,25 @@ void csp_buffer_refc_inc(void * buffer) {
 
 }
 
+size_t csp_buffer_data_size(const csp_packet_t * packet) {
+
+#if (CSP_BUFFER_CLASSES > 0)
+	/* Every class fits in a full data area, so a stale class on a packet outside the pool (e.g. on
+	 * the stack) never overstates its capacity */
+	if ((packet->size_class > 0) && (packet->size_class <= CSP_BUFFER_CLASSES)) {
+		return csp_buffer_classes[packet->size_class - 1].data_size;
+	}
+#endif
+
+	return sizeof(packet->data);
+}
+
 int csp_buffer_remaining(void) {
-	return csp_queue_size(csp_buffers);
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	return csp_buffer_free_count;
+#else
+	return csp_buffer_pool_available(0);
+#endif
 }
 
 /* CSP will use every remaining buffer in an attempt to allocate a packet
@@ -220,3 +676,24 @@ csp_packet_t * csp_buffer_get_isr(size_t unused) {
 	(void)unused; /* Avoid compiler warnings about unused parameter */
 	return csp_buffer_get_actual(CSP_BUFFER_RESERVE, 1);
 }
+
+csp_packet_t * csp_buffer_get_sized(size_t size) {
+
+	if (size > CSP_BUFFER_SIZE) {
+		return NULL;
+	}
+
+#if (CSP_BUFFER_CLASSES > 0)
+	/* Take the smallest class that fits, and fall back to larger ones when it is exhausted */
+	for (unsigned int c = 0; c < CSP_BUFFER_CLASSES; c++) {
+		if (size <= csp_buffer_classes[c].data_size) {
+			csp_packet_t * packet = csp_buffer_class_get(&csp_buffer_classes[c]);
+			if (packet != NULL) {
+				return packet;
+			}
+		}
+	}
+#endif
+
+	return csp_buffer_get_actual(CSP_BUFFER_RESERVE, 0);
+}
@@ -12,24 +12,161 @@
 #include "csp_macro.h"
 #include "csp_rdp_queue.h"
 #include "csp_rdp.h"
+#include "csp_qfifo.h"
 
-#define OUTGOING_PORTS (((1 << (CSP_ID2_PORT_SIZE)) - 1) - CSP_PORT_MAX_BIND)
-#if OUTGOING_PORTS > CSP_CONN_MAX
-#error "More connections than available outgoing ports"
+#if (CSP_CONN_DYNAMIC)
+#if !(CSP_POSIX)
+#error "CSP_CONN_DYNAMIC is only supported on POSIX"
 #endif
+#include "arch/posix/csp_conn_slab.h"
+#endif
+
+#if (CSP_CONN_DYNAMIC)
+/* Connection pool, a growable slab sized at runtime by csp_conf.conn_max */
+static unsigned int csp_conn_max;
 
+/* Open connections indexed by the tuple incoming packets are matched on, see csp_conn_find_existing() */
+static csp_conn_t * conn_hash_none[1];
+static csp_conn_t ** conn_hash = conn_hash_none;
+static unsigned int conn_hash_size = 1;
+#define CSP_CONN_HASH_SIZE conn_hash_size
+#else
 /* Connection pool */
 static csp_conn_t arr_conn[CSP_CONN_MAX] __noinit;
 
-void csp_conn_check_timeouts(void) {
+/* Open connections indexed by the tuple incoming packets are matched on, see csp_conn_find_existing() */
+#define CSP_CONN_HASH_SIZE (CSP_CONN_MAX * 2)
+static csp_conn_t * conn_hash[CSP_CONN_HASH_SIZE] __noinit;
+#endif
+
+/* Outgoing ports in use, one bit per port. Ports above CSP_PORT_MAX_BIND are handed out in
+ * turn, so a port just given back is not reused while late replies to it may still arrive. */
+static atomic_uint_least32_t conn_ports[256 / 32];
+static atomic_uint conn_port_next;
+
+/* Serialises connections being set up or closed, and guards the hash chains against them. A real
+ * lock even with a single router task, as the application runs in other tasks. */
+static csp_bin_sem_t conn_lock;
+
+/* Odd while a connection is added to or removed from the hash chains, under conn_lock. The router
+ * walks the chains without the lock, and looks up again under it if this changed meanwhile. */
+static atomic_uint conn_hash_seq;
+
 #if (CSP_USE_RDP)
-	for (int i = 0; i < CSP_CONN_MAX; i++) {
-		if (arr_conn[i].state == CONN_OPEN) {
-			if (arr_conn[i].idin.flags & CSP_FRDP) {
-				csp_rdp_check_timeouts(&arr_conn[i]);
-			}
+/* RDP connections ordered by the time they must be checked next, earliest first in a binary heap.
+ * Only the router arms connections, and with several router workers the RDP lock in csp_route.c
+ * guards the heap, see csp_rdp_t. */
+#if (CSP_CONN_DYNAMIC)
+static csp_conn_t ** conn_timers;
+#else
+static csp_conn_t * conn_timers[CSP_CONN_MAX] __noinit;
+#endif
+static unsigned int conn_timer_count;
+
+/* The router sleeps until this time, or until a packet arrives if it has nothing armed */
+static uint32_t conn_timer_wake;
+static bool conn_timer_idle;
+
+static inline bool csp_conn_timer_before(uint32_t time, uint32_t cmp) {
+	return (int32_t)(time - cmp) < 0;
+}
+
+static void csp_conn_timer_place(csp_conn_t * conn, unsigned int index) {
+	conn_timers[index] = conn;
+	conn->timer_index = index;
+}
+
+static void csp_conn_timer_sift_up(csp_conn_t * conn, unsigned int index) {
+	while (index > 0) {
+		unsigned int parent = (index - 1) / 2;
+		if (!csp_conn_timer_before(conn->deadline, conn_timers[parent]->deadline)) {
+			break;
+		}
+		csp_conn_timer_place(conn_timers[parent], index);
+		index = parent;
+	}
+	csp_conn_timer_place(conn, index);
+}
+
+static void csp_conn_timer_sift_down(csp_conn_t * conn, unsigned int index) {
+	while (1) {
+		unsigned int child = 2 * index + 1;
+		if (child >= conn_timer_count) {
+			break;
+		}
+		if ((child + 1 < conn_timer_count) && csp_conn_timer_before(conn_timers[child + 1]->deadline, conn_timers[child]->deadline)) {
+			child++;
+		}
+		if (!csp_conn_timer_before(conn_timers[child]->deadline, conn->deadline)) {
+			break;
+		}
+		csp_conn_timer_place(conn_timers[child], index);
+		index = child;
+	}
+	csp_conn_timer_place(conn, index);
+}
+
+static void csp_conn_timer_remove(csp_conn_t * conn) {
+
+	if (conn->timer_index < 0) {
+		return;
+	}
+
+	unsigned int index = conn->timer_index;
+	conn->timer_index = -1;
+
+	csp_conn_t * last = conn_timers[--conn_timer_count];
+	if (last != conn) {
+		csp_conn_timer_sift_down(last, index);
+		csp_conn_timer_sift_up(last, last->timer_index);
+	}
+}
+
+void csp_conn_timer_arm(csp_conn_t * conn, uint32_t deadline) {
+
+	if (conn->timer_index < 0) {
+		conn->deadline = deadline;
+		csp_conn_timer_sift_up(conn, conn_timer_count++);
+	} else if (csp_conn_timer_before(deadline, conn->deadline)) {
+		conn->deadline = deadline;
+		csp_conn_timer_sift_up(conn, conn->timer_index);
+	}
+	/* Connections are armed by any router worker, and only shard 0 checks the timeouts */
+	if (conn_timer_idle || csp_conn_timer_before(deadline, conn_timer_wake)) {
+		conn_timer_idle = false;
+		conn_timer_wake = deadline;
+		csp_qfifo_wake_up_shard(0);
+	}
+}
+#endif
+
+uint32_t csp_conn_check_timeouts(void) {
+#if (CSP_USE_RDP)
+	const uint32_t time_now = csp_get_ms();
+
+	/* Connections re-arm themselves for a later time while being checked */
+	while ((conn_timer_count > 0) && !csp_conn_timer_before(time_now, conn_timers[0]->deadline)) {
+
+		csp_conn_t * conn = conn_timers[0];
+		csp_conn_timer_remove(conn);
+
+		if ((conn->state == CONN_OPEN) && (conn->idin.flags & CSP_FRDP)) {
+			csp_rdp_check_timeouts(conn);
 		}
 	}
+
+	uint32_t timeout = CSP_MAX_TIMEOUT;
+
+	conn_timer_idle = (conn_timer_count == 0);
+	if (!conn_timer_idle) {
+		conn_timer_wake = conn_timers[0]->deadline;
+		uint32_t now = csp_get_ms();
+		timeout = csp_conn_timer_before(now, conn_timer_wake) ? conn_timer_wake - now : 0;
+	}
+
+	return timeout;
+#else
+	return CSP_MAX_TIMEOUT;
 #endif
 }
 
@@ -46,26 +183,201 @@ int csp_conn_enqueue_packet(csp_conn_t * conn, csp_packet_t * packet) {
 	return CSP_ERR_NONE;
 }
 
-void csp_conn_init(void) {
+static void csp_conn_slot_init(void * slot) {
 
-	for (int i = 0; i < CSP_CONN_MAX; i++) {
-		csp_conn_t * conn = &arr_conn[i];
+	csp_conn_t * conn = slot;
+
+	conn->sport_outgoing = 0;
+	conn->state = CONN_CLOSED;
+	conn->idin.flags = 0;
+#if (CSP_CONN_DYNAMIC)
+	/* Created by csp_conn_allocate(), so slots that are never used cost no queue */
+	conn->rx_queue = NULL;
+#else
+	conn->rx_queue = csp_queue_create_static(CSP_CONN_RXQUEUE_LEN, sizeof(csp_packet_t *), conn->rx_queue_static_data, &conn->rx_queue_static);
+#endif
+
+#if (CSP_USE_RDP)
+	csp_rdp_init(conn);
+	conn->timer_index = -1;
+#endif
+}
+
+#if (CSP_CONN_DYNAMIC)
 
-		conn->sport_outgoing = CSP_PORT_MAX_BIND + 1 + i;
-		conn->state = CONN_CLOSED;
-		conn->idin.flags = 0;
-		conn->rx_queue = csp_queue_create_static(CSP_CONN_RXQUEUE_LEN, sizeof(csp_packet_t *), conn->rx_queue_static_data, &conn->rx_queue_static);
+static void csp_conn_table_init(void) {
 
+	/* Queues of slots used before the slab is re-initialized, the packets they hold belong to
+	 * the buffer pool, which csp_init() has re-initialized already */
+	for (unsigned int i = 0; i < csp_conn_slab_slots(); i++) {
+		csp_conn_t * conn = csp_conn_slab_get(i);
+		if (conn->rx_queue != NULL) {
+			csp_queue_delete(conn->rx_queue);
+		}
+	}
+
+	if (conn_hash != conn_hash_none) {
+		free(conn_hash);
+	}
 #if (CSP_USE_RDP)
-		csp_rdp_init(conn);
+	free(conn_timers);
 #endif
+
+	csp_conn_max = (csp_conf.conn_max > 0) ? csp_conf.conn_max : CSP_CONN_MAX;
+	conn_hash_size = csp_conn_max * 2;
+	conn_hash = calloc(conn_hash_size, sizeof(*conn_hash));
+#if (CSP_USE_RDP)
+	conn_timers = calloc(csp_conn_max, sizeof(*conn_timers));
+	bool tables = (conn_hash != NULL) && (conn_timers != NULL);
+#else
+	bool tables = (conn_hash != NULL);
+#endif
+
+	if (!tables || (csp_conn_slab_init(sizeof(csp_conn_t), csp_conn_max, csp_conn_slot_init) != 0)) {
+		/* No connection can be opened, but incoming packets are still looked up */
+		free(conn_hash);
+		conn_hash = conn_hash_none;
+		conn_hash_size = 1;
+#if (CSP_USE_RDP)
+		free(conn_timers);
+		conn_timers = NULL;
+#endif
+		csp_conn_max = 0;
+		csp_conn_slab_init(sizeof(csp_conn_t), 0, csp_conn_slot_init);
 	}
 }
 
-csp_conn_t * csp_conn_find_dport(unsigned int dport) {
+static inline unsigned int csp_conn_slots(void) {
+	return csp_conn_slab_slots();
+}
 
+static inline csp_conn_t * csp_conn_slot(unsigned int index) {
+	return csp_conn_slab_get(index);
+}
+
+#else
+
+static void csp_conn_table_init(void) {
 	for (int i = 0; i < CSP_CONN_MAX; i++) {
-		csp_conn_t * conn = &arr_conn[i];
+		csp_conn_slot_init(&arr_conn[i]);
+	}
+}
+
+static inline unsigned int csp_conn_slots(void) {
+	return CSP_CONN_MAX;
+}
+
+static inline csp_conn_t * csp_conn_slot(unsigned int index) {
+	return &arr_conn[index];
+}
+
+#endif
+
+void csp_conn_init(void) {
+
+	csp_bin_sem_init(&conn_lock);
+#if (CSP_USE_RDP)
+	/* Requests posted to connections before, which may no longer exist */
+	csp_rdp_requests_init();
+#endif
+	csp_conn_table_init();
+
+	for (unsigned int i = 0; i < CSP_CONN_HASH_SIZE; i++) {
+		conn_hash[i] = NULL;
+	}
+
+	for (unsigned int i = 0; i < sizeof(conn_ports) / sizeof(conn_ports[0]); i++) {
+		atomic_store(&conn_ports[i], 0);
+	}
+	atomic_store(&conn_port_next, 0);
+
+#if (CSP_USE_RDP)
+	conn_timer_count = 0;
+	conn_timer_idle = true;
+#endif
+}
+
+/* Take a free outgoing port, or return 0 if all are in use */
+static uint8_t csp_conn_port_get(void) {
+
+	const unsigned int first = CSP_PORT_MAX_BIND + 1;
+	const unsigned int max = csp_id_get_max_port();
+	const unsigned int count = (max >= first) ? (max - first + 1) : 0;
+	const unsigned int start = atomic_load(&conn_port_next);
+
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int port = first + (start + i) % count;
+		uint32_t bit = 1U << (port % 32);
+		if ((atomic_fetch_or(&conn_ports[port / 32], bit) & bit) == 0) {
+			atomic_store(&conn_port_next, (start + i + 1) % count);
+			return port;
+		}
+	}
+
+	return 0;
+}
+
+static void csp_conn_port_put(uint8_t port) {
+	atomic_fetch_and(&conn_ports[port / 32], ~(1U << (port % 32)));
+}
+
+/* Client connections are found by dport alone, so they hash on it alone. dport of a server
+ * connection is a bound port and never collides with the outgoing ports used by clients. */
+static inline unsigned int csp_conn_hash_client(unsigned int dport) {
+	return dport % CSP_CONN_HASH_SIZE;
+}
+
+static inline unsigned int csp_conn_hash_server(unsigned int src, unsigned int sport, unsigned int dport) {
+	uint32_t hash = (src << 16) ^ (sport << 8) ^ dport;
+	hash *= 2654435761U;
+	return (hash >> 16) % CSP_CONN_HASH_SIZE;
+}
+
+static inline unsigned int csp_conn_hash(const csp_conn_t * conn) {
+	if (conn->type == CONN_CLIENT) {
+		return csp_conn_hash_client(conn->idin.dport);
+	}
+	return csp_conn_hash_server(conn->idin.src, conn->idin.sport, conn->idin.dport);
+}
+
+static inline void csp_conn_hash_write_begin(void) {
+	atomic_fetch_add_explicit(&conn_hash_seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static inline void csp_conn_hash_write_end(void) {
+	atomic_fetch_add_explicit(&conn_hash_seq, 1, memory_order_release);
+}
+
+static inline unsigned int csp_conn_hash_read_begin(void) {
+	return atomic_load_explicit(&conn_hash_seq, memory_order_acquire);
+}
+
+/* False if the lookup may have missed a connection, or matched one being set up */
+static inline bool csp_conn_hash_read_end(unsigned int seq) {
+	atomic_thread_fence(memory_order_acquire);
+	return ((seq & 1) == 0) && (atomic_load_explicit(&conn_hash_seq, memory_order_relaxed) == seq);
+}
+
+static void csp_conn_hash_add(csp_conn_t * conn) {
+	unsigned int bucket = csp_conn_hash(conn);
+	conn->hash_next = conn_hash[bucket];
+	conn_hash[bucket] = conn;
+}
+
+static void csp_conn_hash_remove(csp_conn_t * conn) {
+	for (csp_conn_t ** pos = &conn_hash[csp_conn_hash(conn)]; *pos != NULL; pos = &(*pos)->hash_next) {
+		if (*pos == conn) {
+			*pos = conn->hash_next;
+			conn->hash_next = NULL;
+			break;
+		}
+	}
+}
+
+static csp_conn_t * csp_conn_lookup_dport(unsigned int dport) {
+
+	for (csp_conn_t * conn = conn_hash[csp_conn_hash_client(dport)]; conn != NULL; conn = conn->hash_next) {
 
 		/* Connection must match dport */
 		if (conn->idin.dport != dport)
@@ -86,54 +398,58 @@ csp_conn_t * csp_conn_find_dport(unsigned int dport) {
 	return NULL;
 }
 
-csp_conn_t * csp_conn_find_existing(csp_id_t * id) {
+csp_conn_t * csp_conn_find_dport(unsigned int dport) {
 
-	for (int i = 0; i < CSP_CONN_MAX; i++) {
-		csp_conn_t * conn = &arr_conn[i];
+	/* Retry under the lock rather than spin, the task changing the chains may be preempted */
+	unsigned int seq = csp_conn_hash_read_begin();
+	csp_conn_t * conn = csp_conn_lookup_dport(dport);
+	if (csp_conn_hash_read_end(seq)) {
+		return conn;
+	}
+
+	csp_bin_sem_wait(&conn_lock, CSP_MAX_TIMEOUT);
+	conn = csp_conn_lookup_dport(dport);
+	csp_bin_sem_post(&conn_lock);
+
+	return conn;
+}
+
+static csp_conn_t * csp_conn_lookup_existing(csp_id_t * id) {
+
+	/* Outgoing connections are uniquely defined by the source port,
+	 * So only the incoming destination port must match. This means
+	 * that responses to broadcast addresses, are accepted as long
+	 * as the incoming port matches the unique source port of the
+	 * connection */
+	csp_conn_t * conn = csp_conn_lookup_dport(id->dport);
+	if (conn != NULL) {
+		return conn;
+	}
+
+	/* Incoming connections are uniquely defined by the source and
+	 * destination port, as well as the source node. Incoming
+	 * connections can never come from a broadcast address */
+	for (conn = conn_hash[csp_conn_hash_server(id->src, id->sport, id->dport)]; conn != NULL; conn = conn->hash_next) {
 
 		/* Connection must be open */
 		if (conn->state != CONN_OPEN)
 			continue;
 
-		/**
-		 * This search looks verbose, Instead of a big if statement, it is written out as
-		 * conditions. This has been done for clarity. The least likely check is put first
-		 * for runtime speed improvement.
-		 * Also this is written using explicit fields, not bitmasks, in order to improve
-		 * portability and dual use between different header formats.
-		 */
-
-		/* Outgoing connections are uniquely defined by the source port,
-		 * So only the incoming destination port must match. This means
-		 * that responses to broadcast addresses, are accepted as long
-		 * as the incoming port matches the unique source port of the
-		 * connection */
-		if (conn->type == CONN_CLIENT) {
-
-			/* Connection must match dport */
-			if (conn->idin.dport != id->dport)
-				continue;
-
-		/* Incoming connections are uniquely defined by the source and
-		 * destination port, as well as the source node. Incoming
-		 * connections can never come from a broadcast address */
-		} else {
-
-			/* Connection must match dport */
-			if (conn->idin.dport != id->dport)
-				continue;
-
-			/* Connection must match sport */
-			if (conn->idin.sport != id->sport)
-				continue;
-
-			/* Connection must match source */
-			if (conn->idin.src != id->src)
-				continue;
+		/* Connection must be server */
+		if (conn->type != CONN_SERVER)
+			continue;
 
-		}
+		/* Connection must match dport */
+		if (conn->idin.dport != id->dport)
+			continue;
 
+		/* Connection must match sport */
+		if (conn->idin.sport != id->sport)
+			continue;
 
+		/* Connection must match source */
+		if (conn->idin.src != id->src)
+			continue;
 
 		/* All conditions found! */
 		return conn;
@@ -142,6 +458,21 @@ csp_conn_t * csp_conn_find_existing(csp_id_t * id) {
 	return NULL;
 }
 
+csp_conn_t * csp_conn_find_existing(csp_id_t * id) {
+
+	unsigned int seq = csp_conn_hash_read_begin();
+	csp_conn_t * conn = csp_conn_lookup_existing(id);
+	if (csp_conn_hash_read_end(seq)) {
+		return conn;
+	}
+
+	csp_bin_sem_wait(&conn_lock, CSP_MAX_TIMEOUT);
+	conn = csp_conn_lookup_existing(id);
+	csp_bin_sem_post(&conn_lock);
+
+	return conn;
+}
+
 static int csp_conn_flush_rx_queue(csp_conn_t * conn) {
 
 	csp_packet_t * packet;
@@ -156,8 +487,42 @@ static int csp_conn_flush_rx_queue(csp_conn_t * conn) {
 	return CSP_ERR_NONE;
 }
 
+/* Give back the slot and outgoing port of an open connection. Only the task that moves the
+ * connection to closed does, should several close it at once. */
+static void csp_conn_release(csp_conn_t * conn) {
+
+	uint8_t port = conn->sport_outgoing;
+
+	int expected = CONN_OPEN;
+	if (!atomic_compare_exchange_strong(&conn->state, &expected, CONN_CLOSED)) {
+		return;
+	}
+
+	if (port != 0) {
+		csp_conn_port_put(port);
+	}
+
+#if (CSP_CONN_DYNAMIC)
+	csp_conn_slab_free(conn);
+#endif
+}
+
 csp_conn_t * csp_conn_allocate(csp_conn_type_t type) {
 
+#if (CSP_CONN_DYNAMIC)
+	csp_conn_t * conn = csp_conn_slab_alloc();
+	if (conn != NULL) {
+		conn->sport_outgoing = 0;
+		conn->state = CONN_OPEN;
+		if (conn->rx_queue == NULL) {
+			conn->rx_queue = csp_queue_create_static(CSP_CONN_RXQUEUE_LEN, sizeof(csp_packet_t *), NULL, NULL);
+			if (conn->rx_queue == NULL) {
+				csp_conn_release(conn);
+				conn = NULL;
+			}
+		}
+	}
+#else
 	static uint8_t csp_conn_last_given = 0;
 
 	/* Search for free connection */
@@ -169,10 +534,12 @@ csp_conn_t * csp_conn_allocate(csp_conn_type_t type) {
 		int expected = CONN_CLOSED;
 		if (atomic_compare_exchange_strong(&arr_conn[i].state, &expected, CONN_OPEN)) {
 			conn = &arr_conn[i];
+			conn->sport_outgoing = 0;
 			csp_conn_last_given = i;
 			break;
 		}
 	}
+#endif
 
 	if (conn == NULL) {
 		csp_dbg_conn_out++;
@@ -188,25 +555,57 @@ csp_conn_t * csp_conn_allocate(csp_conn_type_t type) {
 
 csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout, csp_conn_type_t type) {
 
-	/* Allocate connection structure */
+	/* Outgoing connections are told apart by their source port alone */
+	uint8_t port = 0;
+	if (type == CONN_CLIENT) {
+		port = csp_conn_port_get();
+		if (port == 0) {
+			csp_dbg_errno = CSP_DBG_ERR_PORTS_EXHAUSTED;
+			return NULL;
+		}
+	}
+
+	/* Allocate connection structure. Nobody else has a reference to it yet, but router workers
+	 * must not match it against incoming packets before the identifiers are set. */
+	csp_bin_sem_wait(&conn_lock, CSP_MAX_TIMEOUT);
 	csp_conn_t * conn = csp_conn_allocate(type);
 
 	if (conn) {
-		/* No lock is needed here, because nobody else *
-		 * has a reference to this connection yet.     */
 		csp_id_copy(&conn->idin, &idin);
 		csp_id_copy(&conn->idout, &idout);
+		atomic_store(&conn->pri, idout.pri);
+
+		if (type == CONN_CLIENT) {
+			conn->sport_outgoing = port;
+			conn->idout.sport = port;
+			conn->idin.dport = port;
+		}
 
 		conn->timestamp = csp_get_ms();
 
 		/* Ensure connection queue is empty */
 		csp_conn_flush_rx_queue(conn);
+
+		csp_conn_hash_write_begin();
+		csp_conn_hash_add(conn);
+		csp_conn_hash_write_end();
+	} else if (port != 0) {
+		csp_conn_port_put(port);
 	}
+	csp_bin_sem_post(&conn_lock);
 
 	return conn;
 }
 
 int csp_close(csp_conn_t * conn) {
+
+#if (CSP_USE_RDP)
+	/* The router owns RDP connections and closes them once it has sent what was posted */
+	if ((conn != NULL) && (conn->state == CONN_OPEN) && ((conn->idin.flags & CSP_FRDP) || (conn->idout.flags & CSP_FRDP))) {
+		return csp_rdp_close_request(conn);
+	}
+#endif
+
 	return csp_conn_close(conn, CSP_RDP_CLOSED_BY_USERSPACE);
 }
 
@@ -241,12 +640,44 @@ int csp_conn_close(csp_conn_t * conn, uint8_t closed_by) {
 	}
 #endif
 
+#if (CSP_USE_RDP)
+	/* Nothing is left to time out */
+	csp_conn_timer_remove(conn);
+#endif
+
 	/* Set to closed */
-	conn->state = CONN_CLOSED;
+	csp_bin_sem_wait(&conn_lock, CSP_MAX_TIMEOUT);
+	if (conn->state != CONN_CLOSED) {
+		csp_conn_hash_write_begin();
+		csp_conn_hash_remove(conn);
+		csp_conn_release(conn);
+		csp_conn_hash_write_end();
+	}
+	csp_bin_sem_post(&conn_lock);
 
 	return CSP_ERR_NONE;
 }
 
+void csp_conn_detach_socket(csp_socket_t * socket) {
+
+	const unsigned int slots = csp_conn_slots();
+	for (unsigned int i = 0; i < slots; i++) {
+		csp_conn_t * conn = csp_conn_slot(i);
+
+		csp_bin_sem_wait(&conn_lock, CSP_MAX_TIMEOUT);
+		bool pending = (conn->state == CONN_OPEN) && (conn->dest_socket == socket);
+		if (pending) {
+			conn->dest_socket = NULL;
+		}
+		csp_bin_sem_post(&conn_lock);
+
+		/* Nobody will accept it now */
+		if (pending) {
+			csp_close(conn);
+		}
+	}
+}
+
 csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t timeout, uint32_t opts) {
 	(void)timeout; /* Avoid compiler warnings about unused parameter */
 
@@ -309,9 +740,6 @@ csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t ti
 		return NULL;
 	}
 
-	/* Outgoing connections always use pre-defined source port */
-	conn->idout.sport = conn->sport_outgoing;
-	conn->idin.dport = conn->sport_outgoing;
 	conn->dest_socket = NULL;
 
 	/* Set connection options */
@@ -362,8 +790,9 @@ int csp_conn_flags(const csp_conn_t * conn) {
 
 void csp_conn_print_table(void) {
 
-	for (unsigned int i = 0; i < CSP_CONN_MAX; i++) {
-		__unused csp_conn_t * conn = &arr_conn[i];
+	const unsigned int slots = csp_conn_slots();
+	for (unsigned int i = 0; i < slots; i++) {
+		__unused csp_conn_t * conn = csp_conn_slot(i);
 		csp_print("[%02u %p] S:%u, %u -> %u, %u -> %u (%u) fl %x\r\n",
 		          i, (void *)conn, conn->state, conn->idin.src, conn->idin.dst,
 		          conn->idin.dport, conn->idin.sport, conn->sport_outgoing, conn->idin.flags);
@@ -384,10 +813,11 @@ void csp_conn_print_table(void) {
 int csp_conn_print_table_str(char * str_buf, int str_size) {
 
 	/* Display up to 10 connections */
-	unsigned int start = (CSP_CONN_MAX > 10) ? (CSP_CONN_MAX - 10) : 0;
+	const unsigned int slots = csp_conn_slots();
+	unsigned int start = (slots > 10) ? (slots - 10) : 0;
 
-	for (unsigned int i = start; i < CSP_CONN_MAX; i++) {
-		csp_conn_t * conn = &arr_conn[i];
+	for (unsigned int i = start; i < slots; i++) {
+		csp_conn_t * conn = csp_conn_slot(i);
 		char buf[100];
 		snprintf(buf, sizeof(buf), "[%02u %p] S:%u, %u -> %u, %u -> %u (%u)\n",
 				 i, (void *)conn, conn->state, conn->idin.src, conn->idin.dst,
@@ -405,8 +835,14 @@ int csp_conn_print_table_str(char * str_buf, int str_size) {
 #endif
 
 const csp_conn_t * csp_conn_get_array(size_t * size) {
+#if (CSP_CONN_DYNAMIC)
+        /* Connections are spread over the chunks of the slab */
+        *size = 0;
+        return NULL;
+#else
         *size = CSP_CONN_MAX;
         return arr_conn;
+#endif
 }
 
 bool csp_conn_is_active(csp_conn_t *conn) {
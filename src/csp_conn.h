@@ -32,11 +32,25 @@ typedef enum {
 #define CSP_RDP_CLOSED_BY_TIMEOUT   0x04
 #define CSP_RDP_CLOSED_BY_ALL       (CSP_RDP_CLOSED_BY_USERSPACE | CSP_RDP_CLOSED_BY_PROTOCOL | CSP_RDP_CLOSED_BY_TIMEOUT)
 
+/**
+ * RDP segment held for retransmission or reordering
+ */
+typedef struct {
+	csp_packet_t * packet;
+	uint16_t seq_nr;
+	bool sacked;  /**< TX: reported received by EACK, kept until acknowledged as the receiver may still drop it */
+} csp_rdp_slot_t;
+
 /**
  * RDP Connection
+ *
+ * Threading: the router is the only task that changes the RDP state of a connection, one router
+ * worker at a time under the RDP lock in csp_route.c. User tasks never write it. Instead they post
+ * segments to tx_post and RDP_REQ_* requests, and list the connection for the router, see
+ * csp_rdp_process_requests(). The few fields user tasks touch are atomic and marked (shared).
  */
 typedef struct {
-	csp_rdp_state_t state; /**< Connection state */
+	_Atomic(csp_rdp_state_t) state; /**< Connection state (shared) */
 	uint8_t closed_by;     /**< Tracks 'who' have closed the RDP connection */
 	uint16_t snd_nxt;      /**< The sequence number of the next segment that is to be sent */
 	uint16_t snd_una;      /**< The sequence number of the oldest unacknowledged segment */
@@ -51,7 +65,36 @@ typedef struct {
 	uint32_t ack_timeout;
 	uint32_t ack_delay_count;
 	uint32_t ack_timestamp;
+	atomic_uint_least32_t rto;    /**< Retransmission timeout in ms, starts at packet_timeout and adapts to the measured RTT (shared) */
+	atomic_uint_least32_t srtt;   /**< Smoothed round trip time in ms, scaled by 8 (shared) */
+	atomic_uint_least32_t rttvar; /**< Round trip time variation in ms, scaled by 4 (shared) */
+	uint32_t rtt_timestamp; /**< Time the segment being timed was sent */
+	uint16_t rtt_seq;       /**< The sequence number of the segment being timed */
+	bool rtt_active;        /**< A segment is being timed, only one at a time and never a retransmitted one */
+	uint32_t cwnd;          /**< Congestion window in segments, at most window_size */
+	uint32_t cwnd_acked;    /**< Segments acknowledged since the congestion window last grew */
+	atomic_uint_least32_t retransmits;      /**< Segments retransmitted on the connection (shared) */
+	atomic_uint_least32_t fast_retransmits; /**< Segments retransmitted on duplicate EACKs, before they timed out (shared) */
+	uint16_t snd_sack;      /**< One past the highest sequence number reported received by EACK */
+	uint16_t fast_recover;  /**< snd_nxt when fast recovery began, recovery ends once it is acknowledged */
+	uint16_t fast_high;     /**< Missing segments before this have been retransmitted in the current recovery */
+	uint16_t dup_acks;      /**< EACKs received since snd_una last advanced */
+	bool fast_recovery;     /**< Missing segments are retransmitted as EACKs report them */
+	atomic_uint_least32_t tx_window; /**< cwnd, as published to user tasks (shared) */
+	atomic_uint_least32_t tx_credit; /**< Segments posted by user tasks and not acknowledged yet, at most tx_window (shared) */
+	_Atomic(csp_packet_t *) tx_post; /**< Segments posted by user tasks, newest first, linked by next (shared) */
+	csp_packet_t * tx_head;          /**< Posted segments waiting for the window, oldest first */
+	csp_packet_t * tx_tail;
+	atomic_uint requests;   /**< RDP_REQ_* flags posted by user tasks (shared) */
+	atomic_bool listed;     /**< On the router's list of connections with requests (shared) */
+	csp_conn_t * list_next; /**< Next connection on that list, written by the task listing it */
+	atomic_bool ack_withheld; /**< An ACK was held back for lack of room in the RX queue (shared) */
+	atomic_bool tx_blocked; /**< csp_send_nonblock() found the window full, notify CSP_RDP_EVENT_WRITABLE (shared) */
+	_Atomic(csp_rdp_event_callback_t) event_callback; /**< Set with csp_rdp_set_event_callback(), cleared on close (shared) */
+	void * event_arg;
 	csp_bin_sem_t tx_wait;
+	csp_rdp_slot_t tx_ring[CSP_RDP_MAX_WINDOW];     /**< Segments awaiting ACK, indexed by seq_nr % CSP_RDP_MAX_WINDOW */
+	csp_rdp_slot_t rx_ring[CSP_RDP_MAX_WINDOW * 2]; /**< Segments received out of sequence, indexed by seq_nr % (CSP_RDP_MAX_WINDOW * 2) */
 
 } csp_rdp_t;
 
@@ -60,25 +103,41 @@ struct csp_conn_s {
 	atomic_int type;   /* Connection type (CONN_CLIENT or CONN_SERVER) */
 	atomic_int state; /* Connection state (CONN_OPEN or CONN_CLOSED) */
 	csp_id_t idin;          /* Identifier received */
-	csp_id_t idout;         /* Identifier transmitted */
-	uint8_t sport_outgoing; /* When used for outgoing, use this sport */
+	csp_id_t idout;         /* Identifier transmitted, but see csp_conn_idout() */
+	atomic_uint_least8_t pri; /* Priority of outgoing packets, changed by csp_send_prio() */
+	uint8_t sport_outgoing; /* Source port of an outgoing connection, 0 for incoming ones */
 
-	csp_queue_handle_t rx_queue;        /* Queue for RX packets */
+	csp_queue_handle_t rx_queue;        /* Queue for RX packets, created on first use with CSP_CONN_DYNAMIC */
+#if !(CSP_CONN_DYNAMIC)
 	csp_static_queue_t rx_queue_static; /* Static storage for rx queue */
 	char rx_queue_static_data[sizeof(csp_packet_t *) * CSP_CONN_RXQUEUE_LEN];
+#endif
 
 	void (*callback)(csp_packet_t * packet);
 
 	csp_socket_t * dest_socket; /* incoming connections destination socket */
-	uint32_t timestamp;         /* Time the connection was opened */
+	atomic_uint_least32_t timestamp; /* Time the connection was opened */
 	uint32_t opts;              /* Connection or socket options */
+	csp_conn_t * hash_next;     /* Next open connection in the same lookup bucket */
 #if (CSP_USE_RDP)
 	csp_rdp_t rdp; /* RDP state */
+	uint32_t deadline;          /* Time RDP must check the connection next, see csp_conn_timer_arm() */
+	int timer_index;            /* Position in the timer heap, -1 when not armed */
 #endif
 };
 
 
 
+/**
+ * Identifier to send with on a connection. idout is fixed once the connection is set up, its
+ * priority is kept apart so csp_send_prio() can change it while other tasks send.
+ */
+static inline csp_id_t csp_conn_idout(const csp_conn_t * conn) {
+	csp_id_t idout = conn->idout;
+	idout.pri = atomic_load(&conn->pri);
+	return idout;
+}
+
 int csp_conn_enqueue_packet(csp_conn_t * conn, csp_packet_t * packet);
 void csp_conn_init(void);
 csp_conn_t * csp_conn_allocate(csp_conn_type_t type);
@@ -87,7 +146,29 @@ csp_conn_t * csp_conn_find_existing(csp_id_t * id);
 csp_conn_t * csp_conn_find_dport(unsigned int dport);
 
 csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout, csp_conn_type_t type);
-void csp_conn_check_timeouts(void);
+
+/**
+ * Make sure csp_conn_check_timeouts() checks an RDP connection no later than deadline.
+ * An earlier deadline replaces the armed one, a later one is ignored: the check re-arms the
+ * connection for whatever is due next. Wakes the router if it sleeps past the new deadline.
+ * Only called by RDP, from the router with the RDP lock held.
+ * @param conn RDP connection
+ * @param deadline time in ms, as returned by csp_get_ms()
+ */
+void csp_conn_timer_arm(csp_conn_t * conn, uint32_t deadline);
+
+/**
+ * Check the RDP connections whose deadline has passed.
+ * @return ms until the next deadline, #CSP_MAX_TIMEOUT if no connection is armed
+ */
+uint32_t csp_conn_check_timeouts(void);
 int csp_conn_get_rxq(int prio);
 int csp_conn_close(csp_conn_t * conn, uint8_t closed_by);
+
+/**
+ * Close the new connections the router has not queued to a socket yet, so it stops posting
+ * them there. Called when the socket closes.
+ * @param socket socket being closed
+ */
+void csp_conn_detach_socket(csp_socket_t * socket);
 const csp_conn_t * csp_conn_get_array(size_t * size);  // for test purposes only!
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Update a CRC32 with a chunk of data, without the initial and final inversion.
+ */
+typedef uint32_t (*csp_crc32_kernel_t)(uint32_t crc, const uint8_t * data, uint32_t length);
+
+/**
+ * Select the implementation used by csp_crc32_update(), which otherwise picks the fastest one
+ * the CPU supports on first use. All implementations give the same results, this is meant for
+ * tests and benchmarks.
+ * @param name "table", "slice8", "sse4.2", "armv8", or NULL for the fastest one supported
+ * @return name of the implementation selected, NULL if not built or not supported by the CPU
+ */
+const char * csp_crc32_select(const char * name);
@@ -10,6 +10,8 @@ uint8_t csp_dbg_conn_noroute;
 uint8_t csp_dbg_can_errno;
 uint8_t csp_dbg_eth_errno;
 uint8_t csp_dbg_inval_reply;
+uint32_t csp_dbg_dedup_hit;
+uint32_t csp_dbg_dedup_miss;
 uint8_t csp_dbg_rdp_print;
 uint8_t csp_dbg_packet_print;
 
@@ -2,47 +2,140 @@
 
 #include "csp_dedup.h"
 
-#include <stdlib.h>
+#include <string.h>
 
-#include <csp/arch/csp_time.h>
+#include <csp/csp.h>
 #include <csp/csp_crc32.h>
-#include <csp/csp_id.h>
+#include <csp/csp_debug.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_route.h"
+
+/* Packets remembered with csp_conf.dedup_count = 0 */
+#ifndef CSP_DEDUP_MAX
+#define CSP_DEDUP_MAX 64  //! Maximum number of packets remembered, storage is reserved at build time
+#endif
 
-/* Check the last CSP_DEDUP_COUNT packets for duplicates */
-#define CSP_DEDUP_COUNT 16
+/* Packets with keys in the same set are checked against each other */
+#define CSP_DEDUP_WAYS 4
 
-/* Only consider packet a duplicate if received under CSP_DEDUP_WINDOW_MS ago */
+/* Only consider packet a duplicate if received under csp_conf.dedup_window_ms ago, 0 = this */
 #define CSP_DEDUP_WINDOW_MS 100
 
-/* Store packet CRC's in a ringbuffer */
-static uint32_t csp_dedup_array[CSP_DEDUP_COUNT] = {0};
-static uint32_t csp_dedup_timestamp[CSP_DEDUP_COUNT] = {0};
-static unsigned int csp_dedup_in = 0;
+#define CSP_DEDUP_SETS (CSP_DEDUP_MAX / CSP_DEDUP_WAYS)
+
+#if (CSP_DEDUP_SETS < 1)
+#error "CSP_DEDUP_MAX must be at least 4"
+#endif
+
+/**
+ * Keys of packets seen, hashed into sets. Each set is a ring in order of arrival, so a new key
+ * replaces the oldest of its set, and a lookup stops at the first key out of the window.
+ */
+typedef struct {
+	uint64_t key[CSP_DEDUP_WAYS];
+	uint32_t timestamp[CSP_DEDUP_WAYS];
+	uint8_t in;
+	uint8_t used;
+} csp_dedup_set_t;
+
+static csp_dedup_set_t csp_dedup_set[CSP_DEDUP_SETS];
+
+static unsigned int csp_dedup_sets = CSP_DEDUP_SETS;
+static uint32_t csp_dedup_window_ms = CSP_DEDUP_WINDOW_MS;
+static csp_route_lock_t csp_dedup_lock = CSP_ROUTE_LOCK_INIT;
+
+static inline uint64_t csp_dedup_mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t csp_dedup_key(const csp_packet_t * packet) {
+
+	const csp_id_t * id = &packet->id;
+	uint64_t h = ((uint64_t)id->pri << 56) | ((uint64_t)id->flags << 48) | ((uint64_t)id->src << 32) |
+				 ((uint64_t)id->dst << 16) | ((uint64_t)id->sport << 8) | id->dport;
+	h = csp_dedup_mix(h ^ ((uint64_t)packet->length << 40));
+
+	/* The last 4 bytes of the data are the CRC32 trailer, if any */
+	uint32_t tail = 0;
+	if (packet->length < sizeof(tail)) {
+		memcpy(&tail, packet->data, packet->length);
+		return csp_dedup_mix(h ^ tail);
+	}
+	memcpy(&tail, &packet->data[packet->length - sizeof(tail)], sizeof(tail));
+
+	/* The CRC32 trailer already sums up the data */
+	if (id->flags & CSP_FCRC32) {
+		return csp_dedup_mix(h ^ tail);
+	}
+
+	/* Otherwise the CRC32 of the rest, which the driver may have computed while receiving */
+	uint32_t crc = packet->rx_crc_valid ? packet->rx_crc : csp_crc32_memory(packet->data, packet->length - sizeof(tail));
+	return csp_dedup_mix(h ^ (((uint64_t)crc << 32) | tail));
+}
+
+void csp_dedup_init(void) {
+
+	unsigned int count = csp_conf.dedup_count;
+	if ((count == 0) || (count > CSP_DEDUP_MAX)) {
+		count = CSP_DEDUP_MAX;
+	}
+	if (count < CSP_DEDUP_WAYS) {
+		count = CSP_DEDUP_WAYS;
+	}
+
+	csp_route_lock(&csp_dedup_lock);
+	csp_dedup_sets = count / CSP_DEDUP_WAYS;
+	csp_dedup_window_ms = csp_conf.dedup_window_ms ? csp_conf.dedup_window_ms : CSP_DEDUP_WINDOW_MS;
+	memset(csp_dedup_set, 0, sizeof(csp_dedup_set));
+	csp_dbg_dedup_hit = 0;
+	csp_dbg_dedup_miss = 0;
+	csp_route_unlock(&csp_dedup_lock);
+}
 
 bool csp_dedup_is_duplicate(csp_packet_t * packet) {
-	/* Calculate CRC32 for packet */
-	csp_id_prepend(packet);
-	uint32_t crc = csp_crc32_memory(packet->frame_begin, packet->frame_length);
+
+	uint64_t key = csp_dedup_key(packet);
 	uint32_t time = csp_get_ms();
+	bool duplicate = false;
+
+	csp_route_lock(&csp_dedup_lock);
 
 	/* Check if we have received this packet before, start looking from newest packet */
-	unsigned int i = (csp_dedup_in-1) % CSP_DEDUP_COUNT;
-	while (i != csp_dedup_in) {
-		/* Check the timestamp */
-		if (time > csp_dedup_timestamp[i] + CSP_DEDUP_WINDOW_MS) {
+	csp_dedup_set_t * set = &csp_dedup_set[(key >> 32) % csp_dedup_sets];
+	unsigned int i = set->in;
+	for (unsigned int n = 0; n < set->used; n++) {
+		i = (i - 1) & (CSP_DEDUP_WAYS - 1);
+		/* Check the timestamp, older packets of the set are out of the window too */
+		if ((uint32_t)(time - set->timestamp[i]) > csp_dedup_window_ms) {
 			break;
 		}
 		/* Check for match */
-		if (crc == csp_dedup_array[i]) {
-			return true;
+		if (key == set->key[i]) {
+			duplicate = true;
+			break;
 		}
-		i = (i-1) & (CSP_DEDUP_COUNT-1);
 	}
 
 	/* If not, insert packet into duplicate list */
-	csp_dedup_array[csp_dedup_in] = crc;
-	csp_dedup_timestamp[csp_dedup_in] = time;
-	csp_dedup_in = (csp_dedup_in + 1) % CSP_DEDUP_COUNT;
+	if (!duplicate) {
+		set->key[set->in] = key;
+		set->timestamp[set->in] = time;
+		set->in = (set->in + 1) & (CSP_DEDUP_WAYS - 1);
+		if (set->used < CSP_DEDUP_WAYS) {
+			set->used++;
+		}
+		csp_dbg_dedup_miss++;
+	} else {
+		csp_dbg_dedup_hit++;
+	}
+
+	csp_route_unlock(&csp_dedup_lock);
 
-	return false;
+	return duplicate;
 }
@@ -2,6 +2,11 @@
 
 #include <csp/csp_types.h>
 
+/**
+ * Size the duplicate list from csp_conf and forget all packets, called by csp_init().
+ */
+void csp_dedup_init(void);
+
 /**
  * Check for a duplicate packet
  * @param packet pointer to packet
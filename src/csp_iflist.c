@@ -3,15 +3,130 @@
 #include <csp/csp_iflist.h>
 #include <csp/csp_id.h>
 
+#include <stdatomic.h>
 #include <string.h>
 
 #include "csp/autoconfig.h"
 #include <csp/csp_debug.h>
 #include <csp/interfaces/csp_if_lo.h>
+#include "csp_io.h"
 
 /* Interfaces are stored in a linked list */
 static csp_iface_t * interfaces = NULL;
 
+/**
+ * The router looks up interfaces for every packet, so the list is also indexed, with subnet masks
+ * worked out in advance. The index is rebuilt when the list changes, and by csp_iflist_update(),
+ * into the copy not in use, and published by a pointer swap. Lists longer than the index are
+ * searched the slow way, and so are lookups racing with a rebuild.
+ */
+#ifndef CSP_IFLIST_INDEX_MAX
+#define CSP_IFLIST_INDEX_MAX 16
+#endif
+#define IFLIST_INDEX_SLOTS (2 * CSP_IFLIST_INDEX_MAX)
+
+typedef struct {
+	uint16_t addr;
+	uint16_t mask;  /* Subnet mask worked out from the netmask */
+	csp_iface_t * ifc;
+} csp_iflist_entry_t;
+
+typedef struct {
+	atomic_uint seq;  /* Odd while the index is being rebuilt */
+	bool overflow;  /* More interfaces than the index holds */
+	uint8_t count;
+	uint8_t subnet_count;
+	uint8_t default_count;
+	csp_iflist_entry_t subnets[CSP_IFLIST_INDEX_MAX];  /* Interfaces with a netmask, in list order */
+	csp_iface_t * defaults[CSP_IFLIST_INDEX_MAX];      /* Default interfaces, in list order */
+	csp_iface_t * by_addr[IFLIST_INDEX_SLOTS];         /* Hashed on address, first in list order wins */
+} csp_iflist_index_t;
+
+static csp_iflist_index_t iflist_index[2];
+static csp_iflist_index_t * _Atomic iflist_current = &iflist_index[0];
+static atomic_flag iflist_reindexing = ATOMIC_FLAG_INIT;
+
+static inline unsigned int csp_iflist_slot(uint16_t addr) {
+	return (addr * 40503U) % IFLIST_INDEX_SLOTS;
+}
+
+static void csp_iflist_reindex(void) {
+
+	while (atomic_flag_test_and_set_explicit(&iflist_reindexing, memory_order_acquire)) {
+	}
+
+	/* Readers still holding the copy not in use see its sequence change and search the list */
+	csp_iflist_index_t * index = (atomic_load(&iflist_current) == &iflist_index[0]) ? &iflist_index[1] : &iflist_index[0];
+	atomic_fetch_add_explicit(&index->seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	index->overflow = false;
+	index->count = 0;
+	index->subnet_count = 0;
+	index->default_count = 0;
+	memset(index->by_addr, 0, sizeof(index->by_addr));
+
+	for (csp_iface_t * ifc = interfaces; ifc != NULL; ifc = ifc->next) {
+		if (index->count == CSP_IFLIST_INDEX_MAX) {
+			index->overflow = true;
+			break;
+		}
+		index->count++;
+
+		/* Reject searches involving subnets, if the netmask is invalid */
+		if (ifc->netmask != 0) {
+			index->subnets[index->subnet_count++] = (csp_iflist_entry_t){
+				.addr = ifc->addr,
+				.mask = ((1 << ifc->netmask) - 1) << (csp_id_get_host_bits() - ifc->netmask),
+				.ifc = ifc,
+			};
+		}
+
+		if (ifc->is_default == 1) {
+			index->defaults[index->default_count++] = ifc;
+		}
+
+		unsigned int slot = csp_iflist_slot(ifc->addr);
+		while ((index->by_addr[slot] != NULL) && (index->by_addr[slot]->addr != ifc->addr)) {
+			slot = (slot + 1) % IFLIST_INDEX_SLOTS;
+		}
+		if (index->by_addr[slot] == NULL) {
+			index->by_addr[slot] = ifc;
+		}
+	}
+
+	atomic_fetch_add_explicit(&index->seq, 1, memory_order_release);
+	atomic_store(&iflist_current, index);
+	atomic_flag_clear_explicit(&iflist_reindexing, memory_order_release);
+	csp_egress_invalidate();
+}
+
+/**
+ * Start a lookup in the index.
+ * @return the index, NULL to search the list instead
+ */
+static csp_iflist_index_t * csp_iflist_index_begin(unsigned int * seq) {
+
+	csp_iflist_index_t * index = atomic_load(&iflist_current);
+	*seq = atomic_load_explicit(&index->seq, memory_order_acquire);
+	if ((*seq & 1) || index->overflow) {
+		return NULL;
+	}
+
+	return index;
+}
+
+/* End a lookup in the index, false if it was rebuilt meanwhile and the list must be searched */
+static bool csp_iflist_index_end(csp_iflist_index_t * index, unsigned int seq) {
+
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&index->seq, memory_order_relaxed) == seq;
+}
+
+void csp_iflist_update(void) {
+	csp_iflist_reindex();
+}
+
 int csp_iflist_is_within_subnet(uint16_t addr, csp_iface_t * ifc) {
 
 	if (ifc == NULL) {
@@ -32,6 +147,33 @@ int csp_iflist_is_within_subnet(uint16_t addr, csp_iface_t * ifc) {
 
 csp_iface_t * csp_iflist_get_by_subnet(uint16_t addr, csp_iface_t * ifc) {
 
+	unsigned int seq;
+	csp_iflist_index_t * index = csp_iflist_index_begin(&seq);
+	if (index != NULL) {
+		csp_iface_t * found = NULL;
+		unsigned int i = 0;
+
+		/* Continue after user defined ifc, a subnet interface found by the previous call */
+		if (ifc != NULL) {
+			while ((i < index->subnet_count) && (index->subnets[i].ifc != ifc)) {
+				i++;
+			}
+			i++;
+		}
+
+		for (; i < index->subnet_count; i++) {
+			const csp_iflist_entry_t * entry = &index->subnets[i];
+			if (((entry->addr ^ addr) & entry->mask) == 0) {
+				found = entry->ifc;
+				break;
+			}
+		}
+
+		if (csp_iflist_index_end(index, seq)) {
+			return found;
+		}
+	}
+
 	/* Head of list */
 	if (ifc == NULL) {
 		ifc = interfaces;
@@ -62,6 +204,25 @@ csp_iface_t * csp_iflist_get_by_subnet(uint16_t addr, csp_iface_t * ifc) {
 
 csp_iface_t * csp_iflist_get_by_isdfl(csp_iface_t * ifc) {
 
+	unsigned int seq;
+	csp_iflist_index_t * index = csp_iflist_index_begin(&seq);
+	if (index != NULL) {
+		unsigned int i = 0;
+
+		/* Continue after user defined ifc, a default interface found by the previous call */
+		if (ifc != NULL) {
+			while ((i < index->default_count) && (index->defaults[i] != ifc)) {
+				i++;
+			}
+			i++;
+		}
+
+		csp_iface_t * found = (i < index->default_count) ? index->defaults[i] : NULL;
+		if (csp_iflist_index_end(index, seq)) {
+			return found;
+		}
+	}
+
 	/* Head of list */
 	if (ifc == NULL) {
 		ifc = interfaces;
@@ -116,10 +277,28 @@ void csp_iflist_check_dfl(void) {
 		}
 		iface->is_default = 1;
 	}
+
+	csp_iflist_reindex();
 }
 
 csp_iface_t * csp_iflist_get_by_addr(uint16_t addr) {
 
+	unsigned int seq;
+	csp_iflist_index_t * index = csp_iflist_index_begin(&seq);
+	if (index != NULL) {
+		unsigned int slot = csp_iflist_slot(addr);
+		csp_iface_t * ifc;
+		while ((ifc = index->by_addr[slot]) != NULL) {
+			if (ifc->addr == addr) {
+				break;
+			}
+			slot = (slot + 1) % IFLIST_INDEX_SLOTS;
+		}
+		if (csp_iflist_index_end(index, seq)) {
+			return ifc;
+		}
+	}
+
 	csp_iface_t * ifc = interfaces;
 	while (ifc) {
 		if (ifc->addr == addr) {
@@ -176,6 +355,7 @@ void csp_iflist_add(csp_iface_t * ifc) {
 		last->next = ifc;
 	}
 
+	csp_iflist_reindex();
 }
 
 void csp_iflist_remove(csp_iface_t * ifc) {
@@ -197,6 +377,8 @@ void csp_iflist_remove(csp_iface_t * ifc) {
 			}
 		}
 	}
+
+	csp_iflist_reindex();
 }
 
 csp_iface_t * csp_iflist_get(void) {
@@ -7,7 +7,10 @@
 #include "csp_conn.h"
 #include "csp_qfifo.h"
 #include "csp_port.h"
-#include "csp_rdp_queue.h"
+#include "csp_dedup.h"
+#if (CSP_USE_RTABLE)
+#include "csp_rtable_cidr.h"
+#endif
 
 __weak void csp_panic(const char * msg) {
 	(void)msg; /* Avoid compiler warnings about unused parameter */
@@ -37,8 +40,9 @@ void csp_init(void) {
 	csp_buffer_init();
 	csp_conn_init();
 	csp_qfifo_init();
-#if (CSP_USE_RDP)
-	csp_rdp_queue_init();
+	csp_dedup_init();
+#if (CSP_USE_RTABLE)
+	csp_rtable_init();
 #endif
 
 	/* Loopback */
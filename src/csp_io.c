@@ -1,5 +1,6 @@
 #include "csp_io.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -21,6 +22,10 @@
 #include "csp_promisc.h"
 #include "csp_qfifo.h"
 #include "csp_rdp.h"
+#include "csp_route.h"
+#if (CSP_USE_RTABLE)
+#include "csp_rtable_cidr.h"
+#endif
 
 csp_conn_t * csp_accept(csp_socket_t * sock, uint32_t timeout) {
 
@@ -58,7 +63,7 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
 
 #if (CSP_USE_RDP)
 	/* Packet read could trigger ACK transmission */
-	if ((conn->idin.flags & CSP_FRDP) && conn->rdp.delayed_acks) {
+	if (conn->idin.flags & CSP_FRDP) {
 		csp_rdp_check_ack(conn);
 	}
 #endif
@@ -85,135 +90,330 @@ void csp_id_clear(csp_id_t * target) {
 	target->flags = 0;
 }
 
-void csp_send_direct(csp_id_t* idout, csp_packet_t * packet, csp_iface_t * routed_from) {
-
-	int from_me = (routed_from == NULL ? 1 : 0);
-
-	/* Try to find the destination on any local subnets */
-	int via = CSP_NO_VIA_ADDRESS;
-	csp_iface_t * iface = NULL;
-	csp_packet_t * copy = NULL;
-	int local_found = 0;
-
-	/* Quickly send on loopback */
-	if(idout->dst == csp_if_lo.addr){
-		csp_send_direct_iface(idout, packet, &csp_if_lo, via, from_me);
-		return;
+/* Egress selected by csp_send_direct(), held back until the next one is known */
+typedef struct {
+	csp_iface_t * iface;
+	uint16_t via;
+	csp_id_t idout;
+} csp_egress_t;
+
+/**
+ * Queue an egress for the packet.
+ * The previously queued egress is sent a copy, the last one queued is handed the original buffer,
+ * so a single egress never causes a copy. Interfaces modify the packet they send, so every
+ * other egress needs a copy of its own.
+ */
+static void csp_send_direct_queue(csp_egress_t * egress, const csp_id_t * idout, csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me) {
+
+	if (egress->iface != NULL) {
+		csp_packet_t * copy = csp_buffer_clone(packet);
+		if (copy != NULL) {
+			csp_send_direct_iface(&egress->idout, copy, egress->iface, egress->via, from_me);
+		} else {
+			egress->iface->tx_error++;
+		}
 	}
 
-	/* Make copy as broadcast modifies destination making iflist_get_by_subnet the skip next redundant ifaces */
-	csp_id_t _idout = *idout;
+	egress->iface = iface;
+	egress->via = via;
+	egress->idout = *idout;
+}
 
-	while ((iface = csp_iflist_get_by_subnet(idout->dst, iface)) != NULL) {
+/* One way out for packets to a destination, from csp_egress_resolve() */
+typedef struct {
+	csp_iface_t * iface;
+	uint16_t via;
+	uint8_t weight;  /* Share of the flows for a multipath route, 0 if every packet goes this way */
+	uint8_t flags;
+} csp_egress_hop_t;
+
+#define CSP_EGRESS_LOCAL     0x01  /* Destination on the subnet of the interface */
+#define CSP_EGRESS_BROADCAST 0x02  /* Routed broadcast (L3), rewritten to local (L2) */
+
+/* A packet being sent on the hops of its destination */
+typedef struct {
+	csp_egress_t egress;
+	csp_id_t * idout;
+	csp_packet_t * packet;
+	int from_me;
+	uint32_t pick;  /* Multipath weight left before the hop picked for the flow */
+} csp_egress_out_t;
+
+/* Pick one multipath route for the flow, in proportion to the weights. The upper bits of the
+ * hash are used, as the lower ones select the router worker. */
+static inline void csp_egress_pick(csp_egress_out_t * out, uint32_t weight_total) {
+	out->pick = (weight_total > 0) ? (csp_route_flow_hash(out->idout) >> 16) % weight_total : 0;
+}
 
-		local_found = 1;
+/* Queue the packet on a hop, unless it is a multipath hop not picked for its flow */
+static void csp_egress_send_hop(csp_egress_out_t * out, const csp_egress_hop_t * hop) {
 
-		/* Do not send back to same interface (split horizon)
-		 * This check is is similar to that below, but faster */
-		if (iface == routed_from) {
-			continue;
+	if (hop->weight > 0) {
+		if (out->pick >= hop->weight) {
+			out->pick -= hop->weight;
+			return;
 		}
 
-		/* Do not send to interface with similar subnet (split horizon) */
-		if (csp_iflist_is_within_subnet(iface->addr, routed_from)) {
-			continue;
-		}
+		/* Picked, pass over the remaining multipath hops */
+		out->pick = UINT32_MAX;
+	}
+
+	if (hop->flags & CSP_EGRESS_LOCAL) {
+		csp_id_t _idout = *out->idout;
 
 		/* Apply outgoing interface address to packet */
-		if ((from_me) && (idout->src == 0)) {
-			_idout.src = iface->addr;
+		if ((out->from_me) && (out->idout->src == 0)) {
+			_idout.src = hop->iface->addr;
 		}
 
 		/* Rewrite routed broadcast (L3) to local (L2) when arriving at the interface */
-		if (csp_id_is_broadcast(idout->dst, iface)) {
+		if (hop->flags & CSP_EGRESS_BROADCAST) {
 			_idout.dst = csp_id_get_max_nodeid();
 		}
 
-		/* Todo: Find an elegant way to avoid making a copy when only a single destination interface
-		 * is found. But without looping the list twice. And without using stack memory.
-		 * Is this even possible? */
-		copy = csp_buffer_clone(packet);
-		if (copy != NULL) {
-			csp_send_direct_iface(&_idout, copy, iface, via, from_me);
+		csp_send_direct_queue(&out->egress, &_idout, out->packet, hop->iface, hop->via, out->from_me);
+		return;
+	}
+
+	/* Apply outgoing interface address to packet */
+	if ((out->from_me) && (out->idout->src == 0)) {
+		out->idout->src = hop->iface->addr;
+	}
+
+	csp_send_direct_queue(&out->egress, out->idout, out->packet, hop->iface, hop->via, out->from_me);
+}
+
+/* Queue the packet on the hops of a resolved or cached destination */
+static void csp_egress_send(csp_egress_out_t * out, const csp_egress_hop_t * hops, unsigned int count) {
+
+	uint32_t weight_total = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		weight_total += hops[i].weight;
+	}
+	csp_egress_pick(out, weight_total);
+
+	for (unsigned int i = 0; i < count; i++) {
+		csp_egress_send_hop(out, &hops[i]);
+	}
+}
+
+/* Do not send a packet back to the interface or subnet it came from (split horizon) */
+static inline bool csp_egress_is_back(csp_iface_t * iface, csp_iface_t * routed_from) {
+
+	/* Same interface, similar to the subnet check but faster */
+	if (iface == routed_from) {
+		return true;
+	}
+
+	return csp_iflist_is_within_subnet(iface->addr, routed_from);
+}
+
+/* Add a hop, or once there are more than max_hops, send the packet on it and on those before */
+static inline void csp_egress_add(csp_egress_hop_t * hops, unsigned int max_hops, unsigned int * count, csp_egress_hop_t hop, csp_egress_out_t * out) {
+
+	if (*count < max_hops) {
+		hops[*count] = hop;
+	} else if (out != NULL) {
+		if (*count == max_hops) {
+			for (unsigned int i = 0; i < max_hops; i++) {
+				csp_egress_send_hop(out, &hops[i]);
+			}
 		}
+		csp_egress_send_hop(out, &hop);
+	}
+	(*count)++;
+}
+
+/**
+ * Find the ways out for packets to dst: local subnets, else the routing table, else the default
+ * interfaces. Fills in up to max_hops hops. If there are more, the packet of out is sent on all
+ * of them meanwhile, so it is resolved only once.
+ * @return number of hops, more than max_hops if they did not all fit
+ */
+static unsigned int csp_egress_resolve(uint16_t dst, csp_iface_t * routed_from, csp_egress_hop_t * hops, unsigned int max_hops, csp_egress_out_t * out) {
 
+	unsigned int count = 0;
+	csp_iface_t * iface = NULL;
+	int local_found = 0;
+
+	/* Try to find the destination on any local subnets */
+	while ((iface = csp_iflist_get_by_subnet(dst, iface)) != NULL) {
+
+		local_found = 1;
+
+		if (csp_egress_is_back(iface, routed_from)) {
+			continue;
+		}
+
+		uint8_t flags = CSP_EGRESS_LOCAL;
+		if (csp_id_is_broadcast(dst, iface)) {
+			flags |= CSP_EGRESS_BROADCAST;
+		}
+		csp_egress_add(hops, max_hops, &count, (csp_egress_hop_t){.iface = iface, .via = CSP_NO_VIA_ADDRESS, .flags = flags}, out);
 	}
 
 	/* If the above worked, we don't want to look at the routing table */
 	if (local_found == 1) {
-		csp_buffer_free(packet);
-		return;
+		return count;
 	}
 
 #if CSP_USE_RTABLE
-	/* Try to send via routing table */
-	int route_found = 0;
-	csp_route_t * route = csp_rtable_find_route(idout->dst);
-	if (route != NULL) {
-		do {
-			route_found = 1;
-
-			/* Do not send back to same interface (split horizon)
-			* This check is is similar to that below, but faster */
-			if (route->iface == routed_from) {
-				continue;
+	/* Try to send via routing table, redundant routes first, then the multipath routes to pick from */
+	const csp_rtable_version_t * rtable = csp_rtable_read_begin();
+	csp_route_t * route = csp_rtable_lookup(rtable, dst);
+	if ((out != NULL) && (route != NULL)) {
+		/* Hops may be sent before all are found, so pick from the multipath routes first */
+		uint32_t weight_total = 0;
+		for (csp_route_t * r = route; r != NULL; r = csp_rtable_search_backward(r)) {
+			if (!(r->flags & CSP_ROUTE_REDUNDANT) && !csp_egress_is_back(r->iface, routed_from)) {
+				weight_total += r->weight;
 			}
-
-			/* Do not send to interface with similar subnet (split horizon) */
-			if (csp_iflist_is_within_subnet(route->iface->addr, routed_from)) {
+		}
+		csp_egress_pick(out, weight_total);
+	}
+	for (int redundant = 1; redundant >= 0; redundant--) {
+		for (csp_route_t * r = route; r != NULL; r = csp_rtable_search_backward(r)) {
+			if (((r->flags & CSP_ROUTE_REDUNDANT) != 0) != redundant) {
 				continue;
 			}
-
-			/* Apply outgoing interface address to packet */
-			if ((from_me) && (idout->src == 0)) {
-				idout->src = route->iface->addr;
-			}
-
-			copy = csp_buffer_clone(packet);
-			if (copy != NULL) {
-				csp_send_direct_iface(idout, copy, route->iface, route->via, from_me);
+			if (csp_egress_is_back(r->iface, routed_from)) {
+				continue;
 			}
-		} while ((route = csp_rtable_search_backward(route)) != NULL);
+			csp_egress_add(hops, max_hops, &count, (csp_egress_hop_t){.iface = r->iface, .via = r->via, .weight = redundant ? 0 : r->weight}, out);
+		}
 	}
+	csp_rtable_read_end(rtable);
 
 	/* If the above worked, we don't want to look at default interfaces */
-	if (route_found == 1) {
-		csp_buffer_free(packet);
-		return;
+	if (route != NULL) {
+		return count;
 	}
-
 #endif
 
 	/* Try to send via default interfaces */
 	while ((iface = csp_iflist_get_by_isdfl(iface)) != NULL) {
 
-		/* Do not send back to same interface (split horizon)
-		 * This check is is similar to that below, but faster */
-		if (iface == routed_from) {
+		if (csp_egress_is_back(iface, routed_from)) {
 			continue;
 		}
 
-		/* Do not send to interface with similar subnet (split horizon) */
-		if (csp_iflist_is_within_subnet(iface->addr, routed_from)) {
-			continue;
-		}
+		csp_egress_add(hops, max_hops, &count, (csp_egress_hop_t){.iface = iface, .via = CSP_NO_VIA_ADDRESS}, out);
+	}
 
-		/* Apply outgoing interface address to packet */
-		if ((from_me) && (idout->src == 0)) {
-			idout->src = iface->addr;
-		}
+	return count;
+}
 
-		/* Todo: Find an elegant way to avoid making a copy when only a single destination interface
-		 * is found. But without looping the list twice. And without using stack memory.
-		 * Is this even possible? */
-		copy = csp_buffer_clone(packet);
-		if (copy != NULL) {
-			csp_send_direct_iface(idout, copy, iface, via, from_me);
+/**
+ * Destinations resolved recently, by destination and incoming interface (split horizon). Entries
+ * belong to a generation, and changes to routes or interfaces start a new one. Each entry has a
+ * sequence count, odd while it is written, so senders on other threads never use half an entry.
+ */
+#ifndef CSP_EGRESS_CACHE_SIZE
+#define CSP_EGRESS_CACHE_SIZE 32  //! Cached destinations, 0 to disable
+#endif
+#ifndef CSP_EGRESS_CACHE_HOPS
+#define CSP_EGRESS_CACHE_HOPS 4   //! Hops per cached destination, destinations with more are not cached
+#endif
+
+static atomic_uint egress_generation;
+
+void csp_egress_invalidate(void) {
+	atomic_fetch_add(&egress_generation, 1);
+}
+
+#if (CSP_EGRESS_CACHE_SIZE > 0)
+
+typedef struct {
+	atomic_uint seq;
+	unsigned int generation;
+	uint16_t dst;
+	uint8_t count;
+	csp_iface_t * routed_from;
+	csp_egress_hop_t hops[CSP_EGRESS_CACHE_HOPS];
+} csp_egress_cache_t;
+
+static csp_egress_cache_t egress_cache[CSP_EGRESS_CACHE_SIZE];
+
+static inline csp_egress_cache_t * csp_egress_cache_entry(uint16_t dst, csp_iface_t * routed_from) {
+	uint32_t hash = (dst ^ (uint32_t)((uintptr_t)routed_from >> 4)) * 2654435761U;
+	return &egress_cache[(hash >> 16) % CSP_EGRESS_CACHE_SIZE];
+}
+
+/* Copy the hops of a cached destination, returns false if not cached */
+static bool csp_egress_cache_get(uint16_t dst, csp_iface_t * routed_from, unsigned int generation, csp_egress_hop_t * hops, unsigned int * count) {
+
+	csp_egress_cache_t * entry = csp_egress_cache_entry(dst, routed_from);
+
+	unsigned int seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+	if ((seq & 1) || (entry->generation != generation) || (entry->dst != dst) || (entry->routed_from != routed_from)) {
+		return false;
+	}
+	*count = entry->count;
+	memcpy(hops, entry->hops, entry->count * sizeof(hops[0]));
+	atomic_thread_fence(memory_order_acquire);
+
+	return atomic_load_explicit(&entry->seq, memory_order_relaxed) == seq;
+}
+
+static void csp_egress_cache_put(uint16_t dst, csp_iface_t * routed_from, unsigned int generation, const csp_egress_hop_t * hops, unsigned int count) {
+
+	csp_egress_cache_t * entry = csp_egress_cache_entry(dst, routed_from);
+
+	/* Leave the entry to another sender writing it */
+	unsigned int seq = atomic_load_explicit(&entry->seq, memory_order_relaxed);
+	if ((seq & 1) || !atomic_compare_exchange_strong(&entry->seq, &seq, seq + 1)) {
+		return;
+	}
+	atomic_thread_fence(memory_order_release);
+
+	entry->generation = generation;
+	entry->dst = dst;
+	entry->routed_from = routed_from;
+	entry->count = count;
+	memcpy(entry->hops, hops, count * sizeof(hops[0]));
+
+	atomic_store_explicit(&entry->seq, seq + 2, memory_order_release);
+}
+
+#endif
+
+void csp_send_direct(csp_id_t* idout, csp_packet_t * packet, csp_iface_t * routed_from) {
+
+	int from_me = (routed_from == NULL ? 1 : 0);
+	csp_egress_out_t out = {.egress = {.iface = NULL}, .idout = idout, .packet = packet, .from_me = from_me};
+
+	/* Quickly send on loopback */
+	if(idout->dst == csp_if_lo.addr){
+		csp_send_direct_iface(idout, packet, &csp_if_lo, CSP_NO_VIA_ADDRESS, from_me);
+		return;
+	}
+
+	/* Steady traffic to a destination takes one lookup in the cache. Destinations with more hops
+	 * than it holds have the packet sent while they are resolved. */
+	csp_egress_hop_t hops[CSP_EGRESS_CACHE_HOPS];
+	unsigned int count;
+#if (CSP_EGRESS_CACHE_SIZE > 0)
+	unsigned int generation = atomic_load(&egress_generation);
+	if (!csp_egress_cache_get(idout->dst, routed_from, generation, hops, &count)) {
+		count = csp_egress_resolve(idout->dst, routed_from, hops, CSP_EGRESS_CACHE_HOPS, &out);
+		if (count <= CSP_EGRESS_CACHE_HOPS) {
+			csp_egress_cache_put(idout->dst, routed_from, generation, hops, count);
 		}
+	}
+#else
+	count = csp_egress_resolve(idout->dst, routed_from, hops, CSP_EGRESS_CACHE_HOPS, &out);
+#endif
 
+	if (count <= CSP_EGRESS_CACHE_HOPS) {
+		csp_egress_send(&out, hops, count);
 	}
 
-	csp_buffer_free(packet);
+	/* The last egress takes over the original packet */
+	if (out.egress.iface != NULL) {
+		csp_send_direct_iface(&out.egress.idout, packet, out.egress.iface, out.egress.via, from_me);
+	} else {
+		csp_buffer_free(packet);
+	}
 
 }
 
@@ -228,6 +428,9 @@ void csp_send_direct_iface(const csp_id_t* idout, csp_packet_t * packet, csp_ifa
 
 	csp_output_hook(idout, packet, iface, via, from_me);
 
+	/* The data may change from here on, so the CRC32 computed on reception no longer holds */
+	packet->rx_crc_valid = 0;
+
 	/* Copy identifier to packet (before crc and hmac) */
 	if(idout != &packet->id) {
 		csp_id_copy(&packet->id, idout);
@@ -296,20 +499,42 @@ void csp_send(csp_conn_t * conn, csp_packet_t * packet) {
 	}
 
 #if (CSP_USE_RDP)
+	/* The router sends RDP segments */
 	if (conn->idout.flags & CSP_FRDP) {
 		if (csp_rdp_send(conn, packet) != CSP_ERR_NONE) {
 			csp_buffer_free(packet);
-			return;
 		}
+		return;
 	}
 #endif
 
-	csp_send_direct(&conn->idout, packet, NULL);
+	csp_id_t idout = csp_conn_idout(conn);
+	csp_send_direct(&idout, packet, NULL);
 
 }
 
+int csp_send_nonblock(csp_conn_t * conn, csp_packet_t * packet) {
+
+	if ((conn == NULL) || (packet == NULL) || (conn->state != CONN_OPEN)) {
+		return CSP_ERR_INVAL;
+	}
+
+#if (CSP_USE_RDP)
+	if (conn->idout.flags & CSP_FRDP) {
+		return csp_rdp_send_nonblock(conn, packet);
+	}
+#endif
+
+	csp_id_t idout = csp_conn_idout(conn);
+	csp_send_direct(&idout, packet, NULL);
+
+	return CSP_ERR_NONE;
+}
+
 void csp_send_prio(uint8_t prio, csp_conn_t * conn, csp_packet_t * packet) {
-	conn->idout.pri = prio;
+	if (conn != NULL) {
+		atomic_store(&conn->pri, prio);
+	}
 	csp_send(conn, packet);
 }
 
@@ -11,3 +11,9 @@
  */
 void csp_send_direct(csp_id_t* idout, csp_packet_t * packet, csp_iface_t * routed_from);
 void csp_send_direct_iface(const csp_id_t* idout, csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me);
+
+/**
+ * Forget the destinations resolved by csp_send_direct().
+ * Called whenever routes or interfaces change.
+ */
+void csp_egress_invalidate(void);
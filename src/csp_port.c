@@ -4,6 +4,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 
 #include <csp/csp.h>
 #include <csp/csp_debug.h>
@@ -18,8 +19,10 @@ typedef enum {
 	PORT_OPEN_CB = 2,
 } csp_port_state_t;
 
+/* The state is written last on bind and read first on lookup, so router workers never see an
+ * open port without its socket or callback */
 typedef struct {
-	csp_port_state_t state;
+	atomic_int state;
 	union {
 		csp_socket_t * socket;
 		csp_callback_t callback;
@@ -35,13 +38,15 @@ csp_callback_t csp_port_get_callback(unsigned int port) {
 		return NULL;
 	}
 
+	int state = atomic_load(&ports[port].state);
+
 	/* Check if port is open callback */
-	if (ports[port].state == PORT_OPEN_CB) {
+	if (state == PORT_OPEN_CB) {
 		return ports[port].callback;
 	}
 
 	/* If it's open socket, then return no callback */
-	if (ports[port].state == PORT_OPEN) {
+	if (state == PORT_OPEN) {
 		return NULL;
 	}
 
@@ -59,11 +64,13 @@ csp_socket_t * csp_port_get_socket(unsigned int port) {
 		return NULL;
 	}
 
-	if (ports[port].state == PORT_OPEN) {
+	int state = atomic_load(&ports[port].state);
+
+	if (state == PORT_OPEN) {
 		return ports[port].socket;
 	}
 
-	if (ports[port].state == PORT_OPEN_CB) {
+	if (state == PORT_OPEN_CB) {
 		return NULL;
 	}
 
@@ -74,9 +81,38 @@ csp_socket_t * csp_port_get_socket(unsigned int port) {
 	return NULL;
 }
 
+/* Drop what was queued to the socket and not yet read */
+static void csp_socket_flush(csp_socket_t * sock) {
+
+	void * item = NULL;
+
+	while (csp_queue_dequeue(sock->rx_queue, &item, 0) == CSP_QUEUE_OK) {
+		if (item == NULL) {
+			continue;
+		}
+		if (sock->opts & CSP_SO_CONN_LESS) {
+			csp_buffer_free(item);
+		} else {
+			/* A new connection not accepted yet */
+			csp_close(item);
+		}
+	}
+}
+
 int csp_listen(csp_socket_t * socket, size_t backlog) {
+#if (CSP_CONN_DYNAMIC)
+	/* The queue is allocated on POSIX, so it can hold as many new connections as asked for.
+	 * Listening again replaces the queue. */
+	if (socket->rx_queue != NULL) {
+		csp_socket_flush(socket);
+		csp_queue_delete(socket->rx_queue);
+	}
+	int length = (backlog > 0) ? (int)backlog : CSP_CONN_RXQUEUE_LEN;
+	socket->rx_queue = csp_queue_create_static(length, sizeof(csp_conn_t *), NULL, NULL);
+#else
 	(void)backlog; /* Avoid compiler warnings about unused parameter */
 	socket->rx_queue = csp_queue_create_static(CSP_CONN_RXQUEUE_LEN, sizeof(csp_packet_t *), socket->rx_queue_static_data, &socket->rx_queue_static);
+#endif
 	return CSP_ERR_NONE;
 }
 
@@ -146,15 +182,12 @@ int csp_socket_close(csp_socket_t * sock) {
 		}
 	}
 
-	if (sock->rx_queue != NULL) {
-		csp_packet_t * packet = NULL;
+	csp_conn_detach_socket(sock);
 
-		while (csp_queue_dequeue(sock->rx_queue, &packet, 0) == CSP_QUEUE_OK) {
-			if (packet != NULL) {
-				csp_buffer_free(packet);
-			}
-		}
-		csp_queue_free(sock->rx_queue);
+	/* A router worker may have looked the socket up before the port closed, and still queue to
+	 * it, so the queue is left allocated. Listening again replaces it. */
+	if (sock->rx_queue != NULL) {
+		csp_socket_flush(sock);
 	}
 
 	return CSP_ERR_NONE;
@@ -50,7 +50,8 @@ void csp_promisc_add(csp_packet_t * packet) {
 		return;
 
 	if (csp_promisc_queue != NULL) {
-		/* Make a copy of the message and queue it to the promiscuous task */
+		/* Make a copy of the message and queue it to the promiscuous task,
+		 * the receiver of the original may write to it */
 		csp_packet_t * packet_copy = csp_buffer_clone(packet);
 		if (packet_copy != NULL) {
 			if (csp_queue_enqueue(csp_promisc_queue, &packet_copy, 0) != CSP_QUEUE_OK) {
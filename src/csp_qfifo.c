@@ -1,25 +1,168 @@
 #include "csp_qfifo.h"
 
+#include <stdatomic.h>
+
 #include <csp/arch/csp_queue.h>
 #include <csp/csp_debug.h>
 #include <csp/csp_buffer.h>
 #include "csp_macro.h"
+#include "csp_route.h"
 #include "csp/autoconfig.h"
 
-static csp_static_queue_t qfifo_queue __noinit;
-static csp_queue_handle_t qfifo_queue_handle __noinit;
-static char qfifo_queue_buffer[sizeof(csp_qfifo_t) * CSP_QFIFO_LEN] __noinit;
+#define CSP_QFIFO_PRIOS (CSP_PRIO_LOW + 1)
+
+#if (CSP_USE_QOS)
+#define CSP_QFIFO_LEVELS CSP_QFIFO_PRIOS  //! One queue per csp_prio_t
+#else
+#define CSP_QFIFO_LEVELS 1
+#endif
+
+/* One router input queue per router worker, each with one level per priority when QoS is enabled */
+typedef struct {
+	csp_static_queue_t queue[CSP_QFIFO_LEVELS];
+	csp_queue_handle_t queue_handle[CSP_QFIFO_LEVELS];
+	char queue_buffer[CSP_QFIFO_LEVELS][sizeof(csp_qfifo_t) * CSP_QFIFO_LEN];
+#if (CSP_USE_QOS)
+	/* One event per queued element, so the router can sleep on all levels at once */
+	csp_static_queue_t events;
+	csp_queue_handle_t events_handle;
+	char events_buffer[sizeof(uint8_t) * CSP_QFIFO_LEVELS * CSP_QFIFO_LEN];
+	uint8_t credits[CSP_QFIFO_LEVELS];
+#endif
+} csp_qfifo_shard_t;
+
+static csp_qfifo_shard_t qfifo_shard[CSP_ROUTE_WORKERS] __noinit;
+static unsigned int qfifo_shards = 1;
+
+/* Counted by every task and ISR writing to the router */
+static atomic_uint qfifo_drops[CSP_QFIFO_PRIOS];
+
+#if (CSP_USE_QOS)
+static csp_qfifo_policy_t qfifo_policy = CSP_QFIFO_STRICT;
+static uint8_t qfifo_weights[CSP_QFIFO_LEVELS] = {8, 4, 2, 1};
+#endif
+
+static inline int csp_qfifo_prio(const csp_packet_t * packet) {
+	return (packet->id.pri < CSP_QFIFO_PRIOS) ? packet->id.pri : CSP_QFIFO_PRIOS - 1;
+}
+
+static inline int csp_qfifo_level(const csp_packet_t * packet) {
+#if (CSP_USE_QOS)
+	return csp_qfifo_prio(packet);
+#else
+	(void)packet;
+	return 0;
+#endif
+}
+
+/* Packets of one flow always go to the same worker, which keeps them in order */
+static inline csp_qfifo_shard_t * csp_qfifo_shard(const csp_packet_t * packet) {
+#if (CSP_ROUTE_WORKERS > 1)
+	return &qfifo_shard[csp_route_flow_hash(&packet->id) % qfifo_shards];
+#else
+	(void)packet;
+	return &qfifo_shard[0];
+#endif
+}
 
 void csp_qfifo_init(void) {
-	qfifo_queue_handle = csp_queue_create_static(CSP_QFIFO_LEN, sizeof(csp_qfifo_t), qfifo_queue_buffer, &qfifo_queue);
+	for (int i = 0; i < CSP_ROUTE_WORKERS; i++) {
+		csp_qfifo_shard_t * shard = &qfifo_shard[i];
+		for (int level = 0; level < CSP_QFIFO_LEVELS; level++) {
+			shard->queue_handle[level] = csp_queue_create_static(CSP_QFIFO_LEN, sizeof(csp_qfifo_t), shard->queue_buffer[level], &shard->queue[level]);
+		}
+#if (CSP_USE_QOS)
+		shard->events_handle = csp_queue_create_static(CSP_QFIFO_LEVELS * CSP_QFIFO_LEN, sizeof(uint8_t), shard->events_buffer, &shard->events);
+		for (int level = 0; level < CSP_QFIFO_LEVELS; level++) {
+			shard->credits[level] = qfifo_weights[level];
+		}
+#endif
+	}
+	qfifo_shards = 1;
+}
+
+void csp_qfifo_set_shards(unsigned int count) {
+	if ((count >= 1) && (count <= CSP_ROUTE_WORKERS)) {
+		qfifo_shards = count;
+	}
+}
+
+#if (CSP_USE_QOS)
+/* Take the next element according to the dequeue policy, after an event has been consumed */
+static int csp_qfifo_take(csp_qfifo_shard_t * shard, csp_qfifo_t * input) {
+
+	if (qfifo_policy == CSP_QFIFO_WEIGHTED) {
+		/* Levels with credit left first, then refill credits and serve anything that is queued */
+		for (int level = 0; level < CSP_QFIFO_LEVELS; level++) {
+			if ((shard->credits[level] > 0) && (csp_queue_dequeue(shard->queue_handle[level], input, 0) == CSP_QUEUE_OK)) {
+				shard->credits[level]--;
+				return CSP_ERR_NONE;
+			}
+		}
+		for (int level = 0; level < CSP_QFIFO_LEVELS; level++) {
+			shard->credits[level] = qfifo_weights[level];
+		}
+	}
+
+	for (int level = 0; level < CSP_QFIFO_LEVELS; level++) {
+		if (csp_queue_dequeue(shard->queue_handle[level], input, 0) == CSP_QUEUE_OK) {
+			if ((qfifo_policy == CSP_QFIFO_WEIGHTED) && (shard->credits[level] > 0)) {
+				shard->credits[level]--;
+			}
+			return CSP_ERR_NONE;
+		}
+	}
+
+	/* Every event is posted after its element, so this should not happen */
+	return CSP_ERR_TIMEDOUT;
 }
+#endif
 
 int csp_qfifo_read(csp_qfifo_t * input) {
 
-	if (csp_queue_dequeue(qfifo_queue_handle, input, FIFO_TIMEOUT) != CSP_QUEUE_OK)
+	csp_qfifo_shard_t * shard = &qfifo_shard[0];
+
+#if (CSP_USE_QOS)
+	uint8_t event;
+	if (csp_queue_dequeue(shard->events_handle, &event, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK)
+		return CSP_ERR_TIMEDOUT;
+
+	return csp_qfifo_take(shard, input);
+#else
+	if (csp_queue_dequeue(shard->queue_handle[0], input, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK)
 		return CSP_ERR_TIMEDOUT;
 
 	return CSP_ERR_NONE;
+#endif
+}
+
+int csp_qfifo_read_batch(unsigned int index, csp_qfifo_t * input, int count, uint32_t timeout) {
+
+	if (index >= CSP_ROUTE_WORKERS) {
+		return 0;
+	}
+
+	csp_qfifo_shard_t * shard = &qfifo_shard[index];
+
+#if (CSP_USE_QOS)
+	uint8_t events[CSP_QFIFO_LEVELS * CSP_QFIFO_LEN];
+	if (count > (int)sizeof(events)) {
+		count = sizeof(events);
+	}
+
+	int n = csp_queue_dequeue_many(shard->events_handle, events, count, timeout);
+
+	int found = 0;
+	for (int i = 0; i < n; i++) {
+		if (csp_qfifo_take(shard, &input[found]) == CSP_ERR_NONE) {
+			found++;
+		}
+	}
+
+	return found;
+#else
+	return csp_queue_dequeue_many(shard->queue_handle[0], input, count, timeout);
+#endif
 }
 
 void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * iface, void * pxTaskWoken) {
@@ -44,22 +187,86 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * iface, void * pxTaskWo
 	queue_element.iface = iface;
 	queue_element.packet = packet;
 
+	csp_qfifo_shard_t * shard = csp_qfifo_shard(packet);
+	int level = csp_qfifo_level(packet);
+
 	if (pxTaskWoken == NULL)
-		result = csp_queue_enqueue(qfifo_queue_handle, &queue_element, 1);
+		result = csp_queue_enqueue(shard->queue_handle[level], &queue_element, 1);
 	else
-		result = csp_queue_enqueue_isr(qfifo_queue_handle, &queue_element, pxTaskWoken);
+		result = csp_queue_enqueue_isr(shard->queue_handle[level], &queue_element, pxTaskWoken);
 
 	if (result != CSP_QUEUE_OK) {
 		csp_dbg_conn_ovf++;
 		iface->tx_error++;
+		atomic_fetch_add_explicit(&qfifo_drops[csp_qfifo_prio(packet)], 1, memory_order_relaxed);
 		if (pxTaskWoken == NULL)
 			csp_buffer_free(packet);
 		else
 			csp_buffer_free_isr(packet);
+		return;
 	}
+
+#if (CSP_USE_QOS)
+	/* The events queue holds as many elements as all levels together, so it cannot be full */
+	const uint8_t event = level;
+	if (pxTaskWoken == NULL)
+		csp_queue_enqueue(shard->events_handle, &event, 0);
+	else
+		csp_queue_enqueue_isr(shard->events_handle, &event, pxTaskWoken);
+#endif
 }
 
-void csp_qfifo_wake_up(void) {
+void csp_qfifo_wake_up_shard(unsigned int index) {
 	const csp_qfifo_t queue_element = {.iface = NULL, .packet = NULL};
-	csp_queue_enqueue(qfifo_queue_handle, &queue_element, 0);
+	csp_qfifo_shard_t * shard = &qfifo_shard[index];
+	if (csp_queue_enqueue(shard->queue_handle[0], &queue_element, 0) != CSP_QUEUE_OK) {
+		return;
+	}
+#if (CSP_USE_QOS)
+	const uint8_t event = 0;
+	csp_queue_enqueue(shard->events_handle, &event, 0);
+#endif
+}
+
+void csp_qfifo_wake_up(void) {
+	for (unsigned int i = 0; i < qfifo_shards; i++) {
+		csp_qfifo_wake_up_shard(i);
+	}
+}
+
+void csp_qfifo_set_policy(csp_qfifo_policy_t policy, const uint8_t weights[CSP_PRIO_LOW + 1]) {
+#if (CSP_USE_QOS)
+	if (weights != NULL) {
+		for (int level = 0; level < CSP_QFIFO_LEVELS; level++) {
+			/* A level without weight would only be served when all others are empty */
+			qfifo_weights[level] = (weights[level] > 0) ? weights[level] : 1;
+			for (int i = 0; i < CSP_ROUTE_WORKERS; i++) {
+				qfifo_shard[i].credits[level] = qfifo_weights[level];
+			}
+		}
+	}
+	qfifo_policy = policy;
+#else
+	(void)policy;
+	(void)weights;
+#endif
+}
+
+int csp_qfifo_get_stats(csp_prio_t prio, csp_qfifo_stats_t * stats) {
+
+	if (((unsigned int)prio >= CSP_QFIFO_PRIOS) || (stats == NULL)) {
+		return CSP_ERR_INVAL;
+	}
+
+	stats->depth = 0;
+	for (int i = 0; i < CSP_ROUTE_WORKERS; i++) {
+#if (CSP_USE_QOS)
+		stats->depth += csp_queue_size(qfifo_shard[i].queue_handle[prio]);
+#else
+		stats->depth += csp_queue_size(qfifo_shard[i].queue_handle[0]);
+#endif
+	}
+	stats->drops = atomic_load_explicit(&qfifo_drops[prio], memory_order_relaxed);
+
+	return CSP_ERR_NONE;
 }
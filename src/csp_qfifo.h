@@ -3,12 +3,6 @@
 #include <csp/csp.h>
 #include <csp/csp_interface.h>
 
-#if (CSP_USE_RDP)
-#define FIFO_TIMEOUT 100  //! If RDP is enabled, the router needs to awake some times to check timeouts
-#else
-#define FIFO_TIMEOUT CSP_MAX_TIMEOUT  //! If no RDP, the router can sleep until data arrives
-#endif
-
 /**
  * Init FIFO/QOS queues
  * @return CSP_ERR type
@@ -27,8 +21,31 @@ typedef struct {
  */
 int csp_qfifo_read(csp_qfifo_t * input);
 
+/**
+ * Read a burst of packets from one shard of the router input queue.
+ * Waits for the first packet, then takes whatever else is queued, up to count.
+ * @param shard router worker index, 0 when there is a single router task
+ * @param input array of at least count router queue item elements
+ * @param count max number of elements to read
+ * @param timeout max time in ms to wait for the first packet, the router passes its next connection timeout
+ * @return number of elements read, 0 on timeout
+ */
+int csp_qfifo_read_batch(unsigned int shard, csp_qfifo_t * input, int count, uint32_t timeout);
+
+/**
+ * Spread incoming packets over count shards by flow, one per router worker.
+ * @param count number of shards, 1 to CSP_ROUTE_WORKERS
+ */
+void csp_qfifo_set_shards(unsigned int count);
+
 /**
  * Wake up any task (e.g. router) waiting on messages.
  * For testing.
  */
 void csp_qfifo_wake_up(void);
+
+/**
+ * Wake up the router worker reading one shard.
+ * @param shard shard index
+ */
+void csp_qfifo_wake_up_shard(unsigned int shard);
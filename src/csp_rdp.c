@@ -18,10 +18,12 @@
 #include "csp_macro.h"
 #include <csp/arch/csp_queue.h>
 #include <csp/arch/csp_time.h>
+#include <csp/crypto/csp_hmac.h>
 
 #include "csp_port.h"
 #include "csp_conn.h"
 #include "csp_io.h"
+#include "csp_qfifo.h"
 #include "csp_semaphore.h"
 
 #define RDP_SYN 0x08
@@ -33,6 +35,15 @@
 #define CSP_USE_RDP_FAST_CLOSE 1
 #endif
 
+#define RDP_RETRY_DELAY 100  //! ms before retrying a timeout that could not be handled, e.g. for lack of buffers
+#define RDP_RTO_MIN 10  //! ms, least margin of the retransmission timeout over the smoothed round trip time
+#define RDP_DUP_ACKS 3  //! EACKs received without progress before the missing segments are retransmitted
+
+/* Requests posted by user tasks to the router, see csp_rdp_process_requests() */
+#define RDP_REQ_CONNECT 0x01  //! Send SYN
+#define RDP_REQ_ABORT   0x02  //! Connect failed, close without RST
+#define RDP_REQ_ACK     0x04  //! An ACK held back for lack of RX queue room may be sent
+#define RDP_REQ_CLOSE   0x08  //! Userspace closed the connection
 
 
 static uint32_t csp_rdp_window_size = 4;
@@ -48,7 +59,14 @@ typedef struct __packed {
 	uint16_t ack_nr;
 } rdp_header_t;
 
+/* Connections with requests for the router, newest first, linked by rdp.list_next */
+static _Atomic(csp_conn_t *) csp_rdp_listed = NULL;
+
+/* The router is going to sleep, so listing a connection must wake it, see csp_rdp_router_idle() */
+static atomic_bool csp_rdp_router_waiting = true;
+
 static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool send_rst);
+static void csp_rdp_tx_flush(csp_conn_t * conn);
 
 /**
  * RDP Headers:
@@ -57,7 +75,7 @@ static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool sen
  */
 static rdp_header_t * csp_rdp_header_add(csp_packet_t * packet) {
 	rdp_header_t * header;
-	if ((packet->length + sizeof(*header)) > sizeof(packet->data)) {
+	if ((packet->length + sizeof(*header)) > csp_buffer_data_size(packet)) {
 		return NULL;
 	}
 	header = (rdp_header_t *)&packet->data[packet->length];
@@ -109,6 +127,128 @@ static inline int csp_rdp_time_after(uint32_t time, uint32_t cmp) {
 	return csp_rdp_time_before(cmp, time);
 }
 
+/* Each connection holds at most CSP_RDP_MAX_WINDOW segments in flight, see csp_rdp_t */
+static inline uint32_t csp_rdp_window_limit(uint32_t window_size) {
+	return (window_size < CSP_RDP_MAX_WINDOW) ? window_size : CSP_RDP_MAX_WINDOW;
+}
+
+/**
+ * ROUND TRIP AND CONGESTION CONTROL
+ * The retransmission timeout follows the measured round trip time (Jacobson/Karels), and the
+ * number of segments in flight is limited by a congestion window that grows by one segment per
+ * window acknowledged and is halved when segments time out (AIMD).
+ */
+/* User tasks reserve credit for the segments they post against the published congestion window */
+static inline void csp_rdp_cc_publish(csp_conn_t * conn) {
+	atomic_store(&conn->rdp.tx_window, conn->rdp.cwnd);
+}
+
+static void csp_rdp_cc_init(csp_conn_t * conn) {
+	conn->rdp.rto = conn->rdp.packet_timeout;
+	conn->rdp.srtt = 0;
+	conn->rdp.rttvar = 0;
+	conn->rdp.rtt_active = false;
+	conn->rdp.cwnd = conn->rdp.window_size;
+	conn->rdp.cwnd_acked = 0;
+	conn->rdp.retransmits = 0;
+	conn->rdp.fast_retransmits = 0;
+	conn->rdp.snd_sack = conn->rdp.snd_una;
+	conn->rdp.dup_acks = 0;
+	conn->rdp.fast_recovery = false;
+	atomic_store(&conn->rdp.tx_credit, 0);
+	csp_rdp_cc_publish(conn);
+}
+
+/* Time the segment just sent, unless one is being timed already */
+static void csp_rdp_rtt_start(csp_conn_t * conn, uint16_t seq_nr, uint32_t timestamp) {
+	if (!conn->rdp.rtt_active) {
+		conn->rdp.rtt_active = true;
+		conn->rdp.rtt_seq = seq_nr;
+		conn->rdp.rtt_timestamp = timestamp;
+	}
+}
+
+/* RTO = SRTT + 4 * RTTVAR, no longer than a connection timeout */
+static void csp_rdp_rto_update(csp_conn_t * conn) {
+
+	if (conn->rdp.srtt == 0) {
+		/* Not measured yet */
+		conn->rdp.rto = conn->rdp.packet_timeout;
+		return;
+	}
+
+	/* Allow for the receiver holding back an ACK for the ACK timeout, which most samples do not show */
+	uint32_t margin = RDP_RTO_MIN + (conn->rdp.delayed_acks ? conn->rdp.ack_timeout : 0);
+	if (margin < conn->rdp.rttvar) {
+		margin = conn->rdp.rttvar;
+	}
+
+	uint32_t rto = (conn->rdp.srtt >> 3) + margin;
+	if (rto > conn->rdp.conn_timeout) {
+		rto = conn->rdp.conn_timeout;
+	}
+	conn->rdp.rto = rto;
+}
+
+static void csp_rdp_rtt_sample(csp_conn_t * conn, uint32_t rtt) {
+
+	/* Round up to the clock resolution, an SRTT of 0 means not measured */
+	if (rtt == 0) {
+		rtt = 1;
+	}
+
+	if (conn->rdp.srtt == 0) {
+		/* First measurement */
+		conn->rdp.srtt = rtt << 3;
+		conn->rdp.rttvar = rtt << 1;
+	} else {
+		int32_t err = (int32_t)rtt - (int32_t)(conn->rdp.srtt >> 3);
+		conn->rdp.srtt += err;
+		if (err < 0) {
+			err = -err;
+		}
+		conn->rdp.rttvar += err - (int32_t)(conn->rdp.rttvar >> 2);
+	}
+
+	csp_rdp_rto_update(conn);
+}
+
+/* Segments lost: halve the congestion window */
+static void csp_rdp_cc_loss(csp_conn_t * conn) {
+	conn->rdp.cwnd = (conn->rdp.cwnd > 1) ? conn->rdp.cwnd / 2 : 1;
+	conn->rdp.cwnd_acked = 0;
+	csp_rdp_cc_publish(conn);
+}
+
+/* Segments timed out: back off the retransmission timeout and halve the congestion window */
+static void csp_rdp_cc_timeout(csp_conn_t * conn) {
+
+	/* Karn: an ACK of a retransmitted segment is ambiguous, and must not be measured */
+	conn->rdp.rtt_active = false;
+
+	conn->rdp.rto *= 2;
+	if (conn->rdp.rto > conn->rdp.conn_timeout) {
+		conn->rdp.rto = conn->rdp.conn_timeout;
+	}
+
+	/* Everything unacknowledged is being resent, so start over counting EACKs */
+	conn->rdp.fast_recovery = false;
+	conn->rdp.dup_acks = 0;
+
+	csp_rdp_cc_loss(conn);
+}
+
+/* One segment acknowledged: grow the congestion window by one segment per window */
+static void csp_rdp_cc_acked(csp_conn_t * conn) {
+	if (++conn->rdp.cwnd_acked >= conn->rdp.cwnd) {
+		conn->rdp.cwnd_acked = 0;
+		if (conn->rdp.cwnd < conn->rdp.window_size) {
+			conn->rdp.cwnd++;
+			csp_rdp_cc_publish(conn);
+		}
+	}
+}
+
 /**
  * CONTROL MESSAGES
  * The following function is used to send empty messages,
@@ -118,7 +258,8 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 
 	/* Generate message */
 	if (!packet) {
-		packet = csp_buffer_get(0);
+		/* Leave room for the RDP header and the CRC32 and HMAC trailers */
+		packet = csp_buffer_get_sized(sizeof(rdp_header_t) + sizeof(uint32_t) + CSP_HMAC_LENGTH);
 		if (!packet)
 			return CSP_ERR_NOMEM;
 		packet->length = 0;
@@ -152,12 +293,14 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 		csp_packet_t * rdp_packet = csp_buffer_clone(packet);
 		if (rdp_packet == NULL) return CSP_ERR_NOMEM;
 		rdp_packet->timestamp_tx = csp_get_ms();
-		csp_rdp_queue_tx_add(conn, rdp_packet);
+		csp_rdp_queue_tx_add(conn, seq_nr, rdp_packet);
+		csp_rdp_rtt_start(conn, seq_nr, rdp_packet->timestamp_tx);
+		csp_conn_timer_arm(conn, rdp_packet->timestamp_tx + conn->rdp.rto + 1);
 	}
 
 	/* Send control messages with high priority */
-	csp_id_t idout = conn->idout;
-	idout.pri = conn->idout.pri < CSP_PRIO_HIGH ? conn->idout.pri : CSP_PRIO_HIGH;
+	csp_id_t idout = csp_conn_idout(conn);
+	idout.pri = idout.pri < CSP_PRIO_HIGH ? idout.pri : CSP_PRIO_HIGH;
 
 	csp_rdp_protocol("RDP %p: Send CMP S %u: syn %u, ack %u, eack %u, rst %u, seq_nr %5u, ack_nr %5u, packet_len %u (%u)\n",
 					 (void *)conn, conn->rdp.state,
@@ -212,13 +355,8 @@ static inline int csp_rdp_receive_data(csp_conn_t * conn, csp_packet_t * packet)
 
 static inline void csp_rdp_rx_queue_flush(csp_conn_t * conn) {
 
-	/* Loop through RX queue */
-	int i, count;
-	csp_packet_t * packet;
-
-front:
-	count = csp_rdp_queue_rx_size();
-	for (i = 0; i < count; i++) {
+	/* Deliver the segments held for reordering that are now in sequence */
+	while (1) {
 
 		/* Check there is room in the RX queue:
 		 * We don't hold a lock on the queue, so we require at least two spaces to be free
@@ -226,67 +364,53 @@ front:
 		if (csp_queue_free(conn->rx_queue) <= 2)
 			return;
 
-		packet = csp_rdp_queue_rx_get(conn);
-		if (packet == NULL) {
-			break;
-		}
-
-		rdp_header_t * header = csp_rdp_header_ref(packet);
-
-		/* If the matching packet was found: */
-		if (header->seq_nr == (uint16_t)(conn->rdp.rcv_cur + 1)) {
-			csp_rdp_protocol("RDP %p: Deliver seq %u\n", (void *)conn, header->seq_nr);
-			if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE) {
-				csp_rdp_error("RDP lost packet internally, stream corrupted!\n");
-				csp_buffer_free(packet);
-			}
-			conn->rdp.rcv_cur++;
-
-			/* Loop from first element again */
-			goto front;
-
-			/* Otherwise, requeue */
-		} else {
-			csp_rdp_queue_rx_add(conn, packet);
-		}
-	}
-}
-
-static inline bool csp_rdp_seq_in_rx_queue(csp_conn_t * conn, uint16_t seq_nr) {
-
-	/* Loop through RX queue */
-	int i, count;
-	csp_packet_t * packet;
-	count = csp_rdp_queue_rx_size();
-	for (i = 0; i < count; i++) {
-
-		packet = csp_rdp_queue_rx_get(conn);
+		csp_packet_t * packet = csp_rdp_queue_rx_get(conn, conn->rdp.rcv_cur + 1);
 		if (packet == NULL) {
-			break;
+			return;
 		}
 
-		csp_rdp_queue_rx_add(conn, packet);
-
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *)packet);
-		if (header->seq_nr == seq_nr) {
-			return true;
+		csp_rdp_protocol("RDP %p: Deliver seq %u\n", (void *)conn, (uint16_t)(conn->rdp.rcv_cur + 1));
+		if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE) {
+			csp_rdp_error("RDP lost packet internally, stream corrupted!\n");
+			csp_buffer_free(packet);
 		}
+		conn->rdp.rcv_cur++;
 	}
-
-	return false;
 }
 
 static inline int csp_rdp_rx_queue_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr) {
 
-	if (csp_rdp_seq_in_rx_queue(conn, seq_nr)) {
+	if (csp_rdp_queue_rx_add(conn, seq_nr, packet) != CSP_ERR_NONE) {
 		csp_rdp_protocol("RDP %p: Already exists in RX queue %u\n", (void *)conn, seq_nr);
 		return CSP_ERR_USED;
 	}
 	csp_rdp_protocol("RDP %p: Add to RX queue %u\n", (void *) conn, seq_nr);
-	csp_rdp_queue_rx_add(conn, packet);
 	return CSP_ERR_NONE;
 }
 
+/* A segment was received, measure the round trip if it was being timed */
+static void csp_rdp_tx_received(csp_conn_t * conn, uint16_t seq_nr) {
+	if (conn->rdp.rtt_active && (conn->rdp.rtt_seq == seq_nr)) {
+		conn->rdp.rtt_active = false;
+		csp_rdp_rtt_sample(conn, csp_get_ms() - conn->rdp.rtt_timestamp);
+	}
+}
+
+/* Store the oldest unacknowledged sequence number, and release the segments acknowledged before it.
+ * ACKs older than the current one are ignored, and no ACK reaches past what was sent. */
+static void csp_rdp_set_una(csp_conn_t * conn, uint16_t una) {
+	while (csp_rdp_seq_before(conn->rdp.snd_una, una) && csp_rdp_seq_before(conn->rdp.snd_una, conn->rdp.snd_nxt)) {
+		/* Data segments hold credit of the task that posted them, the SYN does not */
+		csp_packet_t * segment = csp_rdp_queue_tx_get(conn, conn->rdp.snd_una);
+		if ((segment != NULL) && !(csp_rdp_header_ref(segment)->flags & RDP_SYN)) {
+			atomic_fetch_sub(&conn->rdp.tx_credit, 1);
+		}
+		csp_rdp_tx_received(conn, conn->rdp.snd_una);
+		csp_rdp_queue_tx_remove(conn, conn->rdp.snd_una);
+		csp_rdp_cc_acked(conn);
+		conn->rdp.snd_una++;
+	}
+}
 
 static inline bool csp_rdp_should_ack(csp_conn_t * conn) {
 
@@ -307,39 +431,248 @@ static inline bool csp_rdp_should_ack(csp_conn_t * conn) {
 	return false;
 }
 
-int csp_rdp_check_ack(csp_conn_t * conn) {
+/* Segments are only acknowledged while the RX queue has room for a full window, as flow control */
+static inline bool csp_rdp_rx_has_room(csp_conn_t * conn) {
+	return (CSP_CONN_RXQUEUE_LEN - csp_queue_size(conn->rx_queue) > 2 * (int32_t)conn->rdp.window_size);
+}
 
-	/* Check RX queue for spare capacity */
-	if (CSP_CONN_RXQUEUE_LEN - csp_queue_size(conn->rx_queue) <= 2 * (int32_t)conn->rdp.window_size) {
+/**
+ * EACK Packet
+ * Acknowledges the segments received in sequence and lists the sequence numbers of those held
+ * out of sequence, so the sender only retransmits the missing ones. Sent right away when a segment
+ * arrives out of sequence or more than once, which tells the sender a segment was lost or an ACK was.
+ */
+static int csp_rdp_send_eack(csp_conn_t * conn) {
+
+	/* Room for the list, the RDP header and the CRC32 and HMAC trailers */
+	csp_packet_t * packet = csp_buffer_get_sized((CSP_RDP_MAX_WINDOW * 2 * sizeof(uint16_t)) + sizeof(rdp_header_t) + sizeof(uint32_t) + CSP_HMAC_LENGTH);
+	if (packet == NULL) {
+		return CSP_ERR_NOMEM;
+	}
+
+	unsigned int count = 0;
+	for (uint32_t i = 2; i <= conn->rdp.window_size * 2; i++) {
+		uint16_t seq_nr = conn->rdp.rcv_cur + i;
+		if (csp_rdp_queue_rx_peek(conn, seq_nr) != NULL) {
+			packet->data16[count++] = htobe16(seq_nr);
+		}
+	}
+	packet->length = count * sizeof(uint16_t);
+
+	/* Repeat the last ACK instead while the RX queue is full */
+	uint16_t ack_nr = conn->rdp.rcv_cur;
+	if (!csp_rdp_rx_has_room(conn)) {
+		ack_nr = conn->rdp.rcv_lsa;
+		atomic_store(&conn->rdp.ack_withheld, true);
+	}
+
+	return csp_rdp_send_cmp(conn, packet, (count > 0) ? (RDP_ACK | RDP_EAK) : RDP_ACK, conn->rdp.snd_nxt, ack_nr);
+}
+
+static int csp_rdp_ack_if_due(csp_conn_t * conn) {
+
+	/* Check RX queue for spare capacity, the task reading it asks for the ACK once there is */
+	if (!csp_rdp_rx_has_room(conn)) {
+		atomic_store(&conn->rdp.ack_withheld, true);
 		return CSP_ERR_NONE;
 	}
 
 	/* If more space available, only send after ack timeout or immediately if delay_acks is zero */
 	if (csp_rdp_should_ack(conn)) {
 		csp_rdp_send_cmp(conn, NULL, RDP_ACK, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
+	} else if (conn->rdp.rcv_lsa != conn->rdp.rcv_cur) {
+		/* Send the delayed ACK from csp_rdp_check_timeouts */
+		csp_conn_timer_arm(conn, conn->rdp.ack_timestamp + conn->rdp.ack_timeout + 1);
 	}
 
 	return CSP_ERR_NONE;
 }
 
 static inline bool csp_rdp_is_conn_ready_for_tx(csp_conn_t * conn) {
-	// Check Tx window (messages waiting for acks)
-	if (csp_rdp_seq_after(conn->rdp.snd_nxt, conn->rdp.snd_una + conn->rdp.window_size - 1)) {
+	// Check Tx window (messages waiting for acks), the congestion window is never larger
+	if (csp_rdp_seq_after(conn->rdp.snd_nxt, conn->rdp.snd_una + conn->rdp.cwnd - 1)) {
+		return false;
+	}
+	return true;
+}
+
+/* User tasks may post another segment */
+static inline bool csp_rdp_tx_has_credit(csp_conn_t * conn) {
+	return atomic_load(&conn->rdp.tx_credit) < conn->rdp.cwnd;
+}
+
+/**
+ * EVENTS
+ * Tasks sending with csp_send_nonblock() are told through the connection's event callback
+ * when the window opens, instead of waiting on tx_wait.
+ */
+static void csp_rdp_notify(csp_conn_t * conn, unsigned int events) {
+	csp_rdp_event_callback_t callback = atomic_load(&conn->rdp.event_callback);
+	if ((events != 0) && (callback != NULL)) {
+		callback(conn, events, conn->rdp.event_arg);
+	}
+}
+
+/* No more sending: wake a task blocked in csp_rdp_send(), and tell a non-blocking one */
+static void csp_rdp_tx_closed(csp_conn_t * conn) {
+	csp_bin_sem_post(&conn->rdp.tx_wait);
+	atomic_store(&conn->rdp.tx_blocked, false);
+	csp_rdp_notify(conn, CSP_RDP_EVENT_CLOSED);
+}
+
+/* The window has room: wake a task blocked in csp_rdp_send(), and return the event for a non-blocking one */
+static unsigned int csp_rdp_tx_ready(csp_conn_t * conn) {
+	csp_bin_sem_post(&conn->rdp.tx_wait);
+	return atomic_exchange(&conn->rdp.tx_blocked, false) ? CSP_RDP_EVENT_WRITABLE : 0;
+}
+
+/* Send a copy of an unacknowledged segment, carrying the latest ACK */
+static bool csp_rdp_retransmit(csp_conn_t * conn, csp_packet_t * packet) {
+
+	csp_packet_t * new_packet = csp_buffer_get(0);
+	if (new_packet == NULL) {
+		csp_rdp_error("RDP %p: Failed to allocate packet buffer\n", (void *)conn);
 		return false;
 	}
+
+	rdp_header_t * header = csp_rdp_header_ref(packet);
+
+	/* Karn: an ACK of a retransmitted segment is ambiguous, and must not be measured */
+	if (conn->rdp.rtt_active && (conn->rdp.rtt_seq == be16toh(header->seq_nr))) {
+		conn->rdp.rtt_active = false;
+	}
+
+	/* Update to latest outgoing ACK */
+	header->ack_nr = htobe16(conn->rdp.rcv_cur);
+
+	/* Every outgoing message contains the last valid ACK number. So we always set last ack timestamp */
+	conn->rdp.ack_timestamp = csp_get_ms();
+	/* Send copy to tx_queue, at the priority the segment was posted with */
+	packet->timestamp_tx = csp_get_ms();
+	csp_buffer_copy(packet, new_packet);
+	csp_id_t idout = conn->idout;
+	idout.pri = packet->id.pri;
+	csp_send_direct(&idout, new_packet, NULL);
+	conn->rdp.retransmits++;
+
 	return true;
 }
 
 /**
- * This function must be called with regular intervals for the
- * RDP protocol to work as expected. This takes care of closing
- * stale connections and retransmitting traffic. A good place to
- * call this function is from the CSP router task.
+ * FAST RETRANSMIT
+ * Segments still unacknowledged before the highest one reported by EACK are missing. Once
+ * RDP_DUP_ACKS EACKs arrive without progress, or fewer if fewer segments follow the oldest one,
+ * they are retransmitted right away instead of at their timeout, each once per recovery, and the
+ * congestion window is halved once. Segments reported by EACK are not retransmitted, except the
+ * oldest at its timeout, see csp_rdp_check_timeouts().
+ */
+static void csp_rdp_fast_retransmit(csp_conn_t * conn) {
+
+	/* Without a report of later segments, only the oldest is known to be missing */
+	uint16_t end = conn->rdp.snd_sack;
+	if (!csp_rdp_seq_between(end, conn->rdp.snd_una + 1, conn->rdp.snd_nxt)) {
+		end = conn->rdp.snd_una + 1;
+	}
+
+	uint16_t seq = conn->rdp.fast_high;
+	if (csp_rdp_seq_before(seq, conn->rdp.snd_una)) {
+		seq = conn->rdp.snd_una;
+	}
+
+	for (; csp_rdp_seq_before(seq, end); seq++) {
+		csp_packet_t * packet = csp_rdp_queue_tx_get(conn, seq);
+		if ((packet == NULL) || csp_rdp_queue_tx_sacked(conn, seq)) {
+			continue;
+		}
+		csp_rdp_protocol("RDP %p: Fast retransmit of seq %u\n", (void *)conn, seq);
+		if (!csp_rdp_retransmit(conn, packet)) {
+			/* Left to the retransmission timeout */
+			break;
+		}
+		conn->rdp.fast_retransmits++;
+	}
+
+	conn->rdp.fast_high = seq;
+}
+
+/* Mark the segments listed in an EACK, and retransmit the missing ones if enough EACKs were received */
+static void csp_rdp_eack_received(csp_conn_t * conn, csp_packet_t * packet) {
+
+	/* Everything was acknowledged since */
+	if (conn->rdp.snd_una == conn->rdp.snd_nxt) {
+		return;
+	}
+
+	const uint16_t * list = (const uint16_t *)packet->data;
+	unsigned int count = (packet->length - sizeof(rdp_header_t)) / sizeof(uint16_t);
+
+	for (unsigned int i = 0; i < count; i++) {
+		uint16_t seq_nr = be16toh(list[i]);
+		if (!csp_rdp_seq_between(seq_nr, conn->rdp.snd_una, conn->rdp.snd_nxt - 1)) {
+			continue;
+		}
+		csp_rdp_tx_received(conn, seq_nr);
+		csp_rdp_queue_tx_sack(conn, seq_nr);
+		if (!csp_rdp_seq_between(conn->rdp.snd_sack, conn->rdp.snd_una + 1, conn->rdp.snd_nxt) ||
+			csp_rdp_seq_after(seq_nr + 1, conn->rdp.snd_sack)) {
+			conn->rdp.snd_sack = seq_nr + 1;
+		}
+	}
+
+	if (conn->rdp.fast_recovery) {
+		csp_rdp_fast_retransmit(conn);
+		return;
+	}
+
+	/* Small windows do not hold enough segments to return RDP_DUP_ACKS EACKs */
+	uint16_t outstanding = conn->rdp.snd_nxt - conn->rdp.snd_una;
+	uint16_t threshold = (outstanding > RDP_DUP_ACKS) ? RDP_DUP_ACKS : ((outstanding > 1) ? outstanding - 1 : 1);
+	if (++conn->rdp.dup_acks < threshold) {
+		return;
+	}
+
+	csp_rdp_protocol("RDP %p: %u EACKs, fast recovery until seq %u\n", (void *)conn, conn->rdp.dup_acks, conn->rdp.snd_nxt);
+	conn->rdp.fast_recovery = true;
+	conn->rdp.fast_recover = conn->rdp.snd_nxt;
+	conn->rdp.fast_high = conn->rdp.snd_una;
+	csp_rdp_cc_loss(conn);
+	csp_rdp_fast_retransmit(conn);
+}
+
+/* The oldest unacknowledged segment was acknowledged */
+static void csp_rdp_una_advanced(csp_conn_t * conn) {
+
+	/* The path delivers again: drop the timeout backoff, without waiting for a round trip
+	 * sample, which on a lossy link may take many timeouts */
+	csp_rdp_rto_update(conn);
+
+	conn->rdp.dup_acks = 0;
+
+	if (conn->rdp.fast_recovery) {
+		if (!csp_rdp_seq_before(conn->rdp.snd_una, conn->rdp.fast_recover)) {
+			conn->rdp.fast_recovery = false;
+		} else {
+			/* Partial ACK, the next missing segment may follow */
+			csp_rdp_fast_retransmit(conn);
+		}
+	}
+}
+
+/**
+ * This function is called by csp_conn_check_timeouts() from the router
+ * task, when the connection deadline armed with csp_conn_timer_arm()
+ * has passed. This takes care of closing stale connections and
+ * retransmitting traffic, and arms the connection for whatever is due next.
+ * The timeouts expire once the time is after timestamp plus timeout,
+ * hence the + 1 on deadlines.
  */
 void csp_rdp_check_timeouts(csp_conn_t * conn) {
 
 	const uint32_t time_now = csp_get_ms();
 
+	/* Check an idle connection at least once per connection timeout */
+	uint32_t deadline = time_now + conn->rdp.conn_timeout;
+
 	/**
 	 * CONNECTION TIMEOUT:
 	 * Check that connection has not timed out inside the network stack
@@ -364,72 +697,76 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 		}
 	}
 
+	if ((conn->dest_socket != NULL) || (conn->rdp.state == RDP_CLOSE_WAIT)) {
+		deadline = conn->timestamp + conn->rdp.conn_timeout + 1;
+	}
+
 	/**
 	 * MESSAGE TIMEOUT:
-	 * Check each outgoing message for TX timeout
+	 * Check each unacknowledged outgoing message for TX timeout
 	 */
-	int count = csp_rdp_queue_tx_size();
-	for (int i = 0; i < count; i++) {
+	bool timed_out = false;
+	bool waiting = false;
+	uint32_t oldest_tx = time_now;
+	for (uint16_t seq = conn->rdp.snd_una; csp_rdp_seq_before(seq, conn->rdp.snd_nxt); seq++) {
 
-		csp_packet_t * packet;
-		packet = csp_rdp_queue_tx_get(conn);
+		csp_packet_t * packet = csp_rdp_queue_tx_get(conn, seq);
 		if (packet == NULL) {
-			break;
+			continue;
 		}
 
-		/* Get header */
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *)packet);
-
-		/* If acked, do not retransmit */
-		if (csp_rdp_seq_before(be16toh(header->seq_nr), conn->rdp.snd_una)) {
-			csp_rdp_protocol("RDP %p: TX Element Free, time %" PRIu32 ", seq %u, una %u\n",
-							 (void *)conn, packet->timestamp_tx, be16toh(header->seq_nr), conn->rdp.snd_una);
-			csp_buffer_free(packet);
+		/* Segments reported by EACK need no retransmission, but the oldest is resent at its
+		 * timeout anyway, for the receiver to repeat an ACK that may have been lost */
+		if ((seq != conn->rdp.snd_una) && csp_rdp_queue_tx_sacked(conn, seq)) {
 			continue;
 		}
 
 		/* Check timestamp and retransmit if needed */
-		if (csp_rdp_time_after(time_now, packet->timestamp_tx + conn->rdp.packet_timeout)) {
-			csp_packet_t * new_packet = csp_buffer_get(0);
-			if (new_packet) {
-				csp_rdp_protocol("RDP %p: TX Element timed out, retransmitting seq %u\n",
-								 (void *)conn, be16toh(header->seq_nr));
-
-				/* Update to latest outgoing ACK */
-				header->ack_nr = htobe16(conn->rdp.rcv_cur);
+		if (csp_rdp_time_after(time_now, packet->timestamp_tx + conn->rdp.rto)) {
+			timed_out = true;
+			csp_rdp_protocol("RDP %p: TX Element timed out, retransmitting seq %u\n", (void *)conn, seq);
+			csp_rdp_retransmit(conn, packet);
+		}
 
-				/* Every outgoing message contains the last valid ACK number. So we always set last ack timestamp */
-				conn->rdp.ack_timestamp = csp_get_ms();
-				/* Send copy to tx_queue */
-				packet->timestamp_tx = csp_get_ms();
-				csp_buffer_copy(packet, new_packet);
-				csp_send_direct(&conn->idout, new_packet, NULL);
-			} else {
-				csp_rdp_error("RDP %p: Failed to allocate packet buffer\n", (void *)conn);
-			}
+		if (!waiting || csp_rdp_time_before(packet->timestamp_tx, oldest_tx)) {
+			oldest_tx = packet->timestamp_tx;
 		}
+		waiting = true;
+	}
 
-		/* Requeue the TX element */
-		csp_rdp_queue_tx_add(conn, packet);
+	if (timed_out) {
+		csp_rdp_cc_timeout(conn);
+	}
 
+	if (waiting && csp_rdp_time_before(oldest_tx + conn->rdp.rto + 1, deadline)) {
+		deadline = oldest_tx + conn->rdp.rto + 1;
 	}
 
 	if (conn->rdp.state == RDP_OPEN) {
 
 		/* Check if we have unacknowledged segments */
 		if (conn->rdp.delayed_acks) {
-			csp_rdp_check_ack(conn);
+			csp_rdp_ack_if_due(conn);
 		}
 
+		/* Send what is posted, if sending failed for lack of buffers or the window opened */
+		csp_rdp_tx_flush(conn);
+
 		/* Wake user task if additional Tx can be done */
-		if (csp_rdp_is_conn_ready_for_tx(conn)) {
+		if (csp_rdp_tx_has_credit(conn)) {
 			//csp_rdp_protocol("RDP %p: Wake Tx task (check timeouts)\n", (void *)conn);
-			csp_bin_sem_post(&conn->rdp.tx_wait);
+			csp_rdp_notify(conn, csp_rdp_tx_ready(conn));
 		}
 	}
 
 	csp_rdp_rx_queue_flush(conn);
 
+	/* A retransmission that failed for lack of buffers is retried a little later */
+	if (!csp_rdp_time_after(deadline, time_now)) {
+		deadline = time_now + RDP_RETRY_DELAY;
+	}
+	csp_conn_timer_arm(conn, deadline);
+
 }
 
 bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
@@ -457,7 +794,7 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 		if (rx_header->flags & RDP_ACK) {
 			/* Store current ack'ed sequence number */
-			conn->rdp.snd_una = rx_header->ack_nr + 1;
+			csp_rdp_set_una(conn, rx_header->ack_nr + 1);
 		}
 
 		if (conn->rdp.state == RDP_CLOSED) {
@@ -481,6 +818,8 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			conn->rdp.state = RDP_CLOSE_WAIT;
 			conn->timestamp = csp_get_ms();
 			csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
+			csp_rdp_tx_closed(conn);
+			csp_rdp_tx_flush(conn);
 			if (CSP_USE_RDP_FAST_CLOSE) {
 				closed_by |= CSP_RDP_CLOSED_BY_TIMEOUT;
 			}
@@ -524,12 +863,13 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			conn->rdp.rcv_lsa = rx_header->seq_nr;
 
 			/* Store RDP options */
-			conn->rdp.window_size = be32toh(packet->data32[0]);
+			conn->rdp.window_size = csp_rdp_window_limit(be32toh(packet->data32[0]));
 			conn->rdp.conn_timeout = be32toh(packet->data32[1]);
 			conn->rdp.packet_timeout = be32toh(packet->data32[2]);
 			conn->rdp.delayed_acks = be32toh(packet->data32[3]);
 			conn->rdp.ack_timeout = be32toh(packet->data32[4]);
 			conn->rdp.ack_delay_count = be32toh(packet->data32[5]);
+			csp_rdp_cc_init(conn);
 			csp_rdp_protocol("RDP %p: window size %" PRIu32 ", conn timeout %" PRIu32 ", packet timeout %" PRIu32 ", delayed acks: %" PRIu32 ", ack timeout %" PRIu32 ", ack each %" PRIu32 " packet\n",
 							 (void *)conn, conn->rdp.window_size, conn->rdp.conn_timeout, conn->rdp.packet_timeout,
 							 conn->rdp.delayed_acks, conn->rdp.ack_timeout, conn->rdp.ack_delay_count);
@@ -555,7 +895,7 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				conn->rdp.rcv_cur = rx_header->seq_nr;
 				conn->rdp.rcv_irs = rx_header->seq_nr;
 				conn->rdp.rcv_lsa = rx_header->seq_nr - 1;
-				conn->rdp.snd_una = rx_header->ack_nr + 1;
+				csp_rdp_set_una(conn, rx_header->ack_nr + 1);
 				conn->rdp.ack_timestamp = csp_get_ms();
 				conn->rdp.state = RDP_OPEN;
 
@@ -617,6 +957,9 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				/* If duplicate SYN received, send another SYN/ACK */
 				if (conn->rdp.state == RDP_SYN_RCVD)
 					csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_SYN, conn->rdp.snd_iss, conn->rdp.rcv_irs);
+				/* A segment received before was retransmitted, so our ACK of it was lost */
+				else if (csp_rdp_seq_before(rx_header->seq_nr, conn->rdp.rcv_cur + 1))
+					csp_rdp_send_eack(conn);
 				goto discard_open;
 			}
 
@@ -660,11 +1003,28 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			}
 
 			/* Store current ack'ed sequence number */
-			conn->rdp.snd_una = rx_header->ack_nr + 1;
+			unsigned int events = 0;
+			uint16_t snd_una = conn->rdp.snd_una;
+			csp_rdp_set_una(conn, rx_header->ack_nr + 1);
+			if (conn->rdp.snd_una != snd_una) {
+				csp_rdp_una_advanced(conn);
+				events |= CSP_RDP_EVENT_ACKED;
+			}
 
 			/* We have an EACK */
 			if ((rx_header->flags & RDP_EAK)) {
 				csp_rdp_protocol("RDP %p: Got EACK\n", (void *)conn);
+				csp_rdp_eack_received(conn, packet);
+			}
+
+			/* Send what the ACK made room for, and wake user task if it opened the Tx window */
+			csp_rdp_tx_flush(conn);
+			if (csp_rdp_tx_has_credit(conn)) {
+				events |= csp_rdp_tx_ready(conn);
+			}
+			csp_rdp_notify(conn, events);
+
+			if ((rx_header->flags & RDP_EAK)) {
 				goto discard_open;
 			}
 
@@ -674,8 +1034,9 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 			/* If message is not in sequence, send EACK and store packet */
 			if (rx_header->seq_nr != (uint16_t)(conn->rdp.rcv_cur + 1)) {
-				if (csp_rdp_rx_queue_add(conn, packet, rx_header->seq_nr) != CSP_ERR_NONE) {
-					csp_rdp_check_ack(conn);
+				int ret = csp_rdp_rx_queue_add(conn, packet, rx_header->seq_nr);
+				csp_rdp_send_eack(conn);
+				if (ret != CSP_ERR_NONE) {
 					goto discard_open;
 				}
 				goto accepted_open;
@@ -694,7 +1055,7 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			/* Only ACK the message if there is room for a full window in the RX buffer.
 			 * Unacknowledged segments are ACKed by csp_rdp_check_timeouts when the buffer is
 			 * no longer full. */
-			csp_rdp_check_ack(conn);
+			csp_rdp_ack_if_due(conn);
 
 			/* Flush RX queue */
 			csp_rdp_rx_queue_flush(conn);
@@ -719,7 +1080,7 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			}
 
 			/* Store current ack'ed sequence number */
-			conn->rdp.snd_una = rx_header->ack_nr + 1;
+			csp_rdp_set_una(conn, rx_header->ack_nr + 1);
 
 			/* Send back a reset */
 			csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
@@ -748,11 +1109,48 @@ accepted_open:
 	return close_connection;
 }
 
-int csp_rdp_connect(csp_conn_t * conn) {
+/**
+ * REQUESTS
+ * User tasks never change the RDP state of a connection, the router does. They post what they
+ * want done and list the connection for the router, which wakes and handles the requests of
+ * all listed connections before it checks timeouts, see csp_route_work_shard(). A connection is
+ * listed once however many requests are posted before the router gets to it.
+ */
+static void csp_rdp_request(csp_conn_t * conn, unsigned int requests) {
 
-	int retry = 1;
+	if (requests != 0) {
+		atomic_fetch_or(&conn->rdp.requests, requests);
+	}
 
-	conn->rdp.window_size = csp_rdp_window_size;
+	if (atomic_exchange(&conn->rdp.listed, true)) {
+		return;
+	}
+
+	csp_conn_t * head = atomic_load(&csp_rdp_listed);
+	do {
+		conn->rdp.list_next = head;
+	} while (!atomic_compare_exchange_weak(&csp_rdp_listed, &head, conn));
+
+	if (atomic_load(&csp_rdp_router_waiting)) {
+		csp_qfifo_wake_up_shard(0);
+	}
+}
+
+/* Send SYN, on request of csp_rdp_connect() */
+static void csp_rdp_connect_start(csp_conn_t * conn) {
+
+	csp_rdp_protocol("RDP %p: Active connect, conn state %u\n", (void *)conn, conn->rdp.state);
+
+	if ((conn->rdp.state != RDP_CLOSED) && (conn->rdp.state != RDP_SYN_SENT)) {
+		csp_rdp_error("RDP %p: Connection already open\n", (void *)conn);
+		csp_bin_sem_post(&conn->rdp.tx_wait);
+		return;
+	}
+
+	/* A retry after a half-open connection was reset */
+	csp_rdp_queue_flush(conn);
+
+	conn->rdp.window_size = csp_rdp_window_limit(csp_rdp_window_size);
 	conn->rdp.conn_timeout = csp_rdp_conn_timeout;
 	conn->rdp.packet_timeout = csp_rdp_packet_timeout;
 	conn->rdp.delayed_acks = csp_rdp_delayed_acks;
@@ -760,33 +1158,92 @@ int csp_rdp_connect(csp_conn_t * conn) {
 	conn->rdp.ack_delay_count = csp_rdp_ack_delay_count;
 	conn->rdp.ack_timestamp = csp_get_ms();
 
-retry:
-	csp_rdp_protocol("RDP %p: Active connect, conn state %u\n", (void *)conn, conn->rdp.state);
-
-	if (conn->rdp.state == RDP_OPEN) {
-		csp_rdp_error("RDP %p: Connection already open\n", (void *)conn);
-		return CSP_ERR_ALREADY;
-	}
-
 	/* Randomize ISS */
 	unsigned int seed = csp_get_ms();
 	conn->rdp.snd_iss = (uint16_t)rand_r(&seed);
 	conn->rdp.snd_nxt = conn->rdp.snd_iss + 1;
 	conn->rdp.snd_una = conn->rdp.snd_iss;
+	csp_rdp_cc_init(conn);
 
 	csp_rdp_protocol("RDP %p: AC: Sending SYN\n", (void *)conn);
 
+	/* Send SYN message */
+	conn->rdp.state = RDP_SYN_SENT;
+	if (csp_rdp_send_syn(conn) != CSP_ERR_NONE) {
+		/* Wakes the connecting task */
+		csp_rdp_close_internal(conn, CSP_RDP_CLOSED_BY_PROTOCOL, false);
+	}
+}
+
+void csp_rdp_process_requests(void) {
+
+	atomic_store(&csp_rdp_router_waiting, false);
+	csp_conn_t * conn = atomic_exchange(&csp_rdp_listed, NULL);
+
+	while (conn != NULL) {
+
+		/* Unlist before taking the requests, so one posted meanwhile lists the connection again */
+		csp_conn_t * next = conn->rdp.list_next;
+		atomic_store(&conn->rdp.listed, false);
+		unsigned int requests = atomic_exchange(&conn->rdp.requests, 0);
+
+		if (requests & RDP_REQ_CONNECT) {
+			csp_rdp_connect_start(conn);
+		}
+
+		if (requests & RDP_REQ_ABORT) {
+			csp_rdp_close_internal(conn, CSP_RDP_CLOSED_BY_PROTOCOL, false);
+		}
+
+		/* Send what was posted before a close request sends the RST */
+		if (conn->rdp.state == RDP_OPEN) {
+			csp_rdp_tx_flush(conn);
+		}
+
+		if ((requests & RDP_REQ_ACK) && (conn->rdp.state == RDP_OPEN)) {
+			csp_rdp_rx_queue_flush(conn);
+			if (csp_rdp_rx_has_room(conn) && (conn->rdp.rcv_lsa != conn->rdp.rcv_cur)) {
+				csp_rdp_send_cmp(conn, NULL, RDP_ACK, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
+			}
+		}
+
+		if (requests & RDP_REQ_CLOSE) {
+			csp_conn_close(conn, CSP_RDP_CLOSED_BY_USERSPACE);
+		} else if (conn->rdp.state != RDP_OPEN) {
+			/* Frees segments posted as the connection closed */
+			csp_rdp_tx_flush(conn);
+		}
+
+		conn = next;
+	}
+}
+
+void csp_rdp_requests_init(void) {
+	atomic_store(&csp_rdp_listed, NULL);
+	atomic_store(&csp_rdp_router_waiting, true);
+}
+
+bool csp_rdp_router_idle(void) {
+
+	/* Either a task listing a connection from now on sees the flag and wakes the router,
+	 * or the router sees the connection listed before it and does not sleep */
+	atomic_store(&csp_rdp_router_waiting, true);
+	return atomic_load(&csp_rdp_listed) == NULL;
+}
+
+int csp_rdp_connect(csp_conn_t * conn) {
+
+	int retry = 1;
+
+retry:
 	/* Ensure semaphore is busy, so router task can release it */
 	csp_bin_sem_wait(&conn->rdp.tx_wait, 0);
 
-	/* Send SYN message */
-	conn->rdp.state = RDP_SYN_SENT;
-	if (csp_rdp_send_syn(conn) != CSP_ERR_NONE)
-		goto error;
+	csp_rdp_request(conn, RDP_REQ_CONNECT);
 
 	/* Wait for router task to release semaphore */
 	csp_rdp_protocol("RDP %p: AC: Waiting for SYN/ACK reply...\n", (void *)conn);
-	int result = csp_bin_sem_wait(&conn->rdp.tx_wait, conn->rdp.conn_timeout);
+	int result = csp_bin_sem_wait(&conn->rdp.tx_wait, csp_rdp_conn_timeout);
 
 	if (result == CSP_SEMAPHORE_OK) {
 		if (conn->rdp.state == RDP_OPEN) {
@@ -796,21 +1253,53 @@ retry:
 		if (conn->rdp.state == RDP_SYN_SENT) {
 			if (retry) {
 				csp_rdp_error("RDP %p: Half-open connection detected, RST sent, now retrying\n", (void *)conn);
-				csp_rdp_queue_flush(conn);
 				retry = 0;
 				goto retry;
 			}
 			csp_rdp_error("RDP %p: Connection stayed half-open, even after RST and retry!\n", (void *)conn);
-			goto error;
 		}
 	}
 
-error:
 	csp_rdp_protocol("RDP %p: AC: Connection Failed\n", (void *)conn);
-	csp_rdp_close_internal(conn, CSP_RDP_CLOSED_BY_PROTOCOL, false);
+	csp_rdp_request(conn, RDP_REQ_ABORT);
 	return CSP_ERR_TIMEDOUT;
 }
 
+/* Take credit for one segment, if the window has room for it */
+static bool csp_rdp_tx_reserve(csp_conn_t * conn) {
+
+	uint_least32_t credit = atomic_load(&conn->rdp.tx_credit);
+	do {
+		if (credit >= atomic_load(&conn->rdp.tx_window)) {
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak(&conn->rdp.tx_credit, &credit, credit + 1));
+
+	return true;
+}
+
+/* Hand a segment the task holds credit for to the router. On error the packet is left as it was. */
+static int csp_rdp_tx_post(csp_conn_t * conn, csp_packet_t * packet) {
+
+	/* Make room for the RDP header, the router fills it in */
+	if (csp_rdp_header_add(packet) == NULL) {
+		csp_rdp_error("RDP %p: No space for RDP header (send)\n", (void *)conn);
+		atomic_fetch_sub(&conn->rdp.tx_credit, 1);
+		return CSP_ERR_NOMEM;
+	}
+
+	/* The segment keeps the priority it was sent with, also when retransmitted */
+	packet->id.pri = atomic_load(&conn->pri);
+
+	csp_packet_t * head = atomic_load(&conn->rdp.tx_post);
+	do {
+		packet->next = head;
+	} while (!atomic_compare_exchange_weak(&conn->rdp.tx_post, &head, packet));
+
+	csp_rdp_request(conn, 0);
+	return CSP_ERR_NONE;
+}
+
 int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 
 	if (conn->rdp.state != RDP_OPEN) {
@@ -824,21 +1313,59 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 			csp_rdp_error("RDP %p: ERROR cannot send, connection closed by peer or timeout\n", (void *)conn);
 			return CSP_ERR_RESET;
 		}
-		if (csp_rdp_is_conn_ready_for_tx(conn) == true)
+		if (csp_rdp_tx_reserve(conn) == true)
 			break;
-		csp_rdp_protocol("RDP %p: Waiting for window update before sending seq %u\n", (void *)conn, conn->rdp.snd_nxt);
+		csp_rdp_protocol("RDP %p: Waiting for window update before sending\n", (void *)conn);
 		csp_bin_sem_wait(&conn->rdp.tx_wait, conn->rdp.conn_timeout);
 	}
 
-	/* Add RDP header */
-	rdp_header_t * tx_header = csp_rdp_header_add(packet);
-	if (tx_header == NULL) {
-		csp_rdp_error("RDP %p: No space for RDP header (send)\n", (void *)conn);
-		return CSP_ERR_NOMEM;
+	return csp_rdp_tx_post(conn, packet);
+}
+
+int csp_rdp_send_nonblock(csp_conn_t * conn, csp_packet_t * packet) {
+
+	if (conn->rdp.state != RDP_OPEN) {
+		csp_rdp_error("RDP %p: ERROR cannot send, connection not open (%d)\n", (void *)conn, conn->rdp.state);
+		return CSP_ERR_RESET;
+	}
+
+	if (!csp_rdp_tx_reserve(conn)) {
+		/* Ask for the writable event, then check the window again, so an ACK opening it meanwhile is
+		 * not missed. The flag is only cleared by the router: another sender may be waiting on it,
+		 * and a spurious writable event is harmless. */
+		atomic_store(&conn->rdp.tx_blocked, true);
+		if (!csp_rdp_tx_reserve(conn)) {
+			csp_rdp_protocol("RDP %p: Window full, not sending\n", (void *)conn);
+			return CSP_ERR_AGAIN;
+		}
+	}
+
+	return csp_rdp_tx_post(conn, packet);
+}
+
+int csp_rdp_check_ack(csp_conn_t * conn) {
+
+	/* The router held back an ACK for lack of room in the RX queue, which reading may have made */
+	if (csp_rdp_rx_has_room(conn) && atomic_exchange(&conn->rdp.ack_withheld, false)) {
+		csp_rdp_request(conn, RDP_REQ_ACK);
 	}
+
+	return CSP_ERR_NONE;
+}
+
+int csp_rdp_close_request(csp_conn_t * conn) {
+	csp_rdp_request(conn, RDP_REQ_CLOSE);
+	return CSP_ERR_NONE;
+}
+
+/* Send a posted segment, the window must have room. On error the packet is left as it was. */
+static int csp_rdp_send_segment(csp_conn_t * conn, csp_packet_t * packet) {
+
+	/* Fill in the RDP header */
+	rdp_header_t * tx_header = csp_rdp_header_ref(packet);
 	tx_header->ack_nr = htobe16(conn->rdp.rcv_cur);
 	tx_header->seq_nr = htobe16(conn->rdp.snd_nxt);
-	tx_header->flags |= RDP_ACK;
+	tx_header->flags = RDP_ACK;
 
 	/* Send copy to tx_queue */
 	csp_packet_t * rdp_packet = csp_buffer_clone(packet);
@@ -848,7 +1375,9 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 	}
 
 	rdp_packet->timestamp_tx = csp_get_ms();
-	csp_rdp_queue_tx_add(conn, rdp_packet);
+	csp_rdp_queue_tx_add(conn, conn->rdp.snd_nxt, rdp_packet);
+	csp_rdp_rtt_start(conn, conn->rdp.snd_nxt, rdp_packet->timestamp_tx);
+	csp_conn_timer_arm(conn, rdp_packet->timestamp_tx + conn->rdp.rto + 1);
 
 	csp_rdp_protocol(
 		"RDP %p: Sending  in S %u: syn %u, ack %u, eack %u, "
@@ -861,20 +1390,92 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 
 	conn->rdp.snd_nxt++;
 	conn->rdp.ack_timestamp = csp_get_ms();
+
+	csp_id_t idout = conn->idout;
+	idout.pri = packet->id.pri;
+	csp_send_direct(&idout, packet, NULL);
+
 	return CSP_ERR_NONE;
 }
 
+/**
+ * Send the segments posted by user tasks, in the order they were posted, as far as the window
+ * allows. Once the connection is no longer open they are freed, and their credit returned.
+ */
+static void csp_rdp_tx_flush(csp_conn_t * conn) {
+
+	/* Posted newest first: reverse onto the end of the backlog */
+	csp_packet_t * packet = atomic_exchange(&conn->rdp.tx_post, NULL);
+	csp_packet_t * tail = packet;
+	csp_packet_t * head = NULL;
+	while (packet != NULL) {
+		csp_packet_t * next = packet->next;
+		packet->next = head;
+		head = packet;
+		packet = next;
+	}
+	if (head != NULL) {
+		if (conn->rdp.tx_tail != NULL) {
+			conn->rdp.tx_tail->next = head;
+		} else {
+			conn->rdp.tx_head = head;
+		}
+		conn->rdp.tx_tail = tail;
+	}
+
+	while ((packet = conn->rdp.tx_head) != NULL) {
+
+		csp_packet_t * next = packet->next;
+
+		if (conn->rdp.state != RDP_OPEN) {
+			csp_buffer_free(packet);
+			atomic_fetch_sub(&conn->rdp.tx_credit, 1);
+		} else if (!csp_rdp_is_conn_ready_for_tx(conn)) {
+			return;
+		} else if (csp_rdp_send_segment(conn, packet) != CSP_ERR_NONE) {
+			/* Retried from csp_rdp_check_timeouts() */
+			csp_conn_timer_arm(conn, csp_get_ms() + RDP_RETRY_DELAY);
+			return;
+		}
+
+		conn->rdp.tx_head = next;
+		if (next == NULL) {
+			conn->rdp.tx_tail = NULL;
+		}
+	}
+}
+
 void csp_rdp_init(csp_conn_t * conn) {
 
 	/* Set initial state */
-	conn->rdp.state = RDP_CLOSED;
+	atomic_init(&conn->rdp.state, RDP_CLOSED);
 	conn->rdp.closed_by = 0;
 	conn->rdp.conn_timeout = csp_rdp_conn_timeout;
 	conn->rdp.packet_timeout = csp_rdp_packet_timeout;
+	conn->rdp.window_size = csp_rdp_window_limit(csp_rdp_window_size);
+	atomic_init(&conn->rdp.rto, 0);
+	atomic_init(&conn->rdp.srtt, 0);
+	atomic_init(&conn->rdp.rttvar, 0);
+	atomic_init(&conn->rdp.retransmits, 0);
+	atomic_init(&conn->rdp.fast_retransmits, 0);
+	atomic_init(&conn->rdp.tx_window, 0);
+	atomic_init(&conn->rdp.tx_credit, 0);
+	csp_rdp_cc_init(conn);
+	atomic_init(&conn->rdp.tx_post, NULL);
+	conn->rdp.tx_head = NULL;
+	conn->rdp.tx_tail = NULL;
+	atomic_init(&conn->rdp.requests, 0);
+	atomic_init(&conn->rdp.listed, false);
+	atomic_init(&conn->rdp.ack_withheld, false);
+	atomic_init(&conn->rdp.tx_blocked, false);
+	atomic_init(&conn->rdp.event_callback, NULL);
 
 	/* Create a binary semaphore to wait on for tasks */
 	csp_bin_sem_init(&conn->rdp.tx_wait);
 
+	/* No segments held */
+	csp_rdp_queue_init(conn);
+
 }
 
 /**
@@ -893,6 +1494,11 @@ static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool sen
 
 	conn->rdp.closed_by |= closed_by;
 
+	/* Userspace has let go of the connection */
+	if (closed_by & CSP_RDP_CLOSED_BY_USERSPACE) {
+		atomic_store(&conn->rdp.event_callback, NULL);
+	}
+
 	/* If connection is open, send reset */
 	if (conn->rdp.state != RDP_CLOSE_WAIT) {
 		conn->rdp.state = RDP_CLOSE_WAIT;
@@ -901,7 +1507,9 @@ static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool sen
 			csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
 		}
 		csp_rdp_protocol("RDP %p: csp_rdp_close(0x%x)%s -> CLOSE_WAIT\n", (void *)conn, closed_by, send_rst ? ", sent RST" : "");
-		csp_bin_sem_post(&conn->rdp.tx_wait);  // wake up any pendng Tx
+		csp_rdp_tx_closed(conn);  // wake up any pendng Tx
+		csp_rdp_tx_flush(conn);   // free what was posted but not sent
+		csp_conn_timer_arm(conn, conn->timestamp + conn->rdp.conn_timeout + 1);
 	}
 
 	if (conn->rdp.closed_by != CSP_RDP_CLOSED_BY_ALL) {
@@ -972,3 +1580,33 @@ bool csp_rdp_conn_is_active(csp_conn_t *conn) {
 	return active;
 
 }
+
+int csp_rdp_get_stats(const csp_conn_t * conn, csp_rdp_stats_t * stats) {
+
+	if ((conn == NULL) || (stats == NULL) || !(conn->idin.flags & CSP_FRDP)) {
+		return CSP_ERR_INVAL;
+	}
+
+	stats->srtt = conn->rdp.srtt >> 3;
+	stats->rttvar = conn->rdp.rttvar >> 2;
+	stats->rto = conn->rdp.rto;
+	stats->cwnd = atomic_load(&conn->rdp.tx_window);
+	stats->window_size = conn->rdp.window_size;
+	stats->retransmits = conn->rdp.retransmits;
+	stats->fast_retransmits = conn->rdp.fast_retransmits;
+
+	return CSP_ERR_NONE;
+}
+
+int csp_rdp_set_event_callback(csp_conn_t * conn, csp_rdp_event_callback_t callback, void * arg) {
+
+	if ((conn == NULL) || !(conn->idin.flags & CSP_FRDP)) {
+		return CSP_ERR_INVAL;
+	}
+
+	atomic_store(&conn->rdp.event_callback, NULL);
+	conn->rdp.event_arg = arg;
+	atomic_store(&conn->rdp.event_callback, callback);
+
+	return CSP_ERR_NONE;
+}
@@ -9,5 +9,24 @@ void csp_rdp_check_timeouts(csp_conn_t * conn);
 int csp_rdp_connect(csp_conn_t * conn);
 int csp_rdp_close(csp_conn_t * conn, uint8_t closed_by);
 int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet);
+int csp_rdp_send_nonblock(csp_conn_t * conn, csp_packet_t * packet);
 int csp_rdp_check_ack(csp_conn_t * conn);
 bool csp_rdp_conn_is_active(csp_conn_t *conn);
+
+/* Post a userspace close to the router, see csp_close() */
+int csp_rdp_close_request(csp_conn_t * conn);
+
+/**
+ * Handle the requests user tasks posted to connections: connect, close, segments to send and
+ * ACKs held back. Called by the router with the RDP lock held.
+ */
+void csp_rdp_process_requests(void);
+
+/**
+ * Tell user tasks the router is going to sleep, so they wake it when they post requests.
+ * @return false if requests were posted meanwhile, and the router must not sleep
+ */
+bool csp_rdp_router_idle(void);
+
+/* Drop the requests of every connection, before csp_conn_init() re-initializes them */
+void csp_rdp_requests_init(void);
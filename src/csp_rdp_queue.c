@@ -1,117 +1,111 @@
 #include <csp_rdp_queue.h>
 
-#include <csp/arch/csp_queue.h>
 #include <csp/csp_types.h>
 #include <csp/csp.h>
 #include <csp/csp_debug.h>
+#include "csp_conn.h"
 
-static int __csp_rdp_queue_flush(csp_queue_handle_t queue, csp_conn_t * conn) {
+#define TX_RING_LEN (CSP_RDP_MAX_WINDOW)
+#define RX_RING_LEN (CSP_RDP_MAX_WINDOW * 2)
 
-	int ret = CSP_ERR_NONE;
-	int size;
-
-	size = csp_queue_size(queue);
-	while (size--) {
-		csp_packet_t * packet;
-
-		ret = csp_queue_dequeue(queue, &packet, 0);
-		if (ret != CSP_QUEUE_OK) {
-			break;
-		}
-
-        if (conn == packet->conn) {
-            csp_buffer_free(packet);
-        } else {
-			/* put it back */
-			ret = csp_queue_enqueue(queue, &packet, 0);
-			if (ret != CSP_QUEUE_OK) {
-				/* something is really broken */
-				break;
-			}
+static void csp_rdp_ring_flush(csp_rdp_slot_t * ring, int len) {
+	for (int i = 0; i < len; i++) {
+		if (ring[i].packet != NULL) {
+			csp_buffer_free(ring[i].packet);
+			ring[i].packet = NULL;
 		}
 	}
-
-	return ret;
 }
 
-static void csp_rdp_queue_add(csp_queue_handle_t queue, csp_conn_t * conn, csp_packet_t * packet) {
-    packet->conn = conn;
-    if (csp_queue_enqueue(queue, &packet, 0) != CSP_QUEUE_OK) {
-		csp_buffer_free(packet);
-    }
+void csp_rdp_queue_init(csp_conn_t * conn) {
+	for (int i = 0; i < TX_RING_LEN; i++) {
+		conn->rdp.tx_ring[i].packet = NULL;
+	}
+	for (int i = 0; i < RX_RING_LEN; i++) {
+		conn->rdp.rx_ring[i].packet = NULL;
+	}
 }
 
-static csp_packet_t * csp_rdp_queue_get(csp_queue_handle_t queue, csp_conn_t * conn) {
-    csp_packet_t * packet;
-    int size = csp_queue_size(queue);
-
-    while(size--) {
-        if (csp_queue_dequeue(queue, &packet, 0) != CSP_QUEUE_OK) {
-            /* Error */
-            return NULL;
-        }
-
-        if (packet->conn == conn) {
-            /* Found it */
-            return packet;
-        }
-
-        /* Put it back and check next */
-        csp_rdp_queue_add(queue, conn, packet);
-    }
-
-    return NULL;
+void csp_rdp_queue_flush(csp_conn_t * conn) {
+	csp_rdp_ring_flush(conn->rdp.tx_ring, TX_RING_LEN);
+	csp_rdp_ring_flush(conn->rdp.rx_ring, RX_RING_LEN);
 }
 
-static csp_queue_handle_t tx_queue;
-static csp_static_queue_t tx_queue_static; /* Static storage for rx queue */
-static char tx_queue_static_data[sizeof(csp_packet_t *) * CSP_RDP_MAX_WINDOW * 2];
+void csp_rdp_queue_tx_add(csp_conn_t * conn, uint16_t seq_nr, csp_packet_t * packet) {
+	csp_rdp_slot_t * slot = &conn->rdp.tx_ring[seq_nr % TX_RING_LEN];
 
-static csp_queue_handle_t rx_queue;
-static csp_static_queue_t rx_queue_static; /* Static storage for rx queue */
-static char rx_queue_static_data[sizeof(csp_packet_t *) * CSP_RDP_MAX_WINDOW * 2];
+	/* The window never spans more than the ring, so an occupied slot holds a stale segment */
+	if (slot->packet != NULL) {
+		csp_buffer_free(slot->packet);
+	}
+	slot->packet = packet;
+	slot->seq_nr = seq_nr;
+	slot->sacked = false;
+}
 
-void csp_rdp_queue_init(void) {
+csp_packet_t * csp_rdp_queue_tx_get(csp_conn_t * conn, uint16_t seq_nr) {
+	csp_rdp_slot_t * slot = &conn->rdp.tx_ring[seq_nr % TX_RING_LEN];
 
-	/* Create TX queue */
-	tx_queue = csp_queue_create_static(CSP_RDP_MAX_WINDOW * 2, sizeof(csp_packet_t *), tx_queue_static_data, &tx_queue_static);
+	if ((slot->packet == NULL) || (slot->seq_nr != seq_nr)) {
+		return NULL;
+	}
+	return slot->packet;
+}
 
-	/* Create RX queue */
-	rx_queue = csp_queue_create_static(CSP_RDP_MAX_WINDOW * 2, sizeof(csp_packet_t *), rx_queue_static_data, &rx_queue_static);
+void csp_rdp_queue_tx_remove(csp_conn_t * conn, uint16_t seq_nr) {
+	csp_rdp_slot_t * slot = &conn->rdp.tx_ring[seq_nr % TX_RING_LEN];
 
+	if ((slot->packet != NULL) && (slot->seq_nr == seq_nr)) {
+		csp_buffer_free(slot->packet);
+		slot->packet = NULL;
+	}
 }
 
-void csp_rdp_queue_flush(csp_conn_t * conn) {
+void csp_rdp_queue_tx_sack(csp_conn_t * conn, uint16_t seq_nr) {
+	csp_rdp_slot_t * slot = &conn->rdp.tx_ring[seq_nr % TX_RING_LEN];
 
-	if (conn == NULL) {
-		csp_queue_empty(tx_queue);
-		csp_queue_empty(rx_queue);
-	} else {
-		(void)__csp_rdp_queue_flush(tx_queue, conn);
-		(void)__csp_rdp_queue_flush(rx_queue, conn);
+	if ((slot->packet != NULL) && (slot->seq_nr == seq_nr)) {
+		slot->sacked = true;
 	}
 }
 
-int csp_rdp_queue_tx_size(void) {
-    return csp_queue_size(tx_queue);
-}
+bool csp_rdp_queue_tx_sacked(csp_conn_t * conn, uint16_t seq_nr) {
+	csp_rdp_slot_t * slot = &conn->rdp.tx_ring[seq_nr % TX_RING_LEN];
 
-void csp_rdp_queue_tx_add(csp_conn_t * conn, csp_packet_t * packet) {
-    csp_rdp_queue_add(tx_queue, conn, packet);
+	return (slot->packet != NULL) && (slot->seq_nr == seq_nr) && slot->sacked;
 }
 
-csp_packet_t * csp_rdp_queue_tx_get(csp_conn_t * conn) {
-    return csp_rdp_queue_get(tx_queue, conn);
-}
+int csp_rdp_queue_rx_add(csp_conn_t * conn, uint16_t seq_nr, csp_packet_t * packet) {
+	csp_rdp_slot_t * slot = &conn->rdp.rx_ring[seq_nr % RX_RING_LEN];
 
-int csp_rdp_queue_rx_size(void) {
-    return csp_queue_size(rx_queue);
+	if (slot->packet != NULL) {
+		if (slot->seq_nr == seq_nr) {
+			return CSP_ERR_USED;
+		}
+		/* Left behind when the same segment was later received in sequence */
+		csp_buffer_free(slot->packet);
+	}
+	slot->packet = packet;
+	slot->seq_nr = seq_nr;
+	return CSP_ERR_NONE;
 }
 
-void csp_rdp_queue_rx_add(csp_conn_t * conn, csp_packet_t * packet) {
-    csp_rdp_queue_add(rx_queue, conn, packet);
+csp_packet_t * csp_rdp_queue_rx_get(csp_conn_t * conn, uint16_t seq_nr) {
+	csp_rdp_slot_t * slot = &conn->rdp.rx_ring[seq_nr % RX_RING_LEN];
+
+	if ((slot->packet == NULL) || (slot->seq_nr != seq_nr)) {
+		return NULL;
+	}
+	csp_packet_t * packet = slot->packet;
+	slot->packet = NULL;
+	return packet;
 }
 
-csp_packet_t * csp_rdp_queue_rx_get(csp_conn_t * conn) {
-    return csp_rdp_queue_get(rx_queue, conn);
+csp_packet_t * csp_rdp_queue_rx_peek(csp_conn_t * conn, uint16_t seq_nr) {
+	csp_rdp_slot_t * slot = &conn->rdp.rx_ring[seq_nr % RX_RING_LEN];
+
+	if ((slot->packet == NULL) || (slot->seq_nr != seq_nr)) {
+		return NULL;
+	}
+	return slot->packet;
 }
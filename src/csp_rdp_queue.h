@@ -2,13 +2,17 @@
 
 #include <csp/csp_types.h>
 
-void csp_rdp_queue_init(void);
+/* Segments are held per connection in rings indexed by sequence number, see csp_rdp_t */
+
+void csp_rdp_queue_init(csp_conn_t * conn);
 void csp_rdp_queue_flush(csp_conn_t * conn);
 
-int csp_rdp_queue_tx_size(void);
-void csp_rdp_queue_tx_add(csp_conn_t * conn, csp_packet_t * packet);
-csp_packet_t * csp_rdp_queue_tx_get(csp_conn_t * conn);
+void csp_rdp_queue_tx_add(csp_conn_t * conn, uint16_t seq_nr, csp_packet_t * packet);
+csp_packet_t * csp_rdp_queue_tx_get(csp_conn_t * conn, uint16_t seq_nr);
+void csp_rdp_queue_tx_remove(csp_conn_t * conn, uint16_t seq_nr);
+void csp_rdp_queue_tx_sack(csp_conn_t * conn, uint16_t seq_nr);
+bool csp_rdp_queue_tx_sacked(csp_conn_t * conn, uint16_t seq_nr);
 
-int csp_rdp_queue_rx_size(void);
-void csp_rdp_queue_rx_add(csp_conn_t * conn, csp_packet_t * packet);
-csp_packet_t * csp_rdp_queue_rx_get(csp_conn_t * conn);
+int csp_rdp_queue_rx_add(csp_conn_t * conn, uint16_t seq_nr, csp_packet_t * packet);
+csp_packet_t * csp_rdp_queue_rx_get(csp_conn_t * conn, uint16_t seq_nr);
+csp_packet_t * csp_rdp_queue_rx_peek(csp_conn_t * conn, uint16_t seq_nr);
@@ -14,6 +14,7 @@
 #include "csp_io.h"
 #include "csp_promisc.h"
 #include "csp_qfifo.h"
+#include "csp_route.h"
 #include "csp_dedup.h"
 #include "csp_rdp.h"
 #include <csp/csp_debug.h>
@@ -21,6 +22,14 @@
 #include <csp/csp_iflist.h>
 #include "csp_macro.h"
 
+#define CSP_ROUTE_BATCH 8  //! Max packets taken from the router queue per wake up
+
+#if (CSP_USE_RDP)
+/* The router owns the RDP state of all connections and the timer heap, so RDP input, requests
+ * and timeout handling must not run in two router workers at once */
+static csp_route_lock_t rdp_lock = CSP_ROUTE_LOCK_INIT;
+#endif
+
 /**
  * Check supported packet options
  * @param iface pointer to incoming interface
@@ -109,37 +118,25 @@ __weak void csp_input_hook(csp_iface_t * iface, csp_packet_t * packet) {
 				   packet->id.sport, packet->id.pri, packet->id.flags, packet->length, iface->name, csp_get_ms());
 }
 
-int csp_route_work(void) {
+/**
+ * Route one packet from the router input queue
+ * @param iface pointer to incoming interface
+ * @param packet pointer to packet
+ */
+static void csp_route_input(csp_iface_t * iface, csp_packet_t * packet) {
 
-	csp_qfifo_t input;
-	csp_packet_t * packet;
 	csp_conn_t * conn;
 	csp_socket_t * socket;
 
-#if (CSP_USE_RDP)
-	/* Check connection timeouts (currently only for RDP) */
-	csp_conn_check_timeouts();
-#endif
-
-	/* Get next packet to route */
-	if (csp_qfifo_read(&input) != CSP_ERR_NONE) {
-		return CSP_ERR_TIMEDOUT;
-	}
-
-	packet = input.packet;
-	if (packet == NULL) {
-		return CSP_ERR_TIMEDOUT;
-	}
-
-	csp_input_hook(input.iface, packet);
+	csp_input_hook(iface, packet);
 
 	/* Count the message */
-	input.iface->rx++;
-	input.iface->rxbytes += packet->length;
+	iface->rx++;
+	iface->rxbytes += packet->length;
 
 	/* The packet is to me, if the address matches that of any interface,
 	 * or the address matches the broadcast address of the incoming interface */
-	int is_to_me = (csp_iflist_get_by_addr(packet->id.dst) != NULL || (csp_id_is_broadcast(packet->id.dst, input.iface)));
+	int is_to_me = (csp_iflist_get_by_addr(packet->id.dst) != NULL || (csp_id_is_broadcast(packet->id.dst, iface)));
 
 	/* Deduplication */
 	if ((csp_conf.dedup == CSP_DEDUP_ALL) ||
@@ -147,9 +144,9 @@ int csp_route_work(void) {
 		((!is_to_me) && (csp_conf.dedup == CSP_DEDUP_FWD))) {
 		if (csp_dedup_is_duplicate(packet)) {
 			/* Discard packet */
-			input.iface->drop++;
+			iface->drop++;
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 	}
 
@@ -162,15 +159,15 @@ int csp_route_work(void) {
 	if (!is_to_me) {
 
 		/* Otherwise, actually send the message */
-		csp_send_direct(&packet->id, packet, input.iface);
-		return CSP_ERR_NONE;
+		csp_send_direct(&packet->id, packet, iface);
+		return;
 
 	}
 
 	/* Discard packets with unsupported options */
-	if (csp_route_check_options(input.iface, packet) != CSP_ERR_NONE) {
+	if (csp_route_check_options(iface, packet) != CSP_ERR_NONE) {
 		csp_buffer_free(packet);
-		return CSP_ERR_NONE;
+		return;
 	}
 
 	/**
@@ -179,13 +176,13 @@ int csp_route_work(void) {
 	csp_callback_t callback = csp_port_get_callback(packet->id.dport);
 	if (callback) {
 
-		if (csp_route_security_check(CSP_SO_CRC32REQ, input.iface, packet) != CSP_ERR_NONE) {
+		if (csp_route_security_check(CSP_SO_CRC32REQ, iface, packet) != CSP_ERR_NONE) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		callback(packet);
-		return CSP_ERR_NONE;
+		return;
 	}
 
 	/**
@@ -198,18 +195,18 @@ int csp_route_work(void) {
 	/* If the socket is connection-less, deliver now */
 	if (socket && (socket->opts & CSP_SO_CONN_LESS)) {
 
-		if (csp_route_security_check(socket->opts, input.iface, packet) != CSP_ERR_NONE) {
+		if (csp_route_security_check(socket->opts, iface, packet) != CSP_ERR_NONE) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		if (csp_queue_enqueue(socket->rx_queue, &packet, 0) != CSP_QUEUE_OK) {
 			csp_dbg_conn_ovf++;
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 		
-		return CSP_ERR_NONE;
+		return;
 	}
 
 	/* Search for an existing connection */
@@ -221,13 +218,13 @@ int csp_route_work(void) {
 		/* Reject packet if no matching socket is found */
 		if (!socket) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(socket->opts, input.iface, packet) != CSP_ERR_NONE) {
+		if (csp_route_security_check(socket->opts, iface, packet) != CSP_ERR_NONE) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		/* New incoming connection accepted */
@@ -245,7 +242,7 @@ int csp_route_work(void) {
 		if (!conn) {
 			csp_dbg_conn_out++;
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		/* Store the socket queue and options */
@@ -256,20 +253,22 @@ int csp_route_work(void) {
 	} else {
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(conn->opts, input.iface, packet) != CSP_ERR_NONE) {
+		if (csp_route_security_check(conn->opts, iface, packet) != CSP_ERR_NONE) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 	}
 
 #if (CSP_USE_RDP)
 	/* Pass packet to RDP module */
 	if (packet->id.flags & CSP_FRDP) {
+		csp_route_lock(&rdp_lock);
 		bool close_connection = csp_rdp_new_packet(conn, packet);
 		if (close_connection) {
-			csp_close(conn);
+			csp_conn_close(conn, CSP_RDP_CLOSED_BY_USERSPACE);
 		}
-		return CSP_ERR_NONE;
+		csp_route_unlock(&rdp_lock);
+		return;
 	}
 #endif
 
@@ -277,7 +276,7 @@ int csp_route_work(void) {
 	if (csp_conn_enqueue_packet(conn, packet) != CSP_ERR_NONE) {
 		csp_dbg_conn_ovf++;
 		csp_buffer_free(packet);
-		return CSP_ERR_NONE;
+		return;
 	}
 
 	/* Try to queue up the new connection pointer */
@@ -285,12 +284,53 @@ int csp_route_work(void) {
 		if (csp_queue_enqueue(conn->dest_socket->rx_queue, &conn, 0) != CSP_QUEUE_OK) {
 			csp_dbg_conn_ovf++;
 			csp_close(conn);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		/* Ensure that this connection will not be posted to this socket again */
 		conn->dest_socket = NULL;
 	}
+}
 
-	return CSP_ERR_NONE;
+int csp_route_work_shard(unsigned int shard) {
+
+	csp_qfifo_t input[CSP_ROUTE_BATCH];
+	uint32_t timeout = CSP_MAX_TIMEOUT;
+
+#if (CSP_USE_RDP)
+	/* Handle what user tasks posted to RDP connections, check connection timeouts (currently
+	 * only for RDP), and sleep no longer than the next one */
+	if (shard == 0) {
+		csp_route_lock(&rdp_lock);
+		csp_rdp_process_requests();
+		timeout = csp_conn_check_timeouts();
+		if (!csp_rdp_router_idle()) {
+			timeout = 0;
+		}
+		csp_route_unlock(&rdp_lock);
+	}
+#endif
+
+	/* Get next burst of packets to route */
+	int count = csp_qfifo_read_batch(shard, input, CSP_ROUTE_BATCH, timeout);
+	if (count == 0) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	int routed = 0;
+	for (int i = 0; i < count; i++) {
+		/* Wake up element */
+		if (input[i].packet == NULL) {
+			continue;
+		}
+
+		csp_route_input(input[i].iface, input[i].packet);
+		routed++;
+	}
+
+	return (routed > 0) ? CSP_ERR_NONE : CSP_ERR_TIMEDOUT;
+}
+
+int csp_route_work(void) {
+	return csp_route_work_shard(0);
 }
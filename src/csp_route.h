@@ -0,0 +1,60 @@
+#pragma once
+
+#include "csp/autoconfig.h"
+#include <csp/csp_types.h>
+
+#ifndef CSP_ROUTE_WORKERS
+#define CSP_ROUTE_WORKERS 1
+#endif
+
+#if (CSP_ROUTE_WORKERS > 1)
+#if !(CSP_POSIX)
+#error "CSP_ROUTE_WORKERS is only supported on POSIX"
+#endif
+#include <pthread.h>
+
+/* Tables shared between router workers are guarded by a mutex. With a single router task the
+ * locks compile to nothing. */
+typedef pthread_mutex_t csp_route_lock_t;
+#define CSP_ROUTE_LOCK_INIT PTHREAD_MUTEX_INITIALIZER
+
+static inline void csp_route_lock(csp_route_lock_t * lock) {
+	pthread_mutex_lock(lock);
+}
+
+static inline void csp_route_unlock(csp_route_lock_t * lock) {
+	pthread_mutex_unlock(lock);
+}
+#else
+typedef char csp_route_lock_t;
+#define CSP_ROUTE_LOCK_INIT 0
+
+static inline void csp_route_lock(csp_route_lock_t * lock) {
+	(void)lock;
+}
+
+static inline void csp_route_unlock(csp_route_lock_t * lock) {
+	(void)lock;
+}
+#endif
+
+/**
+ * Route packets from one shard of the router input queue.
+ * Shard 0 also checks connection timeouts, so csp_route_work() is csp_route_work_shard(0).
+ * @param shard shard index, less than the number of running workers
+ * @return #CSP_ERR_NONE if any packet was routed, otherwise #CSP_ERR_TIMEDOUT
+ */
+int csp_route_work_shard(unsigned int shard);
+
+/**
+ * Hash of the flow (source, destination and ports) a packet belongs to.
+ * Used to keep the packets of a flow on one router worker and on one multipath route.
+ */
+static inline uint32_t csp_route_flow_hash(const csp_id_t * id) {
+	uint32_t hash = ((uint32_t)id->src << 16) | id->dst;
+	hash ^= (((uint32_t)id->sport << 8) | id->dport) * 2654435761U;
+	hash ^= hash >> 15;
+	hash *= 2246822519U;
+	hash ^= hash >> 13;
+	return hash;
+}
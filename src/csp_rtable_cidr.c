@@ -1,128 +1,366 @@
 
 
+#include "csp_rtable_cidr.h"
+
 #include <inttypes.h>
+#include <stdatomic.h>
 #include <string.h>
 
-#include <csp/csp_rtable.h>
 #include <csp/csp_debug.h>
 #include <csp/csp_id.h>
+#include <csp/arch/csp_queue.h>
+#include "csp_io.h"
+
+/**
+ * Routes are also indexed by prefix in a binary trie, walked from the most significant host bit
+ * of an address. The node at depth n holds the routes with netmask n and that prefix, so a lookup
+ * takes at most host bits steps however many routes are set. Routes are never removed one by one,
+ * only all at once by csp_rtable_free().
+ */
+#define RTABLE_HOST_BITS_MAX 14  /* CSPv2, the wider of the two header versions */
+#define RTABLE_NODES (1 + CSP_RTABLE_SIZE * RTABLE_HOST_BITS_MAX)
+#define RTABLE_NONE 0xFFFF
+
+#if (RTABLE_NODES >= RTABLE_NONE)
+#error "CSP_RTABLE_SIZE too large for the routing table index"
+#endif
+
+/**
+ * The router reads the table while other tasks change it, so a published table is never written.
+ * A writer copies the current version into an idle one, changes the copy and publishes it with a
+ * single pointer swap. Readers pin the version they use with a reader count, and a version is only
+ * reused once no reader has it pinned. Versions are reused in turn, so routes returned without a
+ * pin stay valid until the table has been changed CSP_RTABLE_VERSIONS - 1 times.
+ */
+#ifndef CSP_RTABLE_VERSIONS
+#define CSP_RTABLE_VERSIONS 3
+#endif
+
+#ifndef CSP_RTABLE_GRACE_MS
+#define CSP_RTABLE_GRACE_MS 100  //! Max time a writer waits for readers to leave an old version
+#endif
+
+typedef struct {
+	uint16_t child[2]; /* Node one bit longer, 0 if none (the root is nobody's child) */
+	uint16_t route;    /* Newest route with exactly this prefix, RTABLE_NONE if none */
+} csp_rtable_node_t;
+
+struct csp_rtable_version_s {
+	csp_route_t routes[CSP_RTABLE_SIZE];
+	uint16_t next[CSP_RTABLE_SIZE]; /* Next older route with the same prefix, RTABLE_NONE if none */
+	csp_rtable_node_t nodes[RTABLE_NODES];
+	uint16_t count;
+	uint16_t node_count;
+	atomic_uint readers;
+	atomic_flag writing;  /* Claimed by a writer */
+};
+
+static csp_rtable_version_t rtable_versions[CSP_RTABLE_VERSIONS] = {
+	[0] = {.nodes = {{.route = RTABLE_NONE}}, .node_count = 1},
+};
+static csp_rtable_version_t * _Atomic rtable_current = &rtable_versions[0];
+
+/* Writers take turns, by holding the only item of this queue */
+static csp_static_queue_t rtable_writer_queue;
+static char rtable_writer_buffer[1];
+static csp_queue_handle_t rtable_writer;
+
+void csp_rtable_init(void) {
+	const char token = 0;
+	rtable_writer = csp_queue_create_static(1, sizeof(token), rtable_writer_buffer, &rtable_writer_queue);
+	csp_queue_enqueue(rtable_writer, &token, 0);
+}
 
-/* Definition of routing table */
-static csp_route_t rtable[CSP_RTABLE_SIZE] = {0};
+static inline unsigned int csp_rtable_bit(uint16_t addr, unsigned int depth) {
+	return (addr >> (csp_id_get_host_bits() - 1 - depth)) & 1;
+}
 
-static int rtable_inptr = 0;
+/* Find the node of a prefix, adding the nodes leading to it if add is set */
+static csp_rtable_node_t * csp_rtable_node(csp_rtable_version_t * table, uint16_t addr, uint16_t netmask, bool add) {
 
-static csp_route_t * csp_rtable_find_exact(uint16_t addr, uint16_t netmask, csp_iface_t * ifc) {
+	csp_rtable_node_t * node = &table->nodes[0];
 
-	/* Start search */
-	for (int i = 0; i < rtable_inptr; i++) {
-		if (rtable[i].address == addr && rtable[i].netmask == netmask && rtable[i].iface == ifc) {
-			return &rtable[i];
+	for (unsigned int depth = 0; depth < netmask; depth++) {
+		unsigned int bit = csp_rtable_bit(addr, depth);
+		if (node->child[bit] == 0) {
+			if (!add) {
+				return NULL;
+			}
+			table->nodes[table->node_count] = (csp_rtable_node_t){.route = RTABLE_NONE};
+			node->child[bit] = table->node_count++;
 		}
+		node = &table->nodes[node->child[bit]];
 	}
 
-	return NULL;
+	return node;
 }
 
-csp_route_t * csp_rtable_search_backward(csp_route_t * start_route) {
+static csp_route_t * csp_rtable_find_exact(csp_rtable_version_t * table, uint16_t addr, uint16_t netmask, csp_iface_t * ifc) {
 
-    if (start_route == NULL || start_route <= rtable) {
-        return NULL;
-    }
+	const csp_rtable_node_t * node = csp_rtable_node(table, addr, netmask, false);
+	if (node == NULL) {
+		return NULL;
+	}
 
-    /* Start searching backward from the route before start_route */
-    for (csp_route_t * route = start_route - 1; route >= rtable; route--) {
+	for (uint16_t i = node->route; i != RTABLE_NONE; i = table->next[i]) {
+		if (table->routes[i].address == addr && table->routes[i].iface == ifc) {
+			return &table->routes[i];
+		}
+	}
 
-        if (route->netmask == start_route->netmask && route->address == start_route->address) {
-            return route;
-        }
-    }
+	return NULL;
+}
 
-    return NULL;
+const csp_rtable_version_t * csp_rtable_read_begin(void) {
+
+	for (;;) {
+		csp_rtable_version_t * table = atomic_load(&rtable_current);
+		atomic_fetch_add(&table->readers, 1);
+
+		/* A writer may have claimed the version before the pin, but only while it was not current */
+		if (atomic_load(&rtable_current) == table) {
+			return table;
+		}
+		atomic_fetch_sub(&table->readers, 1);
+	}
 }
 
-csp_route_t * csp_rtable_find_route(uint16_t addr) {
+void csp_rtable_read_end(const csp_rtable_version_t * table) {
+	atomic_fetch_sub(&((csp_rtable_version_t *)table)->readers, 1);
+}
 
-	/* Remember best result */
-	int best_result = -1;
-	uint16_t best_result_mask = 0;
+/* Claim an idle version for a writer, the one published longest ago first */
+static csp_rtable_version_t * csp_rtable_claim(void) {
 
-	/* Start search */
-	for (int i = 0; i < rtable_inptr; i++) {
+	const csp_rtable_version_t * current = atomic_load(&rtable_current);
+	unsigned int first = current - rtable_versions;
 
-		uint16_t hostbits = (1 << (csp_id_get_host_bits() - rtable[i].netmask)) - 1;
-		uint16_t netbits = ~hostbits;
+	for (unsigned int i = 1; i < CSP_RTABLE_VERSIONS; i++) {
+		csp_rtable_version_t * table = &rtable_versions[(first + i) % CSP_RTABLE_VERSIONS];
+		if (atomic_flag_test_and_set(&table->writing)) {
+			continue;
+		}
+		if ((table != atomic_load(&rtable_current)) && (atomic_load(&table->readers) == 0)) {
+			return table;
+		}
+		atomic_flag_clear(&table->writing);
+	}
+
+	return NULL;
+}
+
+int csp_rtable_update(int (*update)(csp_rtable_version_t * table, void * ctx), void * ctx) {
 
-		/* Match network addresses */
-		uint16_t net_a = rtable[i].address & netbits;
-		uint16_t net_b = addr & netbits;
+	/* Routes set before csp_init() are set by the only task */
+	char token;
+	if (rtable_writer != NULL) {
+		csp_queue_dequeue(rtable_writer, &token, CSP_MAX_TIMEOUT);
+	}
 
-		/* We have a match */
-		if (net_a == net_b) {
-			if (rtable[i].netmask >= best_result_mask) {
-				best_result = i;
-				best_result_mask = rtable[i].netmask;
+	/* Wait for readers to leave an old version. While the token is held the queue is empty, so a
+	 * dequeue just sleeps, and lets readers of lower priority run. */
+	csp_rtable_version_t * table;
+	unsigned int waited = 0;
+	while ((table = csp_rtable_claim()) == NULL) {
+		if ((rtable_writer == NULL) || (waited++ >= CSP_RTABLE_GRACE_MS)) {
+			if (rtable_writer != NULL) {
+				csp_queue_enqueue(rtable_writer, &token, 0);
 			}
+			return CSP_ERR_BUSY;
 		}
+		char none;
+		csp_queue_dequeue(rtable_writer, &none, 1);
 	}
 
-	if (best_result > -1) {
-		return &rtable[best_result];
+	int res;
+	bool published = false;
+	while (!published) {
+		/* The pin keeps the version from being reused, and so from coming back as current, until the swap */
+		csp_rtable_version_t * current = (csp_rtable_version_t *)csp_rtable_read_begin();
+
+		table->count = current->count;
+		table->node_count = current->node_count;
+		memcpy(table->routes, current->routes, current->count * sizeof(table->routes[0]));
+		memcpy(table->next, current->next, current->count * sizeof(table->next[0]));
+		memcpy(table->nodes, current->nodes, current->node_count * sizeof(table->nodes[0]));
+
+		res = update(table, ctx);
+
+		/* Start over from the new version if another writer published meanwhile */
+		published = (res < 0) || atomic_compare_exchange_strong(&rtable_current, &current, table);
+		csp_rtable_read_end(current);
+	}
+
+	atomic_flag_clear(&table->writing);
+	if (res >= 0) {
+		csp_egress_invalidate();
+	}
+	if (rtable_writer != NULL) {
+		csp_queue_enqueue(rtable_writer, &token, 0);
+	}
+
+	return res;
+}
+
+csp_route_t * csp_rtable_lookup(const csp_rtable_version_t * table, uint16_t addr) {
+
+	const unsigned int host_bits = csp_id_get_host_bits();
+	const csp_rtable_node_t * node = &table->nodes[0];
+
+	/* The longest prefix wins, the newest route among those with the same prefix */
+	uint16_t best = node->route;
+	for (unsigned int depth = 0; depth < host_bits; depth++) {
+		uint16_t child = node->child[csp_rtable_bit(addr, depth)];
+		if (child == 0) {
+			break;
+		}
+		node = &table->nodes[child];
+		if (node->route != RTABLE_NONE) {
+			best = node->route;
+		}
+	}
+
+	if (best != RTABLE_NONE) {
+		return (csp_route_t *)&table->routes[best];
 	}
 
 	return NULL;
 }
 
-static int csp_rtable_set_internal(uint16_t address, uint16_t netmask, csp_iface_t * ifc, uint16_t via) {
+csp_route_t * csp_rtable_search_backward(csp_route_t * start_route) {
+
+    if (start_route == NULL) {
+        return NULL;
+    }
+
+    /* The route belongs to the version that holds it */
+    const csp_rtable_version_t * table = NULL;
+    for (unsigned int i = 0; i < CSP_RTABLE_VERSIONS; i++) {
+        if ((start_route >= rtable_versions[i].routes) && (start_route < &rtable_versions[i].routes[CSP_RTABLE_SIZE])) {
+            table = &rtable_versions[i];
+            break;
+        }
+    }
+    if (table == NULL) {
+        return NULL;
+    }
+
+    /* Older routes with the same prefix, newest first */
+    for (uint16_t i = table->next[start_route - table->routes]; i != RTABLE_NONE; i = table->next[i]) {
+
+        if (table->routes[i].netmask == start_route->netmask && table->routes[i].address == start_route->address) {
+            return (csp_route_t *)&table->routes[i];
+        }
+    }
+
+    return NULL;
+}
+
+csp_route_t * csp_rtable_find_route(uint16_t addr) {
+	return csp_rtable_lookup(atomic_load(&rtable_current), addr);
+}
+
+int csp_rtable_version_set(csp_rtable_version_t * table, uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via, uint8_t weight, uint8_t flags) {
+
+	if ((netmask < 0) || (netmask > (int)csp_id_get_host_bits())) {
+		netmask = csp_id_get_host_bits();
+	}
+
+	/* Validates options */
+	if (ifc == NULL) {
+		csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+		return CSP_ERR_INVAL;
+	}
+
+	if (weight == 0) {
+		weight = 1;
+	}
 
 	/* First see if the entry exists */
-	csp_route_t * entry = csp_rtable_find_exact(address, netmask, ifc);
+	csp_route_t * entry = csp_rtable_find_exact(table, address, netmask, ifc);
+
+	/* Only the via address, weight and flags of an existing entry change */
+	if (entry) {
+		entry->via = via;
+		entry->weight = weight;
+		entry->flags = flags;
+		return CSP_ERR_NONE;
+	}
 
 	/* If not, create a new one */
-	if (!entry) {
-		entry = &rtable[rtable_inptr++];
-		if (rtable_inptr > CSP_RTABLE_SIZE) {
-			rtable_inptr = CSP_RTABLE_SIZE;
-		}
+	if (table->count >= CSP_RTABLE_SIZE) {
+		csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+		return CSP_ERR_NOMEM;
 	}
 
+	uint16_t index = table->count++;
+	entry = &table->routes[index];
+
 	/* Fill in the data */
 	entry->address = address;
 	entry->netmask = netmask;
 	entry->iface = ifc;
 	entry->via = via;
+	entry->weight = weight;
+	entry->flags = flags;
+
+	/* Newest first among the routes with this prefix */
+	csp_rtable_node_t * node = csp_rtable_node(table, address, netmask, true);
+	table->next[index] = node->route;
+	node->route = index;
 
 	return CSP_ERR_NONE;
 }
 
+int csp_rtable_version_free(csp_rtable_version_t * table, void * ctx) {
+	(void)ctx; /* Avoid compiler warnings about unused parameter */
+	table->count = 0;
+	table->nodes[0] = (csp_rtable_node_t){.route = RTABLE_NONE};
+	table->node_count = 1;
+	return CSP_ERR_NONE;
+}
+
 void csp_rtable_free(void) {
-	memset(rtable, 0, sizeof(rtable));
-	rtable_inptr = 0;
+	csp_rtable_update(csp_rtable_version_free, NULL);
 }
 
 void csp_rtable_clear(void) {
 	csp_rtable_free();
 }
 
-int csp_rtable_set(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via) {
+typedef struct {
+	uint16_t address;
+	int netmask;
+	csp_iface_t * ifc;
+	uint16_t via;
+	uint8_t weight;
+	uint8_t flags;
+} csp_rtable_set_ctx_t;
+
+static int csp_rtable_set_update(csp_rtable_version_t * table, void * vctx) {
+	const csp_rtable_set_ctx_t * ctx = vctx;
+	return csp_rtable_version_set(table, ctx->address, ctx->netmask, ctx->ifc, ctx->via, ctx->weight, ctx->flags);
+}
 
-	if ((netmask < 0) || (netmask > (int)csp_id_get_host_bits())) {
-		netmask = csp_id_get_host_bits();
-	}
+int csp_rtable_set_route(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via, uint8_t weight, uint8_t flags) {
 
-	/* Validates options */
-	if (ifc == NULL) {
-		csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
-		return CSP_ERR_INVAL;
-	}
+	csp_rtable_set_ctx_t ctx = {.address = address, .netmask = netmask, .ifc = ifc, .via = via, .weight = weight, .flags = flags};
+	return csp_rtable_update(csp_rtable_set_update, &ctx);
+}
 
-	return csp_rtable_set_internal(address, netmask, ifc, via);
+int csp_rtable_set(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t via) {
+	return csp_rtable_set_route(address, netmask, ifc, via, 1, CSP_ROUTE_REDUNDANT);
 }
 
 void csp_rtable_iterate(csp_rtable_iterator_t iter, void * ctx) {
-	for (int i = 0; i < rtable_inptr; i++) {
-		iter(ctx, &rtable[i]);
+
+	const csp_rtable_version_t * table = csp_rtable_read_begin();
+	for (int i = 0; i < table->count; i++) {
+		if (!iter(ctx, (csp_route_t *)&table->routes[i])) {
+			break;
+		}
 	}
+	csp_rtable_read_end(table);
 }
 
 #if (CSP_ENABLE_CSP_PRINT)
@@ -130,9 +368,14 @@ void csp_rtable_iterate(csp_rtable_iterator_t iter, void * ctx) {
 static bool csp_rtable_print_route(void * ctx, csp_route_t * route) {
 	(void)ctx; /* Avoid compiler warnings about unused parameter */
 	if (route->via == CSP_NO_VIA_ADDRESS) {
-		csp_print("%u/%u %s\r\n", route->address, route->netmask, route->iface->name);
+		csp_print("%u/%u %s", route->address, route->netmask, route->iface->name);
+	} else {
+		csp_print("%u/%u %s %u", route->address, route->netmask, route->iface->name, route->via);
+	}
+	if (route->flags & CSP_ROUTE_REDUNDANT) {
+		csp_print("\r\n");
 	} else {
-		csp_print("%u/%u %s %u\r\n", route->address, route->netmask, route->iface->name, route->via);
+		csp_print(" w%u\r\n", route->weight);
 	}
 	return true;
 }
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <csp/csp_rtable.h>
+
+/** Version of the routing table, published as a whole */
+typedef struct csp_rtable_version_s csp_rtable_version_t;
+
+/**
+ * Initialize the routing table writer lock, called by csp_init().
+ */
+void csp_rtable_init(void);
+
+/**
+ * Pin the current routing table.
+ * Routes looked up in the table stay valid until csp_rtable_read_end(), whatever writers do
+ * meanwhile. Never blocks, but may retry if a writer publishes at the same time.
+ * @return the current table
+ */
+const csp_rtable_version_t * csp_rtable_read_begin(void);
+
+/**
+ * Release a table pinned by csp_rtable_read_begin().
+ * @param table table to release
+ */
+void csp_rtable_read_end(const csp_rtable_version_t * table);
+
+/**
+ * Find the route to an address in a pinned table.
+ * @param table table pinned by csp_rtable_read_begin()
+ * @param dest_address destination address
+ * @return newest route with the longest matching prefix, NULL if none
+ */
+csp_route_t * csp_rtable_lookup(const csp_rtable_version_t * table, uint16_t dest_address);
+
+/**
+ * Change the routing table.
+ * \a update is called on a copy of the current table, which replaces the current table at once if
+ * \a update returns a value >= 0. If another writer publishes meanwhile, \a update is called again
+ * on a copy of the new table. Writers wait for each other, readers never wait.
+ * @param update changes the table, returns < 0 to publish nothing
+ * @param ctx passed to \a update
+ * @return the value returned by \a update, or #CSP_ERR_BUSY if readers kept every old table for too long
+ */
+int csp_rtable_update(int (*update)(csp_rtable_version_t * table, void * ctx), void * ctx);
+
+/**
+ * Set a route in a table being updated, see csp_rtable_set_route().
+ */
+int csp_rtable_version_set(csp_rtable_version_t * table, uint16_t dest_address, int netmask, csp_iface_t * ifc, uint16_t via, uint8_t weight, uint8_t flags);
+
+/**
+ * Remove all routes from a table being updated.
+ * @param table table to clear
+ * @param ctx unused, so it can be passed to csp_rtable_update()
+ * @return #CSP_ERR_NONE
+ */
+int csp_rtable_version_free(csp_rtable_version_t * table, void * ctx);
@@ -7,8 +7,10 @@
 #include <csp/csp_iflist.h>
 #include <csp/interfaces/csp_if_lo.h>
 #include "csp/autoconfig.h"
+#include "csp_rtable_cidr.h"
 
-static int csp_rtable_parse(const char * rtable, int dry_run) {
+/* Parse routes into table, or only check them if table is NULL */
+static int csp_rtable_parse(const char * rtable, csp_rtable_version_t * table) {
 
 	int valid_entries = 0;
 
@@ -22,9 +24,24 @@ static int csp_rtable_parse(const char * rtable, int dry_run) {
 	char * saveptr;
 	char * str = strtok_r(rtable_copy, ",", &saveptr);
 	while ((str) && (strlen(str) > 1)) {
-		unsigned int address, via;
+		unsigned int address, via, weight = 0;
 		int netmask;
 		char name[15];
+
+		/* A trailing weight makes a multipath route, unless it is the interface name */
+		char * weight_str = strrchr(str, ' ');
+		char end;
+		if ((weight_str != NULL) && (sscanf(weight_str, " w%u%c", &weight, &end) == 1)) {
+			*weight_str = 0;
+			if (sscanf(str, "%*s %14s", name) != 1) {
+				*weight_str = ' ';
+				weight = 0;
+			} else if ((weight < 1) || (weight > UINT8_MAX)) {
+				csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+				return CSP_ERR_INVAL;
+			}
+		}
+
 		if (sscanf(str, "%u/%d %14s %u", &address, &netmask, name, &via) == 4) {
 		} else if (sscanf(str, "%u/%d %14s", &address, &netmask, name) == 3) {
 			via = CSP_NO_VIA_ADDRESS;
@@ -45,8 +62,8 @@ static int csp_rtable_parse(const char * rtable, int dry_run) {
 			return CSP_ERR_INVAL;
 		}
 
-		if (dry_run == 0) {
-			int res = csp_rtable_set(address, netmask, ifc, via);
+		if (table != NULL) {
+			int res = csp_rtable_version_set(table, address, netmask, ifc, via, weight, (weight > 0) ? 0 : CSP_ROUTE_REDUNDANT);
 			if (res != CSP_ERR_NONE) {
 				csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
 				return res;
@@ -59,12 +76,25 @@ static int csp_rtable_parse(const char * rtable, int dry_run) {
 	return valid_entries;
 }
 
+static int csp_rtable_load_update(csp_rtable_version_t * table, void * ctx) {
+	return csp_rtable_parse(ctx, table);
+}
+
+static int csp_rtable_reload_update(csp_rtable_version_t * table, void * ctx) {
+	csp_rtable_version_free(table, NULL);
+	return csp_rtable_parse(ctx, table);
+}
+
 int csp_rtable_load(const char * rtable) {
-	return csp_rtable_parse(rtable, 0);
+	return csp_rtable_update(csp_rtable_load_update, (void *)rtable);
+}
+
+int csp_rtable_reload(const char * rtable) {
+	return csp_rtable_update(csp_rtable_reload_update, (void *)rtable);
 }
 
 int csp_rtable_check(const char * rtable) {
-	return csp_rtable_parse(rtable, 1);
+	return csp_rtable_parse(rtable, NULL);
 }
 
 
@@ -98,9 +128,15 @@ static bool csp_rtable_save_route(void * vctx, csp_route_t * route) {
 	} else {
 		via_str[0] = 0;
 	}
+	char weight_str[10];
+	if ((route->flags & CSP_ROUTE_REDUNDANT) == 0) {
+		snprintf(weight_str, sizeof(weight_str), " w%u", route->weight);
+	} else {
+		weight_str[0] = 0;
+	}
 	size_t remain_buf_size = ctx->maxlen - ctx->len;
 	int res = snprintf(ctx->buffer + ctx->len, remain_buf_size,
-					   "%s%u%s %s%s", sep, route->address, mask_str, route->iface->name, via_str);
+					   "%s%u%s %s%s%s", sep, route->address, mask_str, route->iface->name, via_str, weight_str);
 	if ((res < 0) || (res >= (int)(remain_buf_size))) {
 		ctx->error = CSP_ERR_NOMEM;
 		return false;
@@ -7,6 +7,7 @@
 #include <csp/csp_cmp.h>
 #include <endian.h>
 #include <csp/arch/csp_time.h>
+#include <csp/crypto/csp_hmac.h>
 
 int csp_ping(uint16_t node, uint32_t timeout, unsigned int size, uint8_t conn_options) {
 
@@ -26,8 +27,9 @@ int csp_ping(uint16_t node, uint32_t timeout, unsigned int size, uint8_t conn_op
 	if (conn == NULL)
 		return -1;
 
-	/* Prepare data */
-	csp_packet_t * packet = csp_buffer_get(0);
+	/* Prepare data, leaving room for the RDP header and the CRC32 and HMAC trailers */
+	size_t alloc_size = size + CSP_RDP_HEADER_SIZE + sizeof(uint32_t) + CSP_HMAC_LENGTH;
+	csp_packet_t * packet = csp_buffer_get_sized(alloc_size < CSP_BUFFER_SIZE ? alloc_size : CSP_BUFFER_SIZE);
 	if (packet == NULL)
 		goto out;
 
@@ -162,6 +162,9 @@ static void csp_yaml_end_if(struct data_s * data, unsigned int * dfl_addr) {
 	iface->name = strdup(data->name);
 	iface->is_default = (data->is_dfl) ? 1 : 0;
 
+	/* The driver added the interface before its address, netmask and default flag were set */
+	csp_iflist_update();
+
 	csp_print("  %s addr: %u netmask %u %s\n", iface->name, iface->addr, iface->netmask, (iface->is_default) ? "DFL" : "");
 
 }
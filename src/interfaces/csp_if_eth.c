@@ -11,6 +11,7 @@
 #include <unistd.h>
 
 #include <csp/csp.h>
+#include <csp/csp_crc32.h>
 #include <csp/csp_id.h>
 #include <csp/csp_interface.h>
 
@@ -209,7 +210,7 @@ int csp_eth_rx(csp_iface_t * iface, csp_eth_header_t * eth_frame, uint32_t recei
         return CSP_ERR_INVAL;
     }
 
-    memcpy(packet->frame_begin + packet->rx_count, eth_frame->frame_begin, seg_size);
+    csp_crc32_copy_frame(packet, packet->rx_count, eth_frame->frame_begin, seg_size);
     packet->rx_count += seg_size;
 
     /* Send packet when fully received */
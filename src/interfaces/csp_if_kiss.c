@@ -68,6 +68,20 @@ int csp_kiss_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet, int fr
 	return CSP_ERR_NONE;
 }
 
+/**
+ * Append a received byte to the frame.
+ * The CRC32 of the data follows 4 bytes behind, so it leaves out the CRC32 trailer.
+ */
+static inline void csp_kiss_rx_append(csp_kiss_interface_data_t * ifdata, uint8_t byte) {
+
+	csp_packet_t * packet = ifdata->rx_packet;
+
+	packet->frame_begin[ifdata->rx_length++] = byte;
+	if (ifdata->rx_length > csp_id_get_header_size() + sizeof(uint32_t)) {
+		csp_crc32_update(&packet->rx_crc, &packet->frame_begin[ifdata->rx_length - sizeof(uint32_t) - 1], 1);
+	}
+}
+
 /**
  * Decode received data and eventually route the packet.
  */
@@ -110,6 +124,8 @@ void csp_kiss_rx(csp_iface_t * iface, const uint8_t * buf, size_t len, void * px
 
 				/* Start transfer */
 				csp_id_setup_rx(ifdata->rx_packet);
+				csp_crc32_init(&ifdata->rx_packet->rx_crc);
+				ifdata->rx_packet->rx_crc_valid = 0;
 				ifdata->rx_length = 0;
 				ifdata->rx_mode = KISS_MODE_STARTED;
 				ifdata->rx_first = true;
@@ -137,6 +153,10 @@ void csp_kiss_rx(csp_iface_t * iface, const uint8_t * buf, size_t len, void * px
 					if (ifdata->rx_length > 0) {
 
 						ifdata->rx_packet->frame_length = ifdata->rx_length;
+						if (ifdata->rx_length >= csp_id_get_header_size() + sizeof(uint32_t)) {
+							ifdata->rx_packet->rx_crc = csp_crc32_final(&ifdata->rx_packet->rx_crc);
+							ifdata->rx_packet->rx_crc_valid = 1;
+						}
 						if (csp_id_strip(ifdata->rx_packet) < 0) {
 							iface->frame++;
 							ifdata->rx_mode = KISS_MODE_NOT_STARTED;
@@ -168,7 +188,7 @@ void csp_kiss_rx(csp_iface_t * iface, const uint8_t * buf, size_t len, void * px
 				}
 
 				/* Valid data char */
-				ifdata->rx_packet->frame_begin[ifdata->rx_length++] = inputbyte;
+				csp_kiss_rx_append(ifdata, inputbyte);
 
 				break;
 
@@ -183,11 +203,11 @@ void csp_kiss_rx(csp_iface_t * iface, const uint8_t * buf, size_t len, void * px
 
 				/* Escaped escape char */
 				if (inputbyte == TFESC)
-					ifdata->rx_packet->frame_begin[ifdata->rx_length++] = FESC;
+					csp_kiss_rx_append(ifdata, FESC);
 
 				/* Escaped fend char */
 				if (inputbyte == TFEND)
-					ifdata->rx_packet->frame_begin[ifdata->rx_length++] = FEND;
+					csp_kiss_rx_append(ifdata, FEND);
 
 				/* Go back to started mode */
 				ifdata->rx_mode = KISS_MODE_STARTED;
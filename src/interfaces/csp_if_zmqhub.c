@@ -7,6 +7,7 @@
 #include <stdlib.h>
 
 #include <csp/csp.h>
+#include <csp/csp_crc32.h>
 #include <csp/csp_debug.h>
 #include <pthread.h>
 
@@ -139,8 +140,8 @@ static void * csp_zmqhub_task(void * param) {
 
 		csp_id_setup_rx(packet);
 
-		memcpy(packet->frame_begin, rx_data, datalen);
 		packet->frame_length = datalen;
+		csp_crc32_copy_frame(packet, 0, rx_data, datalen);
 
 		/* Parse the frame and strip the ID field */
 		if (csp_id_strip_fixup_cspv1(packet) != 0) {
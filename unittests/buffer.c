@@ -1,6 +1,12 @@
 #include <check.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include "../include/csp/csp.h"
 #include "../include/csp/csp_id.h"
+#include "../include/csp/csp_debug.h"
+#if (CSP_BUFFER_DYNAMIC)
+#include "../src/arch/posix/csp_buffer_arena.h"
+#endif
 
 #define CSP_ID2_HEADER_SIZE 6
 
@@ -67,6 +73,182 @@ START_TEST(test_clone_frame_begin_fixed)
 }
 END_TEST
 
+START_TEST(test_remaining_and_reserve)
+{
+	csp_packet_t * packets[CSP_BUFFER_COUNT];
+
+	csp_init();
+
+	ck_assert_int_eq(csp_buffer_remaining(), CSP_BUFFER_COUNT);
+
+	/* csp_buffer_get() must leave the reserve untouched */
+	unsigned int count = 0;
+	while ((packets[count] = csp_buffer_get(0)) != NULL) {
+		count++;
+		ck_assert_int_eq(csp_buffer_remaining(), CSP_BUFFER_COUNT - count);
+	}
+	ck_assert_int_eq(count, CSP_BUFFER_COUNT - CSP_BUFFER_RESERVE);
+
+	/* The reserve is still available to csp_buffer_get_always() */
+	for (unsigned int i = 0; i < CSP_BUFFER_RESERVE; i++) {
+		packets[count++] = csp_buffer_get_always();
+	}
+	ck_assert_int_eq(csp_buffer_remaining(), 0);
+
+	for (unsigned int i = 0; i < count; i++) {
+		csp_buffer_free(packets[i]);
+	}
+	ck_assert_int_eq(csp_buffer_remaining(), CSP_BUFFER_COUNT);
+}
+END_TEST
+
+START_TEST(test_get_sized)
+{
+	csp_init();
+
+	ck_assert_ptr_null(csp_buffer_get_sized(CSP_BUFFER_SIZE + 1));
+
+	csp_packet_t * small = csp_buffer_get_sized(8);
+	ck_assert_ptr_nonnull(small);
+	ck_assert_int_ge(csp_buffer_data_size(small), 8);
+	ck_assert_int_eq(small->length, 0);
+
+	memcpy(small->data, "ping", 5);
+	small->length = 5;
+
+	/* A clone keeps the capacity of the original */
+	csp_packet_t * clone = csp_buffer_clone(small);
+	ck_assert_ptr_nonnull(clone);
+	ck_assert_int_eq(csp_buffer_data_size(clone), csp_buffer_data_size(small));
+	ck_assert_mem_eq(clone->data, "ping", 5);
+
+	csp_packet_t * full = csp_buffer_get_sized(CSP_BUFFER_SIZE);
+	ck_assert_ptr_nonnull(full);
+	ck_assert_int_eq(csp_buffer_data_size(full), CSP_BUFFER_SIZE);
+
+	/* Copying a packet into a smaller buffer keeps the capacity of the smaller buffer */
+	full->length = 5;
+	csp_buffer_copy(full, small);
+	ck_assert_int_eq(csp_buffer_data_size(small), csp_buffer_data_size(clone));
+
+	csp_buffer_free(small);
+	csp_buffer_free(clone);
+	csp_buffer_free(full);
+	ck_assert_int_eq(csp_buffer_remaining(), CSP_BUFFER_COUNT);
+}
+END_TEST
+
+START_TEST(test_data_size_unpooled)
+{
+	csp_init();
+
+	/* Packets not allocated by CSP have a full data area */
+	csp_packet_t * packet = calloc(1, sizeof(*packet));
+	ck_assert_ptr_nonnull(packet);
+	ck_assert_int_eq(csp_buffer_data_size(packet), CSP_BUFFER_SIZE);
+
+	/* A class that was never set cannot make the packet larger */
+	packet->size_class = 0xFF;
+	ck_assert_int_eq(csp_buffer_data_size(packet), CSP_BUFFER_SIZE);
+
+	free(packet);
+}
+END_TEST
+
+static csp_packet_t * freed_packets[CSP_BUFFER_COUNT];
+static pthread_barrier_t freed_barrier;
+
+/* Frees buffers it did not allocate, and stays alive until told to exit */
+static void * free_elsewhere(void * arg) {
+	(void)arg;
+	for (unsigned int i = 0; i < CSP_BUFFER_COUNT; i++) {
+		csp_buffer_free(freed_packets[i]);
+	}
+	pthread_barrier_wait(&freed_barrier);
+	pthread_barrier_wait(&freed_barrier);
+	return NULL;
+}
+
+START_TEST(test_free_on_other_thread)
+{
+	csp_init();
+
+	for (unsigned int i = 0; i < CSP_BUFFER_COUNT; i++) {
+		freed_packets[i] = csp_buffer_get_always();
+	}
+
+	pthread_t thread;
+	pthread_barrier_init(&freed_barrier, NULL, 2);
+	ck_assert_int_eq(pthread_create(&thread, NULL, free_elsewhere, NULL), 0);
+	pthread_barrier_wait(&freed_barrier);
+
+	/* Every buffer is free again, wherever it was freed */
+	ck_assert_int_eq(csp_buffer_remaining(), CSP_BUFFER_COUNT);
+	for (unsigned int i = 0; i < CSP_BUFFER_COUNT; i++) {
+		freed_packets[i] = csp_buffer_get_always();
+	}
+	ck_assert_int_eq(csp_buffer_remaining(), 0);
+	for (unsigned int i = 0; i < CSP_BUFFER_COUNT; i++) {
+		csp_buffer_free(freed_packets[i]);
+	}
+
+	pthread_barrier_wait(&freed_barrier);
+	pthread_join(thread, NULL);
+	pthread_barrier_destroy(&freed_barrier);
+	ck_assert_int_eq(csp_buffer_remaining(), CSP_BUFFER_COUNT);
+}
+END_TEST
+
+#if (CSP_BUFFER_DYNAMIC) && (CSP_BUFFER_MAGAZINE_SIZE == 0)
+START_TEST(test_arena_release)
+{
+	/* Room for a few arenas, each holds thousands of buffers */
+	const unsigned int count = 40000;
+	csp_conf.buffer_count = count;
+	csp_init();
+	ck_assert_int_eq(csp_buffer_arena_mapped(), 0);
+
+	csp_packet_t ** packets = malloc(count * sizeof(*packets));
+	ck_assert_ptr_nonnull(packets);
+
+	/* Grow into a third arena */
+	unsigned int n = 0;
+	while ((n < count) && (csp_buffer_arena_mapped() < 3)) {
+		packets[n] = csp_buffer_get(0);
+		ck_assert_ptr_nonnull(packets[n]);
+		n++;
+	}
+	ck_assert_int_eq(csp_buffer_arena_mapped(), 3);
+
+	/* Only one idle arena is kept once everything is freed */
+	for (unsigned int i = 0; i < n; i++) {
+		csp_buffer_free(packets[i]);
+	}
+	ck_assert_int_eq(csp_buffer_arena_mapped(), 1);
+	ck_assert_int_eq(csp_buffer_remaining(), count);
+
+	/* Freeing a packet of a released arena again is caught, not a fault */
+	csp_dbg_errno = 0;
+	csp_buffer_free(packets[n - 1]);
+	ck_assert_int_eq(csp_dbg_errno, CSP_DBG_ERR_CORRUPT_BUFFER);
+	ck_assert_int_eq(csp_buffer_remaining(), count);
+
+	/* And grows again */
+	for (unsigned int i = 0; i < n; i++) {
+		packets[i] = csp_buffer_get(0);
+		ck_assert_ptr_nonnull(packets[i]);
+	}
+	ck_assert_int_eq(csp_buffer_arena_mapped(), 3);
+	for (unsigned int i = 0; i < n; i++) {
+		csp_buffer_free(packets[i]);
+	}
+
+	free(packets);
+	csp_conf.buffer_count = 0;
+}
+END_TEST
+#endif
+
 Suite * buffer_suite(void)
 {
 	Suite *s;
@@ -77,6 +259,13 @@ Suite * buffer_suite(void)
 	tc_alloc = tcase_create("allocate");
 	tcase_add_test(tc_alloc, test_alloc_clean_734);
 	tcase_add_test(tc_alloc, test_clone_frame_begin_fixed);
+	tcase_add_test(tc_alloc, test_remaining_and_reserve);
+	tcase_add_test(tc_alloc, test_get_sized);
+	tcase_add_test(tc_alloc, test_data_size_unpooled);
+	tcase_add_test(tc_alloc, test_free_on_other_thread);
+#if (CSP_BUFFER_DYNAMIC) && (CSP_BUFFER_MAGAZINE_SIZE == 0)
+	tcase_add_test(tc_alloc, test_arena_release);
+#endif
 	suite_add_tcase(s, tc_alloc);
 
 	return s;
@@ -0,0 +1,215 @@
+#include <check.h>
+#include "../include/csp/csp.h"
+#include "../include/csp/interfaces/csp_if_lo.h"
+#include "../include/csp/csp_debug.h"
+#include "../include/csp/csp_id.h"
+#if (CSP_CONN_DYNAMIC)
+#include "../src/arch/posix/csp_conn_slab.h"
+#endif
+
+#define SERVER_PORT 11
+#define CLIENTS 4
+#define FLOWS 3
+
+static void inject(uint16_t src, uint8_t sport, uint8_t dport, uint8_t value) {
+
+	csp_packet_t * packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	packet->id.pri = CSP_PRIO_NORM;
+	packet->id.src = src;
+	packet->id.dst = 0;
+	packet->id.sport = sport;
+	packet->id.dport = dport;
+	packet->data[0] = value;
+	packet->length = 1;
+	csp_qfifo_write(packet, &csp_if_lo, NULL);
+}
+
+static void route_all(void) {
+	/* The router sleeps until the next packet, so only run it while packets are queued */
+	csp_qfifo_stats_t stats;
+	for (int prio = CSP_PRIO_CRITICAL; prio <= CSP_PRIO_LOW; prio++) {
+		while ((csp_qfifo_get_stats(prio, &stats) == CSP_ERR_NONE) && (stats.depth > 0)) {
+			csp_route_work();
+		}
+	}
+}
+
+START_TEST(test_conn_lookup)
+{
+	static csp_socket_t sock = {0};
+	csp_conn_t * client[CLIENTS];
+
+	csp_init();
+	ck_assert_int_eq(csp_bind(&sock, SERVER_PORT), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_listen(&sock, 10), CSP_ERR_NONE);
+
+	for (int i = 0; i < CLIENTS; i++) {
+		client[i] = csp_connect(CSP_PRIO_NORM, 5, 7, 0, CSP_O_NONE);
+		ck_assert_ptr_nonnull(client[i]);
+	}
+
+	/* Replies are matched to clients by destination port only */
+	for (int i = CLIENTS - 1; i >= 0; i--) {
+		inject(5 + i, 7 + i, csp_conn_dport(client[i]), i);
+	}
+
+	/* Requests are matched to server connections by source and both ports */
+	for (int round = 0; round < 2; round++) {
+		for (int j = 0; j < FLOWS; j++) {
+			inject(20 + j, 30, SERVER_PORT, j);
+		}
+	}
+	route_all();
+
+	for (int i = 0; i < CLIENTS; i++) {
+		csp_packet_t * packet = csp_read(client[i], 0);
+		ck_assert_ptr_nonnull(packet);
+		ck_assert_int_eq(packet->data[0], i);
+		csp_buffer_free(packet);
+		ck_assert_ptr_null(csp_read(client[i], 0));
+		csp_close(client[i]);
+	}
+
+	for (int j = 0; j < FLOWS; j++) {
+		csp_conn_t * conn = csp_accept(&sock, 0);
+		ck_assert_ptr_nonnull(conn);
+		ck_assert_int_eq(csp_conn_src(conn), 20 + j);
+		for (int round = 0; round < 2; round++) {
+			csp_packet_t * packet = csp_read(conn, 0);
+			ck_assert_ptr_nonnull(packet);
+			ck_assert_int_eq(packet->data[0], j);
+			csp_buffer_free(packet);
+		}
+		csp_close(conn);
+	}
+	ck_assert_ptr_null(csp_accept(&sock, 0));
+
+	/* Closed connections no longer match */
+	inject(5, 7, csp_conn_dport(client[0]), 0);
+	route_all();
+	ck_assert_int_eq(csp_buffer_remaining(), CSP_BUFFER_COUNT);
+
+	csp_socket_close(&sock);
+}
+END_TEST
+
+START_TEST(test_conn_ports)
+{
+	const unsigned int ports = csp_id_get_max_port() - CSP_PORT_MAX_BIND;
+	csp_conn_t * client[ports + 1];
+	unsigned int count = 0;
+
+	csp_init();
+	csp_dbg_errno = 0;
+
+	/* Every client gets an outgoing port of its own, until connections or ports run out */
+	while ((count <= ports) && ((client[count] = csp_connect(CSP_PRIO_NORM, 5, 7, 0, CSP_O_NONE)) != NULL)) {
+		int port = csp_conn_dport(client[count]);
+		ck_assert_int_gt(port, CSP_PORT_MAX_BIND);
+		ck_assert_int_le(port, (int)csp_id_get_max_port());
+		for (unsigned int i = 0; i < count; i++) {
+			ck_assert_int_ne(csp_conn_dport(client[i]), port);
+		}
+		count++;
+	}
+	ck_assert_int_gt(count, 0);
+	ck_assert_int_le(count, ports);
+	if (count == ports) {
+		ck_assert_int_eq(csp_dbg_errno, CSP_DBG_ERR_PORTS_EXHAUSTED);
+	}
+
+	/* A port given back is not reused by the next connection */
+	int port = csp_conn_dport(client[0]);
+	csp_close(client[0]);
+	client[0] = csp_connect(CSP_PRIO_NORM, 5, 7, 0, CSP_O_NONE);
+	ck_assert_ptr_nonnull(client[0]);
+	if (count < ports) {
+		ck_assert_int_ne(csp_conn_dport(client[0]), port);
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		csp_close(client[i]);
+	}
+}
+END_TEST
+
+#if (CSP_CONN_DYNAMIC)
+START_TEST(test_conn_slab_grow)
+{
+	/* Incoming connections hold no outgoing port, so there can be more than one chunk of them */
+	static csp_socket_t sock = {0};
+	const unsigned int count = 100;
+	csp_conn_t * server[count];
+
+	csp_conf.conn_max = 128;
+	csp_init();
+	ck_assert_int_eq(csp_bind(&sock, SERVER_PORT), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_listen(&sock, 4), CSP_ERR_NONE);
+
+	/* Listening again replaces the queue, with room for a whole batch */
+	ck_assert_int_eq(csp_listen(&sock, 10), CSP_ERR_NONE);
+
+	for (unsigned int i = 0; i < count; i += 10) {
+		for (unsigned int j = i; j < i + 10; j++) {
+			inject(20 + j, 30, SERVER_PORT, j);
+		}
+		route_all();
+		for (unsigned int j = i; j < i + 10; j++) {
+			server[j] = csp_accept(&sock, 0);
+			ck_assert_ptr_nonnull(server[j]);
+			ck_assert_int_eq(csp_conn_src(server[j]), 20 + j);
+			csp_packet_t * packet = csp_read(server[j], 0);
+			ck_assert_ptr_nonnull(packet);
+			ck_assert_int_eq(packet->data[0], j);
+			csp_buffer_free(packet);
+		}
+	}
+	ck_assert_int_gt(csp_conn_slab_slots(), 64);
+
+	/* Every connection in a slot of its own */
+	for (unsigned int i = 0; i < count; i++) {
+		for (unsigned int j = 0; j < i; j++) {
+			ck_assert_ptr_ne(server[i], server[j]);
+		}
+	}
+
+	/* Connections left queued to the socket are closed with it */
+	inject(10, 30, SERVER_PORT, 0);
+	route_all();
+	csp_socket_close(&sock);
+	ck_assert_int_eq(csp_buffer_remaining(), CSP_BUFFER_COUNT);
+
+	for (unsigned int i = 0; i < count; i++) {
+		csp_close(server[i]);
+	}
+
+	/* Re-initializing releases the slots and their queues */
+	csp_conf.conn_max = 0;
+	csp_init();
+	ck_assert_int_eq(csp_conn_slab_slots(), 0);
+}
+END_TEST
+#endif
+
+Suite * conn_suite(void)
+{
+	Suite *s;
+	TCase *tc_lookup;
+	TCase *tc_ports;
+
+	s = suite_create("Connection");
+
+	tc_lookup = tcase_create("lookup");
+	tcase_add_test(tc_lookup, test_conn_lookup);
+	suite_add_tcase(s, tc_lookup);
+
+	tc_ports = tcase_create("ports");
+	tcase_add_test(tc_ports, test_conn_ports);
+#if (CSP_CONN_DYNAMIC)
+	tcase_add_test(tc_ports, test_conn_slab_grow);
+#endif
+	suite_add_tcase(s, tc_ports);
+
+	return s;
+}
@@ -0,0 +1,166 @@
+#include <check.h>
+#include <endian.h>
+#include <string.h>
+#include "../include/csp/csp.h"
+#include "../include/csp/csp_id.h"
+#include "../include/csp/csp_crc32.h"
+#include "../src/csp_crc32.h"
+
+static const char * kernels[] = {"table", "slice8", "sse4.2", "armv8"};
+
+/* One bit at a time, straight from the polynomial */
+static uint32_t crc32_bitwise(const uint8_t * data, uint32_t length) {
+
+	uint32_t crc = 0xFFFFFFFF;
+	while (length--) {
+		crc ^= *data++;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+		}
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+START_TEST(test_crc32_kernels)
+{
+	uint8_t data[300];
+	for (unsigned int i = 0; i < sizeof(data); i++) {
+		data[i] = (i * 131) ^ (i >> 3);
+	}
+
+	for (unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		if (csp_crc32_select(kernels[k]) == NULL) {
+			/* Not built or not supported by this CPU */
+			continue;
+		}
+
+		/* Castagnoli check value */
+		ck_assert_int_eq(csp_crc32_memory("123456789", 9), 0xE3069283);
+
+		/* Every alignment and every tail length */
+		for (unsigned int offset = 0; offset < 8; offset++) {
+			for (unsigned int length = 0; length + offset <= sizeof(data); length += 1 + length / 16) {
+				ck_assert_int_eq(csp_crc32_memory(data + offset, length), crc32_bitwise(data + offset, length));
+			}
+		}
+
+		/* Same result in chunks */
+		csp_crc32_t crc;
+		csp_crc32_init(&crc);
+		csp_crc32_update(&crc, data, 3);
+		csp_crc32_update(&crc, data + 3, 100);
+		csp_crc32_update(&crc, data + 103, sizeof(data) - 103);
+		ck_assert_int_eq(csp_crc32_final(&crc), crc32_bitwise(data, sizeof(data)));
+	}
+
+	ck_assert_ptr_nonnull(csp_crc32_select(NULL));
+	ck_assert_ptr_null(csp_crc32_select("none"));
+}
+END_TEST
+
+START_TEST(test_crc32_packet)
+{
+	csp_init();
+
+	csp_packet_t * packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	packet->id = (csp_id_t){.pri = CSP_PRIO_NORM, .src = 1, .dst = 2, .dport = 10, .sport = 20, .flags = CSP_FCRC32};
+	for (unsigned int i = 0; i < 100; i++) {
+		packet->data[i] = i;
+	}
+	packet->length = 100;
+
+	ck_assert_int_eq(csp_crc32_append(packet), CSP_ERR_NONE);
+	ck_assert_int_eq(packet->length, 104);
+	ck_assert_int_eq(csp_crc32_verify(packet), CSP_ERR_NONE);
+	ck_assert_int_eq(packet->length, 100);
+
+	packet->length = 104;
+	packet->data[50] ^= 1;
+	ck_assert_int_eq(csp_crc32_verify(packet), CSP_ERR_CRC32);
+
+	csp_buffer_free(packet);
+}
+END_TEST
+
+START_TEST(test_crc32_copy_frame)
+{
+	csp_init();
+
+	/* Frame of a packet with CRC32 */
+	csp_packet_t * packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	packet->id = (csp_id_t){.pri = CSP_PRIO_NORM, .src = 1, .dst = 2, .dport = 10, .sport = 20, .flags = CSP_FCRC32};
+	for (unsigned int i = 0; i < 100; i++) {
+		packet->data[i] = i * 7;
+	}
+	packet->length = 100;
+	ck_assert_int_eq(csp_crc32_append(packet), CSP_ERR_NONE);
+	csp_id_prepend(packet);
+	uint8_t frame[200];
+	uint16_t frame_length = packet->frame_length;
+	memcpy(frame, packet->frame_begin, frame_length);
+	csp_buffer_free(packet);
+
+	/* Received in one or more segments, split anywhere */
+	for (unsigned int segment = 1; segment <= frame_length; segment += 1 + segment / 4) {
+		packet = csp_buffer_get(0);
+		ck_assert_ptr_nonnull(packet);
+		csp_id_setup_rx(packet);
+		packet->frame_length = frame_length;
+		for (unsigned int offset = 0; offset < frame_length; offset += segment) {
+			unsigned int length = (frame_length - offset < segment) ? frame_length - offset : segment;
+			csp_crc32_copy_frame(packet, offset, &frame[offset], length);
+		}
+		ck_assert_int_eq(memcmp(packet->frame_begin, frame, frame_length), 0);
+		ck_assert_int_eq(csp_id_strip(packet), 0);
+
+		ck_assert_int_eq(packet->rx_crc_valid, 1);
+		ck_assert_int_eq(packet->rx_crc, csp_crc32_memory(packet->data, packet->length - sizeof(uint32_t)));
+		ck_assert_int_eq(csp_crc32_verify(packet), CSP_ERR_NONE);
+		ck_assert_int_eq(packet->length, 100);
+		ck_assert_int_eq(packet->rx_crc_valid, 0);
+		csp_buffer_free(packet);
+	}
+
+	/* A CRC32 over the header is still accepted */
+	packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	packet->id = (csp_id_t){.pri = CSP_PRIO_NORM, .src = 1, .dst = 2, .dport = 10, .sport = 20, .flags = CSP_FCRC32};
+	memset(packet->data, 0x55, 50);
+	packet->length = 50;
+	csp_id_prepend(packet);
+	uint32_t crc = htobe32(csp_crc32_memory(packet->frame_begin, packet->frame_length));
+	memcpy(&packet->data[50], &crc, sizeof(crc));
+	packet->length += sizeof(crc);
+	csp_id_prepend(packet);
+	frame_length = packet->frame_length;
+	memcpy(frame, packet->frame_begin, frame_length);
+
+	csp_id_setup_rx(packet);
+	packet->frame_length = frame_length;
+	csp_crc32_copy_frame(packet, 0, frame, frame_length);
+	ck_assert_int_eq(csp_id_strip(packet), 0);
+	ck_assert_int_eq(packet->rx_crc_valid, 1);
+	ck_assert_int_eq(csp_crc32_verify(packet), CSP_ERR_NONE);
+	ck_assert_int_eq(packet->length, 50);
+
+	csp_buffer_free(packet);
+}
+END_TEST
+
+Suite * crc32_suite(void)
+{
+	Suite *s;
+	TCase *tc_crc32;
+
+	s = suite_create("CRC32");
+
+	tc_crc32 = tcase_create("crc32");
+	tcase_add_test(tc_crc32, test_crc32_kernels);
+	tcase_add_test(tc_crc32, test_crc32_packet);
+	tcase_add_test(tc_crc32, test_crc32_copy_frame);
+	suite_add_tcase(s, tc_crc32);
+
+	return s;
+}
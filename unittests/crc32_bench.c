@@ -0,0 +1,82 @@
+/* CRC32 benchmark
+ *
+ * Checksums buffers of several sizes with every CRC32 implementation built in and supported by
+ * the CPU, and checks they all agree with the byte table.
+ *
+ * Usage: csp_crc32_bench [MiB per run]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+
+#include "../src/csp_crc32.h"
+
+static const char * kernels[] = {"table", "slice8", "sse4.2", "armv8"};
+static const uint32_t sizes[] = {16, 64, 256, 4096};
+static unsigned int mib = 64;
+
+static uint8_t data[4096 + 8];
+
+static double elapsed(const struct timespec * start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+
+	if (argc > 1) mib = atoi(argv[1]);
+
+	for (unsigned int i = 0; i < sizeof(data); i++) {
+		data[i] = rand();
+	}
+
+	uint32_t expected[sizeof(sizes) / sizeof(sizes[0])];
+	int failed = 0;
+
+	printf("%-8s", "");
+	for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		printf(" %8" PRIu32 " B", sizes[s]);
+	}
+	printf("   (MB/s)\n");
+
+	for (unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		if (csp_crc32_select(kernels[k]) == NULL) {
+			continue;
+		}
+
+		printf("%-8s", kernels[k]);
+		for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			uint64_t rounds = ((uint64_t)mib << 20) / sizes[s];
+			uint32_t sum = 0;
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (uint64_t r = 0; r < rounds; r++) {
+				/* Start on a different alignment each time */
+				sum ^= csp_crc32_memory(&data[r & 7], sizes[s]);
+			}
+			double secs = elapsed(&start);
+			printf(" %10.0f", rounds * sizes[s] / secs / 1e6);
+			fflush(stdout);
+
+			if (k == 0) {
+				expected[s] = sum;
+			} else if (sum != expected[s]) {
+				failed = 1;
+			}
+		}
+		printf("\n");
+	}
+
+	if (failed) {
+		printf("FAILED: implementations disagree\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
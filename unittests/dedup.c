@@ -0,0 +1,114 @@
+#include <check.h>
+#include <unistd.h>
+#include "../include/csp/csp.h"
+#include "../include/csp/interfaces/csp_if_lo.h"
+#include "../include/csp/csp_debug.h"
+
+#define PORT 12
+#define LENGTH 20
+
+static csp_socket_t sock = {.opts = CSP_SO_CONN_LESS};
+
+/* Route one packet to the socket, returns 1 if delivered */
+static int deliver(uint8_t sport, uint8_t value) {
+
+	csp_packet_t * packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	packet->id.pri = CSP_PRIO_NORM;
+	packet->id.src = 5;
+	packet->id.dst = 0;
+	packet->id.sport = sport;
+	packet->id.dport = PORT;
+	for (int i = 0; i < LENGTH; i++) {
+		packet->data[i] = i;
+	}
+	/* Packets differ in the last byte only */
+	packet->data[LENGTH - 1] = value;
+	packet->length = LENGTH;
+	csp_qfifo_write(packet, &csp_if_lo, NULL);
+	csp_route_work();
+
+	packet = csp_recvfrom(&sock, 0);
+	if (packet == NULL) {
+		return 0;
+	}
+	ck_assert_int_eq(packet->data[LENGTH - 1], value);
+	csp_buffer_free(packet);
+	return 1;
+}
+
+START_TEST(test_dedup_window)
+{
+	csp_conf.dedup = CSP_DEDUP_ALL;
+	csp_conf.dedup_window_ms = 50;
+	csp_init();
+	ck_assert_int_eq(csp_bind(&sock, PORT), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_listen(&sock, 0), CSP_ERR_NONE);
+
+	ck_assert_int_eq(deliver(30, 1), 1);
+	ck_assert_int_eq(deliver(30, 1), 0);
+	ck_assert_int_eq(deliver(30, 2), 1);
+	ck_assert_int_eq(deliver(31, 1), 1);
+	ck_assert_int_eq(csp_dbg_dedup_hit, 1);
+	ck_assert_int_eq(csp_dbg_dedup_miss, 3);
+
+	/* Out of the window */
+	usleep(100 * 1000);
+	ck_assert_int_eq(deliver(30, 1), 1);
+	ck_assert_int_eq(csp_dbg_dedup_hit, 1);
+
+	csp_socket_close(&sock);
+	csp_conf.dedup = CSP_DEDUP_OFF;
+	csp_conf.dedup_window_ms = 0;
+}
+END_TEST
+
+START_TEST(test_dedup_count)
+{
+	/* More packets in between than the 16 remembered before */
+	csp_conf.dedup = CSP_DEDUP_ALL;
+	csp_init();
+	ck_assert_int_eq(csp_bind(&sock, PORT), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_listen(&sock, 0), CSP_ERR_NONE);
+
+	ck_assert_int_eq(deliver(30, 0), 1);
+	for (int i = 1; i <= 24; i++) {
+		ck_assert_int_eq(deliver(30, i), 1);
+	}
+	ck_assert_int_eq(deliver(30, 0), 0);
+	ck_assert_int_eq(csp_dbg_dedup_hit, 1);
+
+	/* Remember as few packets as possible */
+	csp_socket_close(&sock);
+	csp_conf.dedup_count = 1;
+	csp_init();
+	ck_assert_int_eq(csp_bind(&sock, PORT), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_listen(&sock, 0), CSP_ERR_NONE);
+
+	ck_assert_int_eq(deliver(30, 0), 1);
+	for (int i = 1; i <= 4; i++) {
+		ck_assert_int_eq(deliver(30, i), 1);
+	}
+	ck_assert_int_eq(deliver(30, 0), 1);
+	ck_assert_int_eq(csp_dbg_dedup_hit, 0);
+
+	csp_socket_close(&sock);
+	csp_conf.dedup = CSP_DEDUP_OFF;
+	csp_conf.dedup_count = 0;
+}
+END_TEST
+
+Suite * dedup_suite(void)
+{
+	Suite *s;
+	TCase *tc_dedup;
+
+	s = suite_create("Deduplication");
+
+	tc_dedup = tcase_create("dedup");
+	tcase_add_test(tc_dedup, test_dedup_window);
+	tcase_add_test(tc_dedup, test_dedup_count);
+	suite_add_tcase(s, tc_dedup);
+
+	return s;
+}
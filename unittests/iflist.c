@@ -0,0 +1,150 @@
+#include <check.h>
+#include <stdio.h>
+#include "../include/csp/csp.h"
+#include "../include/csp/csp_id.h"
+#include "../include/csp/csp_iflist.h"
+
+#define IFACES 20
+
+static csp_iface_t ifaces[IFACES];
+static char names[IFACES][8];
+
+/* Same answers as walking the list */
+static void check_lookups(int count) {
+
+	for (unsigned int addr = 0; addr <= csp_id_get_max_nodeid(); addr += 7) {
+		csp_iface_t * expect = NULL;
+		for (csp_iface_t * ifc = csp_iflist_get(); ifc != NULL; ifc = ifc->next) {
+			if (ifc->addr == addr) {
+				expect = ifc;
+				break;
+			}
+		}
+		ck_assert_ptr_eq(csp_iflist_get_by_addr(addr), expect);
+
+		csp_iface_t * found = NULL;
+		for (csp_iface_t * ifc = csp_iflist_get(); ifc != NULL; ifc = ifc->next) {
+			if ((ifc->netmask != 0) && csp_iflist_is_within_subnet(addr, ifc)) {
+				found = csp_iflist_get_by_subnet(addr, found);
+				ck_assert_ptr_eq(found, ifc);
+			}
+		}
+		ck_assert_ptr_null(csp_iflist_get_by_subnet(addr, found));
+	}
+
+	csp_iface_t * dfl = NULL;
+	for (int i = 0; i < count; i++) {
+		if (ifaces[i].is_default) {
+			dfl = csp_iflist_get_by_isdfl(dfl);
+			ck_assert_ptr_eq(dfl, &ifaces[i]);
+		}
+	}
+	ck_assert_ptr_null(csp_iflist_get_by_isdfl(dfl));
+}
+
+START_TEST(test_iflist_index)
+{
+	/* Up to and past the size of the index */
+	for (int i = 0; i < IFACES; i++) {
+		snprintf(names[i], sizeof(names[i]), "IF%d", i);
+		ifaces[i] = (csp_iface_t){
+			.name = names[i],
+			.addr = (i * 977) & csp_id_get_max_nodeid(),
+			.netmask = (i % 3) * 4,
+			.is_default = (i % 4) == 1,
+		};
+		if (i == 5) {
+			/* Shares an address with an interface added before */
+			ifaces[i].addr = ifaces[2].addr;
+		}
+		csp_iflist_add(&ifaces[i]);
+		check_lookups(i + 1);
+	}
+
+	for (int i = IFACES - 1; i >= 0; i--) {
+		csp_iflist_remove(&ifaces[i]);
+		check_lookups(i);
+	}
+}
+END_TEST
+
+static int sent;
+
+static int count_nexthop(csp_iface_t * iface, uint16_t via, csp_packet_t * packet, int from_me) {
+	(void)iface;
+	(void)via;
+	(void)from_me;
+	sent++;
+	csp_buffer_free(packet);
+	return CSP_ERR_NONE;
+}
+
+START_TEST(test_iflist_update)
+{
+	csp_iface_t ifc = {.name = "UPD", .addr = 100, .netmask = 8};
+	csp_iflist_add(&ifc);
+	ck_assert_ptr_eq(csp_iflist_get_by_addr(100), &ifc);
+	ck_assert_ptr_null(csp_iflist_get_by_isdfl(NULL));
+
+	ifc.addr = 200;
+	ifc.is_default = 1;
+	csp_iflist_update();
+	ck_assert_ptr_null(csp_iflist_get_by_addr(100));
+	ck_assert_ptr_eq(csp_iflist_get_by_addr(200), &ifc);
+	ck_assert_ptr_eq(csp_iflist_get_by_isdfl(NULL), &ifc);
+
+	csp_iflist_remove(&ifc);
+	ck_assert_ptr_null(csp_iflist_get_by_addr(200));
+	ck_assert_ptr_null(csp_iflist_get_by_isdfl(NULL));
+}
+END_TEST
+
+START_TEST(test_iflist_setup_after_add)
+{
+	csp_init();
+
+	/* Drivers add the interface, the application sets it up after */
+	csp_iface_t ifc = {.name = "LATE", .nexthop = count_nexthop};
+	csp_iflist_add(&ifc);
+	ck_assert_ptr_null(csp_iflist_get_by_isdfl(NULL));
+	ifc.addr = 1;
+	ifc.is_default = 1;
+	csp_iflist_update();
+	ck_assert_ptr_eq(csp_iflist_get_by_addr(1), &ifc);
+	ck_assert_ptr_eq(csp_iflist_get_by_isdfl(NULL), &ifc);
+
+	sent = 0;
+	csp_packet_t * packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	packet->length = 1;
+	csp_sendto(CSP_PRIO_NORM, 5, 10, 20, 0, packet);
+	ck_assert_int_eq(sent, 1);
+
+	/* Sent elsewhere once no longer default */
+	ifc.is_default = 0;
+	csp_iflist_update();
+	packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	packet->length = 1;
+	csp_sendto(CSP_PRIO_NORM, 5, 10, 20, 0, packet);
+	ck_assert_int_eq(sent, 1);
+
+	csp_iflist_remove(&ifc);
+}
+END_TEST
+
+Suite * iflist_suite(void)
+{
+	Suite *s;
+	TCase *tc_index;
+
+	s = suite_create("Interface list");
+
+	tc_index = tcase_create("index");
+	tcase_add_test(tc_index, test_iflist_index);
+	tcase_add_test(tc_index, test_iflist_update);
+	tcase_add_test(tc_index, test_iflist_setup_after_add);
+	suite_add_tcase(s, tc_index);
+
+	return s;
+}
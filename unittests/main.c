@@ -8,6 +8,12 @@
 Suite * queue_suite(void);
 Suite * buffer_suite(void);
 Suite * hmac_suite(void);
+Suite * conn_suite(void);
+Suite * rtable_suite(void);
+Suite * iflist_suite(void);
+Suite * dedup_suite(void);
+Suite * crc32_suite(void);
+Suite * rdp_suite(void);
 
 static struct option long_options[] = {
     {"verbose", no_argument, 0, 'V'},
@@ -49,6 +55,12 @@ int main(int argc, char *argv[])
 	srunner_add_suite(sr, queue_suite());
 	srunner_add_suite(sr, buffer_suite());
 	srunner_add_suite(sr, hmac_suite());
+	srunner_add_suite(sr, conn_suite());
+	srunner_add_suite(sr, rtable_suite());
+	srunner_add_suite(sr, iflist_suite());
+	srunner_add_suite(sr, dedup_suite());
+	srunner_add_suite(sr, crc32_suite());
+	srunner_add_suite(sr, rdp_suite());
 
 	srunner_run_all(sr, print_verbosity);
 	number_failed = srunner_ntests_failed(sr);
@@ -1,5 +1,9 @@
 #include <check.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "../include/csp/csp.h"
+#include "../include/csp/arch/csp_time.h"
+#include "../include/csp/interfaces/csp_if_lo.h"
 
 #define DEFAULT_TIMEOUT 1000
 
@@ -31,6 +35,194 @@ START_TEST(test_queue_free_707)
 }
 END_TEST
 
+static void * delayed_enqueue(void * arg)
+{
+	int value = 42;
+	usleep(20 * 1000);
+	csp_queue_enqueue(arg, &value, DEFAULT_TIMEOUT);
+	return NULL;
+}
+
+START_TEST(test_queue_order_and_timeout)
+{
+	int qlength = 3;
+	int value;
+
+	csp_queue_handle_t qh;
+	csp_static_queue_t q;
+
+	qh = csp_queue_create_static(qlength, sizeof(int), NULL, &q);
+	ck_assert_ptr_nonnull(qh);
+
+	/* Wrap around a few times, items come out in order */
+	for (int i = 0; i < 10; i++) {
+		ck_assert_int_eq(csp_queue_enqueue(qh, &i, 0), CSP_QUEUE_OK);
+		ck_assert_int_eq(csp_queue_enqueue(qh, &i, 0), CSP_QUEUE_OK);
+		ck_assert_int_eq(csp_queue_size(qh), 2);
+		ck_assert_int_eq(csp_queue_dequeue(qh, &value, 0), CSP_QUEUE_OK);
+		ck_assert_int_eq(value, i);
+		ck_assert_int_eq(csp_queue_dequeue(qh, &value, 0), CSP_QUEUE_OK);
+		ck_assert_int_eq(value, i);
+	}
+
+	/* Full queue times out */
+	for (int i = 0; i < qlength; i++) {
+		ck_assert_int_eq(csp_queue_enqueue(qh, &i, 0), CSP_QUEUE_OK);
+	}
+	uint32_t start = csp_get_ms();
+	ck_assert_int_eq(csp_queue_enqueue(qh, &value, 10), CSP_QUEUE_ERROR);
+	ck_assert_int_ge(csp_get_ms() - start, 10);
+	ck_assert_int_eq(csp_queue_free(qh), 0);
+
+	/* Empty queue times out */
+	csp_queue_empty(qh);
+	ck_assert_int_eq(csp_queue_size(qh), 0);
+	start = csp_get_ms();
+	ck_assert_int_eq(csp_queue_dequeue(qh, &value, 10), CSP_QUEUE_ERROR);
+	ck_assert_int_ge(csp_get_ms() - start, 10);
+
+	/* Blocked reader is woken by a writer */
+	pthread_t thread;
+	ck_assert_int_eq(pthread_create(&thread, NULL, delayed_enqueue, qh), 0);
+	ck_assert_int_eq(csp_queue_dequeue(qh, &value, CSP_MAX_TIMEOUT), CSP_QUEUE_OK);
+	ck_assert_int_eq(value, 42);
+	pthread_join(thread, NULL);
+}
+END_TEST
+
+START_TEST(test_queue_many)
+{
+	int qlength = 5;
+	int in[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+	int out[8];
+
+	csp_queue_handle_t qh;
+	csp_static_queue_t q;
+
+	qh = csp_queue_create_static(qlength, sizeof(int), NULL, &q);
+	ck_assert_ptr_nonnull(qh);
+
+	/* Only what fits is added */
+	ck_assert_int_eq(csp_queue_enqueue_many(qh, in, 3, 0), 3);
+	ck_assert_int_eq(csp_queue_enqueue_many(qh, &in[3], 5, 0), 2);
+	ck_assert_int_eq(csp_queue_enqueue_many(qh, in, 1, 10), 0);
+	ck_assert_int_eq(csp_queue_size(qh), qlength);
+
+	/* Partial read, then the rest, in order */
+	ck_assert_int_eq(csp_queue_dequeue_many(qh, out, 2, 0), 2);
+	ck_assert_int_eq(csp_queue_enqueue_many(qh, &in[5], 3, 0), 2);
+	ck_assert_int_eq(csp_queue_dequeue_many(qh, &out[2], 8, 0), qlength);
+	for (int i = 0; i < 7; i++) {
+		ck_assert_int_eq(out[i], i);
+	}
+
+	/* Empty queue times out */
+	ck_assert_int_eq(csp_queue_dequeue_many(qh, out, 8, 10), 0);
+}
+END_TEST
+
+static void route_all(void) {
+	/* The router sleeps until the next packet, so only run it while packets are queued */
+	csp_qfifo_stats_t stats;
+	for (int prio = CSP_PRIO_CRITICAL; prio <= CSP_PRIO_LOW; prio++) {
+		while ((csp_qfifo_get_stats(prio, &stats) == CSP_ERR_NONE) && (stats.depth > 0)) {
+			csp_route_work();
+		}
+	}
+}
+
+START_TEST(test_qfifo_priority)
+{
+	const csp_prio_t prios[] = {CSP_PRIO_LOW, CSP_PRIO_NORM, CSP_PRIO_LOW, CSP_PRIO_CRITICAL};
+	static csp_socket_t sock = {.opts = CSP_SO_CONN_LESS};
+	csp_qfifo_stats_t stats;
+
+	csp_init();
+	ck_assert_int_eq(csp_bind(&sock, 10), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_listen(&sock, 10), CSP_ERR_NONE);
+
+	for (unsigned int i = 0; i < sizeof(prios) / sizeof(prios[0]); i++) {
+		csp_packet_t * packet = csp_buffer_get(0);
+		ck_assert_ptr_nonnull(packet);
+		packet->id.pri = prios[i];
+		packet->id.dst = 0;
+		packet->id.dport = 10;
+		packet->data[0] = i;
+		packet->length = 1;
+		csp_qfifo_write(packet, &csp_if_lo, NULL);
+	}
+
+	ck_assert_int_eq(csp_qfifo_get_stats(CSP_PRIO_LOW, &stats), CSP_ERR_NONE);
+#if (CSP_USE_QOS)
+	ck_assert_int_eq(stats.depth, 2);
+	/* Highest priority first, FIFO within a level */
+	const uint8_t expected[] = {3, 1, 0, 2};
+#else
+	ck_assert_int_eq(stats.depth, 4);
+	const uint8_t expected[] = {0, 1, 2, 3};
+#endif
+	ck_assert_int_eq(csp_qfifo_get_stats(CSP_PRIO_LOW + 1, &stats), CSP_ERR_INVAL);
+
+	route_all();
+
+	for (unsigned int i = 0; i < sizeof(expected); i++) {
+		csp_packet_t * packet = csp_recvfrom(&sock, 0);
+		ck_assert_ptr_nonnull(packet);
+		ck_assert_int_eq(packet->data[0], expected[i]);
+		csp_buffer_free(packet);
+	}
+	ck_assert_ptr_null(csp_recvfrom(&sock, 0));
+
+#if (CSP_USE_QOS)
+	/* Weighted policy interleaves levels by weight */
+	const uint8_t weights[] = {1, 1, 1, 1};
+	const csp_prio_t weighted[] = {CSP_PRIO_CRITICAL, CSP_PRIO_CRITICAL, CSP_PRIO_LOW, CSP_PRIO_LOW};
+	csp_qfifo_set_policy(CSP_QFIFO_WEIGHTED, weights);
+	for (unsigned int i = 0; i < sizeof(weighted) / sizeof(weighted[0]); i++) {
+		csp_packet_t * packet = csp_buffer_get(0);
+		ck_assert_ptr_nonnull(packet);
+		packet->id.pri = weighted[i];
+		packet->id.dst = 0;
+		packet->id.dport = 10;
+		packet->data[0] = i;
+		packet->length = 1;
+		csp_qfifo_write(packet, &csp_if_lo, NULL);
+	}
+	route_all();
+	const uint8_t interleaved[] = {0, 2, 1, 3};
+	for (unsigned int i = 0; i < sizeof(interleaved); i++) {
+		csp_packet_t * packet = csp_recvfrom(&sock, 0);
+		ck_assert_ptr_nonnull(packet);
+		ck_assert_int_eq(packet->data[0], interleaved[i]);
+		csp_buffer_free(packet);
+	}
+	csp_qfifo_set_policy(CSP_QFIFO_STRICT, NULL);
+#endif
+
+	/* A full level drops, and is counted against the priority of the dropped packet. The same
+	 * buffer is queued repeatedly, so the test does not depend on the buffer count. */
+	ck_assert_int_eq(csp_qfifo_get_stats(CSP_PRIO_LOW, &stats), CSP_ERR_NONE);
+	uint32_t drops = stats.drops;
+	csp_packet_t * packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	packet->id.pri = CSP_PRIO_LOW;
+	for (unsigned int i = 0; i < CSP_QFIFO_LEN; i++) {
+		csp_buffer_refc_inc(packet);
+	}
+	for (unsigned int i = 0; i <= CSP_QFIFO_LEN; i++) {
+		csp_qfifo_write(packet, &csp_if_lo, NULL);
+	}
+	ck_assert_int_eq(csp_qfifo_get_stats(CSP_PRIO_LOW, &stats), CSP_ERR_NONE);
+	ck_assert_int_eq(stats.drops, drops + 1);
+	ck_assert_int_eq(stats.depth, CSP_QFIFO_LEN);
+
+	route_all();
+	ck_assert_int_eq(csp_buffer_remaining(), CSP_BUFFER_COUNT);
+
+	csp_socket_close(&sock);
+}
+END_TEST
+
 Suite * queue_suite(void)
 {
 	Suite *s;
@@ -40,6 +232,9 @@ Suite * queue_suite(void)
 
 	tc_free = tcase_create("free");
 	tcase_add_test(tc_free, test_queue_free_707);
+	tcase_add_test(tc_free, test_queue_order_and_timeout);
+	tcase_add_test(tc_free, test_queue_many);
+	tcase_add_test(tc_free, test_qfifo_priority);
 	suite_add_tcase(s, tc_free);
 
 	return s;
@@ -0,0 +1,143 @@
+/* Queue contention benchmark
+ *
+ * Several producers push into one queue drained by one or more consumers, the way interface rx
+ * threads feed the router qfifo. Build once with the default queue backend and once with
+ * CSP_QUEUE_LOCKFREE to compare.
+ *
+ * Usage: csp_queue_bench [producers] [consumers] [items per producer] [queue length]
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_queue.h>
+
+static csp_queue_handle_t queue;
+static unsigned int producers = 4;
+static unsigned int consumers = 1;
+static uint32_t items = 1000000;
+static int qlength = 64;
+
+static atomic_uint_fast64_t received;
+static atomic_uint_fast64_t checksum;
+static atomic_uint out_of_order;
+
+#define STOP UINT64_MAX
+
+static void * producer(void * arg) {
+
+	uint64_t id = (uintptr_t)arg;
+
+	for (uint32_t i = 0; i < items; i++) {
+		uint64_t item = (id << 32) | i;
+		csp_queue_enqueue(queue, &item, CSP_MAX_TIMEOUT);
+	}
+
+	return NULL;
+}
+
+static void * consumer(void * arg) {
+
+	(void)arg;
+	uint32_t * next = calloc(producers, sizeof(uint32_t));
+	uint64_t count = 0;
+	uint64_t sum = 0;
+
+	for (;;) {
+		uint64_t item;
+		if (csp_queue_dequeue(queue, &item, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK) {
+			continue;
+		}
+		if (item == STOP) {
+			break;
+		}
+
+		/* With a single consumer, items from each producer must arrive in order */
+		uint32_t id = item >> 32;
+		uint32_t seq = item & 0xFFFFFFFF;
+		if ((consumers == 1) && (seq != next[id])) {
+			atomic_fetch_add(&out_of_order, 1);
+		}
+		next[id] = seq + 1;
+
+		count++;
+		sum += item;
+	}
+
+	atomic_fetch_add(&received, count);
+	atomic_fetch_add(&checksum, sum);
+	free(next);
+
+	return NULL;
+}
+
+static double elapsed(const struct timespec * start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+
+	if (argc > 1) producers = atoi(argv[1]);
+	if (argc > 2) consumers = atoi(argv[2]);
+	if (argc > 3) items = atoi(argv[3]);
+	if (argc > 4) qlength = atoi(argv[4]);
+
+	if ((producers == 0) || (consumers == 0) || (qlength <= 0)) {
+		printf("Usage: %s [producers] [consumers] [items per producer] [queue length]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	queue = csp_queue_create_static(qlength, sizeof(uint64_t), NULL, NULL);
+	if (queue == NULL) {
+		printf("Failed to create queue\n");
+		return EXIT_FAILURE;
+	}
+
+	pthread_t prod[producers];
+	pthread_t cons[consumers];
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (unsigned int i = 0; i < consumers; i++) {
+		pthread_create(&cons[i], NULL, consumer, NULL);
+	}
+	for (unsigned int i = 0; i < producers; i++) {
+		pthread_create(&prod[i], NULL, producer, (void *)(uintptr_t)i);
+	}
+	for (unsigned int i = 0; i < producers; i++) {
+		pthread_join(prod[i], NULL);
+	}
+	for (unsigned int i = 0; i < consumers; i++) {
+		uint64_t stop = STOP;
+		csp_queue_enqueue(queue, &stop, CSP_MAX_TIMEOUT);
+	}
+	for (unsigned int i = 0; i < consumers; i++) {
+		pthread_join(cons[i], NULL);
+	}
+
+	double secs = elapsed(&start);
+
+	/* Every producer sends ids (p << 32) | 0 .. items - 1 */
+	uint64_t total = (uint64_t)producers * items;
+	uint64_t expected = 0;
+	for (uint64_t p = 0; p < producers; p++) {
+		expected += (p << 32) * items + (uint64_t)items * (items - 1) / 2;
+	}
+
+	printf("%u producers, %u consumers, queue length %d: %" PRIu64 " items in %.3f s, %.2f Mitems/s\n",
+		   producers, consumers, qlength, total, secs, total / secs / 1e6);
+
+	if ((atomic_load(&received) != total) || (atomic_load(&checksum) != expected) || (atomic_load(&out_of_order) != 0)) {
+		printf("FAILED: received %" PRIu64 ", out of order %u\n", (uint64_t)atomic_load(&received), atomic_load(&out_of_order));
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,487 @@
+#include <check.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "../include/csp/csp.h"
+#include "../include/csp/interfaces/csp_if_lo.h"
+
+#define PORT 15
+#define ADDR 10
+#define SEGMENTS 16
+
+/* RDP header, at the end of the data of every RDP packet */
+#define RDP_HEADER_SIZE 5
+#define RDP_SYN 0x08
+#define RDP_ACK 0x04
+#define RDP_EAK 0x02
+#define RDP_RST 0x01
+
+/* An RDP packet seen by the lossy interface */
+typedef struct {
+	bool from_client;
+	uint8_t flags;
+	uint16_t seq_nr;
+	uint16_t ack_nr;
+	unsigned int length;       //!< Data length without the RDP header
+	unsigned int segment;      //!< Index of a client data segment, from 0
+	unsigned int transmission; //!< Times this segment or ACK number was seen before
+} lossy_packet_t;
+
+/* Returns true to drop the packet */
+static bool (*lossy_drop)(const lossy_packet_t * seen);
+
+static atomic_uint data_sent[SEGMENTS];
+static atomic_uint acks_sent[SEGMENTS];
+static uint16_t data_seq;
+static bool data_seen;
+
+static atomic_uint events;
+
+static csp_socket_t sock = {.opts = CSP_SO_RDPREQ};
+static atomic_bool routing;
+static pthread_t router;
+
+/* Both ends of the connection are on this node, each packet passes here on its way back in */
+static int lossy_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet, int from_me);
+
+static csp_iface_t lossy = {.name = "LOSSY", .addr = ADDR, .netmask = 8, .nexthop = lossy_tx};
+
+static int lossy_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet, int from_me) {
+	(void)iface;
+	(void)via;
+	(void)from_me;
+
+	if (packet->length < RDP_HEADER_SIZE) {
+		csp_qfifo_write(packet, &lossy, NULL);
+		return CSP_ERR_NONE;
+	}
+
+	const uint8_t * header = &packet->data[packet->length - RDP_HEADER_SIZE];
+	lossy_packet_t seen = {
+		.from_client = (packet->id.dport == PORT),
+		.flags = header[0] & 0x0F,
+		.seq_nr = (header[1] << 8) | header[2],
+		.ack_nr = (header[3] << 8) | header[4],
+		.length = packet->length - RDP_HEADER_SIZE,
+	};
+
+	/* Data of the client, and plain ACKs of the server, counted by segment */
+	if (seen.from_client && (seen.length > 0) && !(seen.flags & (RDP_SYN | RDP_RST | RDP_EAK))) {
+		if (!data_seen) {
+			data_seq = seen.seq_nr;
+			data_seen = true;
+		}
+		seen.segment = (uint16_t)(seen.seq_nr - data_seq);
+		if (seen.segment < SEGMENTS) {
+			seen.transmission = atomic_fetch_add(&data_sent[seen.segment], 1);
+		}
+	} else if (!seen.from_client && data_seen && (seen.length == 0) && (seen.flags == RDP_ACK)) {
+		seen.segment = (uint16_t)(seen.ack_nr - data_seq);
+		if (seen.segment < SEGMENTS) {
+			seen.transmission = atomic_fetch_add(&acks_sent[seen.segment], 1);
+		}
+	} else {
+		seen.segment = SEGMENTS;
+	}
+
+	if ((lossy_drop != NULL) && lossy_drop(&seen)) {
+		csp_buffer_free(packet);
+		return CSP_ERR_NONE;
+	}
+
+	csp_qfifo_write(packet, &lossy, NULL);
+	return CSP_ERR_NONE;
+}
+
+static void * route(void * arg) {
+	(void)arg;
+	while (atomic_load(&routing)) {
+		csp_route_work();
+	}
+	return NULL;
+}
+
+/* Listen on the lossy interface, with the router on its own thread */
+static void rdp_start(void) {
+
+	for (unsigned int i = 0; i < SEGMENTS; i++) {
+		atomic_store(&data_sent[i], 0);
+		atomic_store(&acks_sent[i], 0);
+	}
+	data_seen = false;
+	atomic_store(&events, 0);
+
+	csp_init();
+	csp_iflist_add(&lossy);
+	ck_assert_int_eq(csp_bind(&sock, PORT), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_listen(&sock, 1), CSP_ERR_NONE);
+
+	atomic_store(&routing, true);
+	ck_assert_int_eq(pthread_create(&router, NULL, route, NULL), 0);
+}
+
+/* Connect to ourselves over the lossy interface */
+static void rdp_open(csp_conn_t ** client, csp_conn_t ** server) {
+
+	rdp_start();
+
+	*client = csp_connect(CSP_PRIO_NORM, ADDR, PORT, 1000, CSP_O_RDP);
+	ck_assert_ptr_nonnull(*client);
+	*server = csp_accept(&sock, 1000);
+	ck_assert_ptr_nonnull(*server);
+}
+
+static void rdp_close(csp_conn_t * client, csp_conn_t * server) {
+
+	csp_close(client);
+	csp_close(server);
+
+	/* Wake the router with a packet for a port nobody listens on */
+	atomic_store(&routing, false);
+	csp_packet_t * packet = csp_buffer_get_always();
+	packet->id.pri = CSP_PRIO_NORM;
+	packet->id.dst = 0;
+	packet->id.dport = PORT + 1;
+	packet->length = 0;
+	csp_qfifo_write(packet, &csp_if_lo, NULL);
+	pthread_join(router, NULL);
+
+	csp_socket_close(&sock);
+	csp_iflist_remove(&lossy);
+	lossy_drop = NULL;
+	csp_rdp_set_opt(4, 10000, 1000, 1, 250, 2);
+}
+
+static void send_data(csp_conn_t * conn, uint32_t first, uint32_t count) {
+	for (uint32_t i = first; i < first + count; i++) {
+		csp_packet_t * packet = csp_buffer_get(sizeof(uint32_t));
+		ck_assert_ptr_nonnull(packet);
+		packet->data32[0] = i;
+		packet->length = sizeof(uint32_t);
+		csp_send(conn, packet);
+	}
+}
+
+static void read_data(csp_conn_t * conn, uint32_t first, uint32_t count) {
+	for (uint32_t i = first; i < first + count; i++) {
+		csp_packet_t * packet = csp_read(conn, 2000);
+		ck_assert_ptr_nonnull(packet);
+		ck_assert_int_eq(packet->length, sizeof(uint32_t));
+		ck_assert_int_eq(packet->data32[0], i);
+		csp_buffer_free(packet);
+	}
+}
+
+/* Lose the first transmission of segments 1 and 3 */
+static bool drop_segments_1_3(const lossy_packet_t * seen) {
+	return seen->from_client && ((seen->segment == 1) || (seen->segment == 3)) && (seen->transmission == 0);
+}
+
+START_TEST(test_rdp_fast_retransmit)
+{
+	/* Retransmission timeout far above the time it takes to return three EACKs */
+	csp_rdp_set_opt(6, 10000, 1000, 1, 500, 1);
+
+	csp_conn_t * client, * server;
+	rdp_open(&client, &server);
+	lossy_drop = drop_segments_1_3;
+
+	send_data(client, 0, 6);
+	read_data(server, 0, 6);
+
+	/* Segments 2, 4 and 5 were reported by EACK, and only the missing ones sent again */
+	for (unsigned int i = 0; i < 6; i++) {
+		ck_assert_int_eq(atomic_load(&data_sent[i]), ((i == 1) || (i == 3)) ? 2 : 1);
+	}
+
+	csp_rdp_stats_t stats;
+	ck_assert_int_eq(csp_rdp_get_stats(client, &stats), CSP_ERR_NONE);
+	ck_assert_int_eq(stats.fast_retransmits, 2);
+	ck_assert_int_eq(stats.retransmits, 2);
+
+	rdp_close(client, server);
+}
+END_TEST
+
+/* Lose the first ACK of the first segment */
+static bool drop_first_ack(const lossy_packet_t * seen) {
+	return !seen->from_client && (seen->segment == 0) && (seen->transmission == 0);
+}
+
+START_TEST(test_rdp_lost_ack)
+{
+	csp_rdp_set_opt(4, 10000, 1000, 0, 250, 2);
+
+	csp_conn_t * client, * server;
+	rdp_open(&client, &server);
+	lossy_drop = drop_first_ack;
+
+	send_data(client, 0, 1);
+	read_data(server, 0, 1);
+
+	/* The segment times out and is sent again, and the server acknowledges it again */
+	for (unsigned int i = 0; (i < 200) && (atomic_load(&acks_sent[0]) < 2); i++) {
+		usleep(10 * 1000);
+	}
+	ck_assert_int_ge(atomic_load(&data_sent[0]), 2);
+	ck_assert_int_ge(atomic_load(&acks_sent[0]), 2);
+
+	/* Delivered once */
+	ck_assert_ptr_null(csp_read(server, 0));
+
+	csp_rdp_stats_t stats;
+	ck_assert_int_eq(csp_rdp_get_stats(client, &stats), CSP_ERR_NONE);
+	ck_assert_int_ge(stats.retransmits, 1);
+	ck_assert_int_eq(stats.fast_retransmits, 0);
+
+	rdp_close(client, server);
+}
+END_TEST
+
+/* Lose everything the server sends */
+static bool drop_server(const lossy_packet_t * seen) {
+	return !seen->from_client;
+}
+
+static void record_events(csp_conn_t * conn, unsigned int flags, void * arg) {
+	(void)conn;
+	(void)arg;
+	atomic_fetch_or(&events, flags);
+}
+
+static bool wait_events(unsigned int flags) {
+	for (unsigned int i = 0; (i < 300) && ((atomic_load(&events) & flags) != flags); i++) {
+		usleep(10 * 1000);
+	}
+	return (atomic_load(&events) & flags) == flags;
+}
+
+START_TEST(test_rdp_send_nonblock)
+{
+	csp_conn_t * client, * server;
+	rdp_open(&client, &server);
+	ck_assert_int_eq(csp_rdp_set_event_callback(client, record_events, NULL), CSP_ERR_NONE);
+
+	/* Fill the window while no ACK comes back */
+	lossy_drop = drop_server;
+	for (uint32_t i = 0; i < 4; i++) {
+		csp_packet_t * packet = csp_buffer_get(sizeof(uint32_t));
+		ck_assert_ptr_nonnull(packet);
+		packet->data32[0] = i;
+		packet->length = sizeof(uint32_t);
+		ck_assert_int_eq(csp_send_nonblock(client, packet), CSP_ERR_NONE);
+	}
+
+	/* The packet that does not fit is left to the caller as it was */
+	csp_packet_t * packet = csp_buffer_get(sizeof(uint32_t));
+	ck_assert_ptr_nonnull(packet);
+	packet->data32[0] = 4;
+	packet->length = sizeof(uint32_t);
+	ck_assert_int_eq(csp_send_nonblock(client, packet), CSP_ERR_AGAIN);
+	ck_assert_int_eq(packet->length, sizeof(uint32_t));
+	ck_assert_int_eq(packet->data32[0], 4);
+	ck_assert_int_eq(atomic_load(&events), 0);
+
+	/* The ACK of a retransmission opens the window */
+	lossy_drop = NULL;
+	ck_assert(wait_events(CSP_RDP_EVENT_WRITABLE | CSP_RDP_EVENT_ACKED));
+	ck_assert_int_eq(csp_send_nonblock(client, packet), CSP_ERR_NONE);
+	read_data(server, 0, 5);
+
+	/* Reset by the server */
+	csp_close(server);
+	ck_assert(wait_events(CSP_RDP_EVENT_CLOSED));
+	packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	ck_assert_int_eq(csp_send_nonblock(client, packet), CSP_ERR_RESET);
+	csp_buffer_free(packet);
+
+	rdp_close(client, NULL);
+}
+END_TEST
+
+/* Lose the client's ACK that completes the handshake, once */
+static atomic_bool handshake_dropped;
+static bool drop_handshake_ack(const lossy_packet_t * seen) {
+	return seen->from_client && (seen->flags == RDP_ACK) && (seen->length == 0) && !atomic_exchange(&handshake_dropped, true);
+}
+
+START_TEST(test_rdp_socket_close_pending)
+{
+	rdp_start();
+	atomic_store(&handshake_dropped, false);
+	lossy_drop = drop_handshake_ack;
+
+	/* The server side is still waiting for the handshake when the socket closes */
+	csp_conn_t * client = csp_connect(CSP_PRIO_NORM, ADDR, PORT, 1000, CSP_O_RDP);
+	ck_assert_ptr_nonnull(client);
+	ck_assert(atomic_load(&handshake_dropped));
+	ck_assert_int_eq(csp_rdp_set_event_callback(client, record_events, NULL), CSP_ERR_NONE);
+	csp_socket_close(&sock);
+
+	/* Data would complete the handshake, the server resets the connection instead */
+	lossy_drop = NULL;
+	send_data(client, 0, 1);
+	ck_assert(wait_events(CSP_RDP_EVENT_CLOSED));
+	ck_assert_ptr_null(csp_accept(&sock, 0));
+
+	rdp_close(client, NULL);
+}
+END_TEST
+
+START_TEST(test_rdp_stats)
+{
+	csp_conn_t * client, * server;
+	rdp_open(&client, &server);
+
+	csp_rdp_stats_t stats;
+	ck_assert_int_eq(csp_rdp_get_stats(client, &stats), CSP_ERR_NONE);
+	ck_assert_int_eq(stats.window_size, 4);
+	ck_assert_int_eq(stats.cwnd, 4);
+
+	for (uint32_t i = 0; i < 20; i += 4) {
+		send_data(client, i, 4);
+		read_data(server, i, 4);
+	}
+
+	/* Measured, and allowing for the delayed ACKs of the receiver */
+	ck_assert_int_eq(csp_rdp_get_stats(client, &stats), CSP_ERR_NONE);
+	ck_assert_int_ge(stats.srtt, 1);
+	ck_assert_int_ge(stats.rto, stats.srtt + 250);
+	ck_assert_int_le(stats.rto, 10000);
+	ck_assert_int_eq(stats.cwnd, 4);
+	ck_assert_int_eq(stats.window_size, 4);
+	ck_assert_int_eq(stats.retransmits, 0);
+	ck_assert_int_eq(stats.fast_retransmits, 0);
+
+	/* No connection */
+	ck_assert_int_eq(csp_rdp_get_stats(NULL, &stats), CSP_ERR_INVAL);
+
+	rdp_close(client, server);
+}
+END_TEST
+
+/* Retransmission timeout and congestion window at each transmission of the first segment */
+static csp_conn_t * backoff_conn;
+static csp_rdp_stats_t backoff_stats[4];
+
+/* Lose the first three transmissions of the first segment */
+static bool drop_first_three(const lossy_packet_t * seen) {
+	if (!seen->from_client || (seen->segment != 0)) {
+		return false;
+	}
+	if (seen->transmission < 4) {
+		/* Called from the router, which owns the statistics */
+		csp_rdp_get_stats(backoff_conn, &backoff_stats[seen->transmission]);
+	}
+	return seen->transmission < 3;
+}
+
+START_TEST(test_rdp_timeout_backoff)
+{
+	csp_rdp_set_opt(4, 10000, 1000, 0, 250, 2);
+
+	csp_conn_t * client, * server;
+	rdp_open(&client, &server);
+	backoff_conn = client;
+	lossy_drop = drop_first_three;
+	ck_assert_int_eq(csp_rdp_set_event_callback(client, record_events, NULL), CSP_ERR_NONE);
+
+	send_data(client, 0, 1);
+	read_data(server, 0, 1);
+	ck_assert_int_ge(atomic_load(&data_sent[0]), 4);
+
+	/* Each timeout doubles the retransmission timeout and halves the congestion window */
+	ck_assert_int_eq(backoff_stats[1].rto, backoff_stats[0].rto);
+	ck_assert_int_eq(backoff_stats[2].rto, 2 * backoff_stats[1].rto);
+	ck_assert_int_eq(backoff_stats[3].rto, 2 * backoff_stats[2].rto);
+	ck_assert_int_eq(backoff_stats[1].cwnd, 4);
+	ck_assert_int_eq(backoff_stats[2].cwnd, 2);
+	ck_assert_int_eq(backoff_stats[3].cwnd, 1);
+
+	/* Until the segment gets through */
+	ck_assert(wait_events(CSP_RDP_EVENT_ACKED));
+	csp_rdp_stats_t stats;
+	ck_assert_int_eq(csp_rdp_get_stats(client, &stats), CSP_ERR_NONE);
+	ck_assert_int_lt(stats.rto, backoff_stats[3].rto);
+	ck_assert_int_ge(stats.retransmits, 3);
+	ck_assert_int_eq(stats.fast_retransmits, 0);
+
+	rdp_close(client, server);
+}
+END_TEST
+
+/* A few threads share a connection, as in csp_rdp_bench, sized for the default buffer pool */
+#define SENDERS 2
+#define SENDER_PACKETS 200
+
+typedef struct {
+	csp_conn_t * conn;
+	uint32_t sender;
+} sender_t;
+
+static void * sender(void * arg) {
+	const sender_t * s = arg;
+	for (uint32_t i = 0; i < SENDER_PACKETS; i++) {
+		csp_packet_t * packet;
+		while ((packet = csp_buffer_get(2 * sizeof(uint32_t))) == NULL) {
+			usleep(1000);
+		}
+		packet->data32[0] = s->sender;
+		packet->data32[1] = i;
+		packet->length = 2 * sizeof(uint32_t);
+		csp_send(s->conn, packet);
+	}
+	return NULL;
+}
+
+START_TEST(test_rdp_senders)
+{
+	csp_conn_t * client, * server;
+	rdp_open(&client, &server);
+
+	pthread_t threads[SENDERS];
+	sender_t args[SENDERS];
+	for (uint32_t i = 0; i < SENDERS; i++) {
+		args[i] = (sender_t){.conn = client, .sender = i};
+		ck_assert_int_eq(pthread_create(&threads[i], NULL, sender, &args[i]), 0);
+	}
+
+	/* Every packet once, in order per sender */
+	uint32_t next[SENDERS] = {0};
+	for (uint32_t n = 0; n < SENDERS * SENDER_PACKETS; n++) {
+		csp_packet_t * packet = csp_read(server, 2000);
+		ck_assert_ptr_nonnull(packet);
+		ck_assert_int_lt(packet->data32[0], SENDERS);
+		ck_assert_int_eq(packet->data32[1], next[packet->data32[0]]++);
+		csp_buffer_free(packet);
+	}
+
+	for (uint32_t i = 0; i < SENDERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	rdp_close(client, server);
+}
+END_TEST
+
+Suite * rdp_suite(void)
+{
+	Suite *s;
+	TCase *tc_rdp;
+
+	s = suite_create("RDP");
+
+	tc_rdp = tcase_create("rdp");
+	tcase_set_timeout(tc_rdp, 30);
+	tcase_add_test(tc_rdp, test_rdp_fast_retransmit);
+	tcase_add_test(tc_rdp, test_rdp_lost_ack);
+	tcase_add_test(tc_rdp, test_rdp_send_nonblock);
+	tcase_add_test(tc_rdp, test_rdp_socket_close_pending);
+	tcase_add_test(tc_rdp, test_rdp_stats);
+	tcase_add_test(tc_rdp, test_rdp_timeout_backoff);
+	tcase_add_test(tc_rdp, test_rdp_senders);
+	suite_add_tcase(s, tc_rdp);
+
+	return s;
+}
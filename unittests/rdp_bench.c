@@ -0,0 +1,202 @@
+/* RDP connection stress test and benchmark
+ *
+ * Several sender threads share each RDP connection over the loopback interface, some changing
+ * the connection priority as they go, while the router runs on its own workers and a reader
+ * thread per connection checks that the packets of every sender arrive complete and in order.
+ * Exits with failure if any packet is lost or out of order, or if the buffer pool is too small
+ * for the connections and senders asked for.
+ *
+ * Usage: csp_rdp_bench [workers] [connections] [senders per connection] [packets per sender]
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <csp/csp.h>
+
+#define BENCH_PORT 10
+#define BENCH_READ_TIMEOUT 5000
+
+static unsigned int workers = 1;
+static unsigned int connections = 2;
+static unsigned int senders = 4;
+static uint32_t packets = 2000;
+
+static csp_socket_t sock = {.opts = CSP_SO_RDPREQ};
+
+static atomic_uint_fast64_t received;
+static atomic_uint_fast64_t misordered;
+
+typedef struct {
+	csp_conn_t * conn;
+	uint32_t sender;
+} bench_sender_t;
+
+static void * sender(void * arg) {
+
+	const bench_sender_t * s = arg;
+
+	for (uint32_t i = 0; i < packets; i++) {
+		csp_packet_t * packet;
+		while ((packet = csp_buffer_get(2 * sizeof(uint32_t))) == NULL) {
+			sched_yield();
+		}
+
+		packet->data32[0] = s->sender;
+		packet->data32[1] = i;
+		packet->length = 2 * sizeof(uint32_t);
+
+		/* Odd senders change the connection priority while the others send */
+		if ((s->sender % 2) && ((i % 16) == 0)) {
+			csp_send_prio((i % 32) ? CSP_PRIO_HIGH : CSP_PRIO_NORM, s->conn, packet);
+		} else {
+			csp_send(s->conn, packet);
+		}
+	}
+
+	return NULL;
+}
+
+static void * reader(void * arg) {
+
+	csp_conn_t * conn = arg;
+	uint32_t next[senders];
+	uint64_t count = 0;
+
+	memset(next, 0, sizeof(next));
+
+	while (count < (uint64_t)senders * packets) {
+		csp_packet_t * packet = csp_read(conn, BENCH_READ_TIMEOUT);
+		if (packet == NULL) {
+			break;
+		}
+
+		uint32_t index = packet->data32[0] % senders;
+		if (packet->data32[1] != next[index]) {
+			atomic_fetch_add(&misordered, 1);
+		}
+		next[index] = packet->data32[1] + 1;
+
+		count++;
+		atomic_fetch_add(&received, 1);
+		csp_buffer_free(packet);
+	}
+
+	csp_close(conn);
+	return NULL;
+}
+
+static void * server(void * arg) {
+
+	pthread_t * readers = arg;
+
+	for (unsigned int i = 0; i < connections;) {
+		csp_conn_t * conn = csp_accept(&sock, CSP_MAX_TIMEOUT);
+		if (conn != NULL) {
+			pthread_create(&readers[i++], NULL, reader, conn);
+		}
+	}
+
+	return NULL;
+}
+
+static double elapsed(const struct timespec * start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+
+	if (argc > 1) workers = atoi(argv[1]);
+	if (argc > 2) connections = atoi(argv[2]);
+	if (argc > 3) senders = atoi(argv[3]);
+	if (argc > 4) packets = atoi(argv[4]);
+
+	if ((workers == 0) || (connections == 0) || (senders == 0)) {
+		printf("Usage: %s [workers] [connections] [senders per connection] [packets per sender]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Each sender holds a packet while it waits for the window, and each connection up to a
+	 * window of packets on either end. With fewer buffers, senders and the router starve each
+	 * other and the run stalls on retransmission timeouts. */
+	unsigned int window;
+	csp_rdp_get_opt(&window, NULL, NULL, NULL, NULL, NULL);
+	unsigned int buffers = connections * (senders + 2 * window) + CSP_BUFFER_RESERVE;
+
+	/* Both ends of every connection, only used with CSP_CONN_DYNAMIC */
+	csp_conf.conn_max = 2 * connections;
+	/* Only used with CSP_BUFFER_DYNAMIC */
+	csp_conf.buffer_count = (buffers > CSP_BUFFER_COUNT) ? buffers : CSP_BUFFER_COUNT;
+	csp_init();
+
+	if ((unsigned int)csp_buffer_remaining() < buffers) {
+		printf("%u connections with %u senders each need %u packet buffers, CSP_BUFFER_COUNT is %u\n",
+			   connections, senders, buffers, CSP_BUFFER_COUNT);
+		return EXIT_FAILURE;
+	}
+
+	csp_bind(&sock, BENCH_PORT);
+	csp_listen(&sock, connections);
+
+	if (csp_route_start_workers(workers) != CSP_ERR_NONE) {
+		printf("Failed to start %u router workers, CSP_ROUTE_WORKERS is %u\n", workers, CSP_ROUTE_WORKERS);
+		return EXIT_FAILURE;
+	}
+
+	pthread_t readers[connections];
+	pthread_t accept_thread;
+	pthread_create(&accept_thread, NULL, server, readers);
+
+	csp_conn_t * conns[connections];
+	for (unsigned int i = 0; i < connections; i++) {
+		conns[i] = csp_connect(CSP_PRIO_NORM, 0, BENCH_PORT, 1000, CSP_O_RDP);
+		if (conns[i] == NULL) {
+			printf("Failed to connect, CSP_CONN_MAX is %u\n", CSP_CONN_MAX);
+			return EXIT_FAILURE;
+		}
+	}
+	pthread_join(accept_thread, NULL);
+
+	pthread_t threads[connections][senders];
+	bench_sender_t args[connections][senders];
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (unsigned int i = 0; i < connections; i++) {
+		for (unsigned int j = 0; j < senders; j++) {
+			args[i][j].conn = conns[i];
+			args[i][j].sender = j;
+			pthread_create(&threads[i][j], NULL, sender, &args[i][j]);
+		}
+	}
+	for (unsigned int i = 0; i < connections; i++) {
+		for (unsigned int j = 0; j < senders; j++) {
+			pthread_join(threads[i][j], NULL);
+		}
+	}
+	for (unsigned int i = 0; i < connections; i++) {
+		pthread_join(readers[i], NULL);
+	}
+	double secs = elapsed(&start);
+
+	for (unsigned int i = 0; i < connections; i++) {
+		csp_close(conns[i]);
+	}
+
+	uint64_t total = (uint64_t)connections * senders * packets;
+	uint64_t count = atomic_load(&received);
+	uint64_t errors = atomic_load(&misordered);
+
+	printf("%u workers, %u connections, %u senders each: %" PRIu64 "/%" PRIu64 " packets in %.3f s, %.0f packets/s, %" PRIu64 " out of order\n",
+		   workers, connections, senders, count, total, secs, count / secs, errors);
+
+	return ((count == total) && (errors == 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,121 @@
+/* Router worker benchmark
+ *
+ * Producers inject CRC32 protected packets of many flows into the router input queue, and a
+ * callback port consumes them, so the measured work is the router itself: CRC verification, port
+ * lookup and dispatch. Run with increasing worker counts on a build with CSP_ROUTE_WORKERS set to
+ * the highest count to compare.
+ *
+ * Usage: csp_route_bench [workers] [producers] [packets per producer] [flows]
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+#include <csp/interfaces/csp_if_lo.h>
+
+#define BENCH_PORT 10
+#define BENCH_LENGTH 200
+
+static unsigned int workers = 1;
+static unsigned int producers = 2;
+static uint32_t packets = 200000;
+static unsigned int flows = 64;
+
+static atomic_uint_fast64_t received;
+
+static void bench_callback(csp_packet_t * packet) {
+	atomic_fetch_add(&received, 1);
+	csp_buffer_free(packet);
+}
+
+static void * producer(void * arg) {
+
+	uint16_t src = 1 + (uintptr_t)arg;
+
+	for (uint32_t i = 0; i < packets; i++) {
+		csp_packet_t * packet;
+		while ((packet = csp_buffer_get(BENCH_LENGTH)) == NULL) {
+			sched_yield();
+		}
+
+		memset(packet->data, i, BENCH_LENGTH);
+		packet->length = BENCH_LENGTH;
+		packet->id.pri = CSP_PRIO_NORM;
+		packet->id.flags = CSP_FCRC32;
+		packet->id.src = src;
+		packet->id.dst = 0;
+		packet->id.dport = BENCH_PORT;
+		packet->id.sport = CSP_PORT_MAX_BIND + 1 + (i % flows);
+		csp_crc32_append(packet);
+
+		csp_qfifo_write(packet, &csp_if_lo, NULL);
+	}
+
+	return NULL;
+}
+
+static double elapsed(const struct timespec * start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+
+	if (argc > 1) workers = atoi(argv[1]);
+	if (argc > 2) producers = atoi(argv[2]);
+	if (argc > 3) packets = atoi(argv[3]);
+	if (argc > 4) flows = atoi(argv[4]);
+
+	if ((workers == 0) || (producers == 0) || (flows == 0)) {
+		printf("Usage: %s [workers] [producers] [packets per producer] [flows]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	csp_init();
+	csp_bind_callback(bench_callback, BENCH_PORT);
+
+	if (csp_route_start_workers(workers) != CSP_ERR_NONE) {
+		printf("Failed to start %u router workers, CSP_ROUTE_WORKERS is %u\n", workers, CSP_ROUTE_WORKERS);
+		return EXIT_FAILURE;
+	}
+
+	pthread_t prod[producers];
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (unsigned int i = 0; i < producers; i++) {
+		pthread_create(&prod[i], NULL, producer, (void *)(uintptr_t)i);
+	}
+	for (unsigned int i = 0; i < producers; i++) {
+		pthread_join(prod[i], NULL);
+	}
+
+	/* Packets dropped on a full router queue are never received, wait for the rest */
+	uint64_t total = (uint64_t)producers * packets;
+	uint64_t count = atomic_load(&received);
+	double secs = elapsed(&start);
+	while (count < total) {
+		struct timespec delay = {.tv_nsec = 10000000};
+		nanosleep(&delay, NULL);
+		uint64_t now = atomic_load(&received);
+		if (now == count) {
+			break;
+		}
+		count = now;
+		secs = elapsed(&start);
+	}
+
+	printf("%u workers, %u producers, %u flows: %" PRIu64 "/%" PRIu64 " packets in %.3f s, %.0f packets/s\n",
+		   workers, producers, flows, count, total, secs, count / secs);
+
+	return EXIT_SUCCESS;
+}
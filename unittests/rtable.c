@@ -0,0 +1,354 @@
+#include <check.h>
+#include <string.h>
+#include "../include/csp/csp.h"
+#include "../include/csp/csp_id.h"
+#include "../include/csp/csp_rtable.h"
+
+#if (CSP_USE_RTABLE)
+
+#define IFACES 3
+
+static csp_iface_t ifaces[IFACES] = {{.name = "A"}, {.name = "B"}, {.name = "C"}};
+
+typedef struct {
+	csp_route_t * routes[CSP_RTABLE_SIZE];
+	int count;
+} rtable_copy_t;
+
+static bool copy_route(void * ctx, csp_route_t * route) {
+	rtable_copy_t * copy = ctx;
+	copy->routes[copy->count++] = route;
+	return true;
+}
+
+/* Longest prefix match by scanning every route, the newest one wins between equal prefixes */
+static csp_route_t * find_route_linear(const rtable_copy_t * copy, uint16_t addr) {
+
+	csp_route_t * best = NULL;
+	for (int i = 0; i < copy->count; i++) {
+		csp_route_t * route = copy->routes[i];
+		uint16_t hostbits = (1 << (csp_id_get_host_bits() - route->netmask)) - 1;
+		if (((route->address ^ addr) & ~hostbits) == 0) {
+			if ((best == NULL) || (route->netmask >= best->netmask)) {
+				best = route;
+			}
+		}
+	}
+
+	return best;
+}
+
+static void check_table(void) {
+
+	static rtable_copy_t copy;
+	copy.count = 0;
+	csp_rtable_iterate(copy_route, &copy);
+
+	for (unsigned int addr = 0; addr <= csp_id_get_max_nodeid(); addr++) {
+		csp_route_t * route = csp_rtable_find_route(addr);
+		ck_assert_ptr_eq(route, find_route_linear(&copy, addr));
+		if (route == NULL) {
+			continue;
+		}
+
+		/* Every older route to the same destination, newest first */
+		int i = copy.count - 1;
+		while (copy.routes[i] != route) {
+			i--;
+		}
+		while ((route = csp_rtable_search_backward(route)) != NULL) {
+			do {
+				i--;
+				ck_assert_int_ge(i, 0);
+			} while ((copy.routes[i]->address != route->address) || (copy.routes[i]->netmask != route->netmask));
+			ck_assert_ptr_eq(route, copy.routes[i]);
+		}
+	}
+}
+
+START_TEST(test_rtable_lookup)
+{
+	static rtable_copy_t copy;
+	uint32_t seed = 1;
+
+	csp_rtable_free();
+	ck_assert_ptr_null(csp_rtable_find_route(10));
+
+	copy.count = 0;
+	while (copy.count < CSP_RTABLE_SIZE) {
+		seed = seed * 1103515245 + 12345;
+		uint16_t addr = (seed >> 8) & csp_id_get_max_nodeid();
+		int netmask = (seed >> 24) % (csp_id_get_host_bits() + 1);
+		csp_iface_t * ifc = &ifaces[(seed >> 4) % IFACES];
+
+		/* Some routes share a destination, some only differ from another in host bits */
+		if ((copy.count > 0) && ((seed % 4) == 0)) {
+			const csp_route_t * route = copy.routes[(seed >> 12) % copy.count];
+			addr = route->address ^ ((seed & 8) ? 1 : 0);
+			netmask = route->netmask;
+		}
+
+		ck_assert_int_eq(csp_rtable_set(addr, netmask, ifc, copy.count), CSP_ERR_NONE);
+		check_table();
+
+		copy.count = 0;
+		csp_rtable_iterate(copy_route, &copy);
+	}
+
+	/* A full table still takes new via addresses, but no new routes */
+	const csp_route_t route = *copy.routes[0];
+	ck_assert_int_eq(csp_rtable_set(route.address, route.netmask, route.iface, 100), CSP_ERR_NONE);
+	copy.count = 0;
+	csp_rtable_iterate(copy_route, &copy);
+	ck_assert_int_eq(copy.routes[0]->via, 100);
+	ck_assert_int_eq(csp_rtable_set(route.address, route.netmask, &(csp_iface_t){.name = "D"}, 100), CSP_ERR_NOMEM);
+
+	csp_rtable_free();
+	ck_assert_ptr_null(csp_rtable_find_route(10));
+}
+END_TEST
+
+START_TEST(test_rtable_via)
+{
+	csp_rtable_free();
+
+	ck_assert_int_eq(csp_rtable_set(0, 0, &ifaces[0], CSP_NO_VIA_ADDRESS), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_rtable_set(8, 11, &ifaces[1], 20), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_rtable_set(8, 11, &ifaces[2], 30), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_rtable_set(9, -1, &ifaces[0], CSP_NO_VIA_ADDRESS), CSP_ERR_NONE);
+
+	/* Setting an existing route only changes its via address */
+	ck_assert_int_eq(csp_rtable_set(8, 11, &ifaces[1], 21), CSP_ERR_NONE);
+
+	csp_route_t * route = csp_rtable_find_route(9);
+	ck_assert_ptr_nonnull(route);
+	ck_assert_ptr_eq(route->iface, &ifaces[0]);
+	ck_assert_int_eq(route->netmask, csp_id_get_host_bits());
+
+	route = csp_rtable_find_route(15);
+	ck_assert_ptr_nonnull(route);
+	ck_assert_ptr_eq(route->iface, &ifaces[2]);
+	ck_assert_int_eq(route->via, 30);
+	route = csp_rtable_search_backward(route);
+	ck_assert_ptr_nonnull(route);
+	ck_assert_ptr_eq(route->iface, &ifaces[1]);
+	ck_assert_int_eq(route->via, 21);
+	ck_assert_ptr_null(csp_rtable_search_backward(route));
+
+	route = csp_rtable_find_route(16);
+	ck_assert_ptr_nonnull(route);
+	ck_assert_int_eq(route->netmask, 0);
+	ck_assert_ptr_null(csp_rtable_search_backward(route));
+
+	csp_rtable_free();
+}
+END_TEST
+
+START_TEST(test_rtable_versions)
+{
+	csp_rtable_free();
+	ck_assert_int_eq(csp_rtable_set(10, -1, &ifaces[0], CSP_NO_VIA_ADDRESS), CSP_ERR_NONE);
+
+	/* Changes are published as a new table, routes already looked up are left as they were */
+	csp_route_t * route = csp_rtable_find_route(10);
+	ck_assert_ptr_nonnull(route);
+	ck_assert_int_eq(csp_rtable_set(10, -1, &ifaces[0], 20), CSP_ERR_NONE);
+	ck_assert_int_eq(route->via, CSP_NO_VIA_ADDRESS);
+	ck_assert_int_eq(csp_rtable_find_route(10)->via, 20);
+
+	csp_rtable_clear();
+	ck_assert_int_eq(route->via, CSP_NO_VIA_ADDRESS);
+	ck_assert_ptr_null(csp_rtable_find_route(10));
+
+#if (CSP_HAVE_STDIO)
+	csp_iflist_add(&ifaces[0]);
+	csp_iflist_add(&ifaces[1]);
+
+	/* Loads and reloads are published at once, or not at all */
+	ck_assert_int_eq(csp_rtable_load("10 A, 11 B 5"), 2);
+	ck_assert_int_eq(csp_rtable_load("12 A, 13 X"), CSP_ERR_INVAL);
+	ck_assert_ptr_null(csp_rtable_find_route(12));
+	ck_assert_int_eq(csp_rtable_reload("14 B, 13 X"), CSP_ERR_INVAL);
+	ck_assert_ptr_nonnull(csp_rtable_find_route(10));
+	ck_assert_ptr_null(csp_rtable_find_route(14));
+	ck_assert_int_eq(csp_rtable_reload("14 B, 15/13 A"), 2);
+	ck_assert_ptr_null(csp_rtable_find_route(10));
+	ck_assert_ptr_null(csp_rtable_find_route(11));
+	ck_assert_ptr_eq(csp_rtable_find_route(14)->iface, &ifaces[1]);
+	ck_assert_ptr_eq(csp_rtable_find_route(15)->iface, &ifaces[0]);
+
+	csp_iflist_remove(&ifaces[0]);
+	csp_iflist_remove(&ifaces[1]);
+#endif
+
+	csp_rtable_free();
+}
+END_TEST
+
+#define FLOWS 512
+
+/* Interface each flow was last sent on, for the multipath test */
+static csp_iface_t * flow_iface[FLOWS];
+static unsigned int redundant_count;
+
+static int multipath_nexthop(csp_iface_t * iface, uint16_t via, csp_packet_t * packet, int from_me) {
+	(void)via;
+	(void)from_me;
+	if ((iface != &ifaces[0]) && (iface != &ifaces[1])) {
+		redundant_count++;
+	} else {
+		flow_iface[packet->data[0] | (packet->data[1] << 8)] = iface;
+	}
+	csp_buffer_free(packet);
+	return CSP_ERR_NONE;
+}
+
+static void send_flow(unsigned int flow) {
+	csp_packet_t * packet = csp_buffer_get(0);
+	ck_assert_ptr_nonnull(packet);
+	packet->data[0] = flow & 0xFF;
+	packet->data[1] = flow >> 8;
+	packet->length = 2;
+	csp_sendto(CSP_PRIO_NORM, 16 + (flow % 16), 10, 20 + (flow / 16), CSP_O_NONE, packet);
+}
+
+static void send_flows(void) {
+	for (unsigned int flow = 0; flow < FLOWS; flow++) {
+		send_flow(flow);
+	}
+}
+
+START_TEST(test_rtable_multipath)
+{
+	csp_init();
+	csp_rtable_free();
+
+	for (int i = 0; i < IFACES; i++) {
+		ifaces[i].nexthop = multipath_nexthop;
+	}
+
+	/* One in four flows on A, the others on B, and every packet on C */
+	ck_assert_int_eq(csp_rtable_set_route(16, 10, &ifaces[0], CSP_NO_VIA_ADDRESS, 1, 0), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_rtable_set_route(16, 10, &ifaces[1], CSP_NO_VIA_ADDRESS, 3, 0), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_rtable_set(16, 10, &ifaces[2], CSP_NO_VIA_ADDRESS), CSP_ERR_NONE);
+
+	memset(flow_iface, 0, sizeof(flow_iface));
+	redundant_count = 0;
+	send_flows();
+	ck_assert_int_eq(redundant_count, FLOWS);
+
+	int on_a = 0;
+	csp_iface_t * first[FLOWS];
+	for (int flow = 0; flow < FLOWS; flow++) {
+		ck_assert_ptr_nonnull(flow_iface[flow]);
+		on_a += (flow_iface[flow] == &ifaces[0]);
+		first[flow] = flow_iface[flow];
+	}
+	ck_assert_int_gt(on_a, FLOWS / 8);
+	ck_assert_int_lt(on_a, FLOWS * 3 / 8);
+
+	/* Flows stay on their route */
+	memset(flow_iface, 0, sizeof(flow_iface));
+	send_flows();
+	for (int flow = 0; flow < FLOWS; flow++) {
+		ck_assert_ptr_eq(flow_iface[flow], first[flow]);
+	}
+
+	/* Sends follow route changes, also right after sending to the same destination */
+	send_flow(0);
+	ck_assert_int_eq(csp_rtable_set_route(16, -1, &ifaces[1], CSP_NO_VIA_ADDRESS, 1, 0), CSP_ERR_NONE);
+	flow_iface[0] = NULL;
+	redundant_count = 0;
+	send_flow(0);
+	ck_assert_ptr_eq(flow_iface[0], &ifaces[1]);
+	ck_assert_int_eq(redundant_count, 0);
+
+	ck_assert_int_eq(csp_rtable_set(16, -1, &ifaces[2], CSP_NO_VIA_ADDRESS), CSP_ERR_NONE);
+	flow_iface[0] = NULL;
+	send_flow(0);
+	ck_assert_ptr_eq(flow_iface[0], &ifaces[1]);
+	ck_assert_int_eq(redundant_count, 1);
+
+#if (CSP_HAVE_STDIO)
+	for (int i = 0; i < IFACES; i++) {
+		csp_iflist_add(&ifaces[i]);
+	}
+	ck_assert_int_eq(csp_rtable_reload("16/10 A w1,16/10 B w3,16/10 C"), 3);
+	char saved[100];
+	ck_assert_int_eq(csp_rtable_save(saved, sizeof(saved)), CSP_ERR_NONE);
+	ck_assert_str_eq(saved, "16/10 A w1,16/10 B w3,16/10 C");
+
+	csp_rtable_free();
+	ck_assert_int_eq(csp_rtable_load(saved), 3);
+	char loaded[100];
+	ck_assert_int_eq(csp_rtable_save(loaded, sizeof(loaded)), CSP_ERR_NONE);
+	ck_assert_str_eq(loaded, saved);
+	for (int i = 0; i < IFACES; i++) {
+		csp_iflist_remove(&ifaces[i]);
+	}
+#endif
+
+	csp_rtable_free();
+}
+END_TEST
+
+START_TEST(test_rtable_many_hops)
+{
+	csp_init();
+	csp_rtable_free();
+
+	for (int i = 0; i < IFACES; i++) {
+		ifaces[i].nexthop = multipath_nexthop;
+	}
+	ck_assert_int_eq(csp_rtable_set_route(16, 10, &ifaces[0], CSP_NO_VIA_ADDRESS, 1, 0), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_rtable_set_route(16, 10, &ifaces[1], CSP_NO_VIA_ADDRESS, 3, 0), CSP_ERR_NONE);
+	ck_assert_int_eq(csp_rtable_set(16, 10, &ifaces[2], CSP_NO_VIA_ADDRESS), CSP_ERR_NONE);
+
+	memset(flow_iface, 0, sizeof(flow_iface));
+	send_flows();
+	csp_iface_t * cached[FLOWS];
+	memcpy(cached, flow_iface, sizeof(cached));
+
+	/* More hops than a destination in the egress cache has, sent while resolved */
+	static csp_iface_t more[5] = {{.name = "D"}, {.name = "E"}, {.name = "F"}, {.name = "G"}, {.name = "H"}};
+	for (int i = 0; i < 5; i++) {
+		more[i].nexthop = multipath_nexthop;
+		ck_assert_int_eq(csp_rtable_set(16, 10, &more[i], CSP_NO_VIA_ADDRESS), CSP_ERR_NONE);
+	}
+
+	memset(flow_iface, 0, sizeof(flow_iface));
+	redundant_count = 0;
+	send_flows();
+	ck_assert_int_eq(redundant_count, FLOWS * 6);
+
+	/* Each flow still on the multipath route it had */
+	for (int flow = 0; flow < FLOWS; flow++) {
+		ck_assert_ptr_nonnull(flow_iface[flow]);
+		ck_assert_ptr_eq(flow_iface[flow], cached[flow]);
+	}
+
+	csp_rtable_free();
+}
+END_TEST
+
+#endif
+
+Suite * rtable_suite(void)
+{
+	Suite *s;
+	TCase *tc_lookup;
+
+	s = suite_create("Routing table");
+
+	tc_lookup = tcase_create("lookup");
+#if (CSP_USE_RTABLE)
+	tcase_add_test(tc_lookup, test_rtable_lookup);
+	tcase_add_test(tc_lookup, test_rtable_via);
+	tcase_add_test(tc_lookup, test_rtable_versions);
+	tcase_add_test(tc_lookup, test_rtable_multipath);
+	tcase_add_test(tc_lookup, test_rtable_many_hops);
+#endif
+	suite_add_tcase(s, tc_lookup);
+
+	return s;
+}